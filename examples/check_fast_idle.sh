@@ -0,0 +1,53 @@
+#!/bin/bash
+# Checks that --fast-idle skips the polling loops of the fast-idle examples without
+# changing what a run prints: each program runs with and without --fast-idle, and the
+# outputs must match apart from the --stats lines.
+#   fast_idle_poll.g312        with 0-3 lead-in instructions before the loop
+#   os_scheduler_polling.g312  for 50M cycles
+# Run from anywhere after make: examples/check_fast_idle.sh
+set -u
+
+cd "$(dirname "$0")/.." || exit 1
+SIM=./gtu_sim
+ASSEMBLER=tools/gtu_assembler
+if [ ! -x "$SIM" ] || [ ! -x "$ASSEMBLER" ]; then
+    echo "Build the simulator and assembler first (make)." >&2
+    exit 1
+fi
+
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+FAILURES=0
+
+# check <name> <image> <max cycles> <least cycles to skip>
+check() {
+    local name=$1 image=$2 cycles=$3 least=$4
+    "$SIM" "$image" --max-cycles "$cycles" > "$WORK/plain.txt" 2>&1
+    "$SIM" "$image" --max-cycles "$cycles" --fast-idle --stats > "$WORK/fast.txt" 2>&1
+    local skipped
+    skipped=$(sed -n 's/^Fast idle: \([0-9]*\) cycles skipped.*/\1/p' "$WORK/fast.txt")
+    if ! grep -v -e '^Engine: ' -e '^Fast idle: ' "$WORK/fast.txt" | diff -q "$WORK/plain.txt" - > /dev/null; then
+        echo "FAIL $name: output differs with --fast-idle"
+        grep -v -e '^Engine: ' -e '^Fast idle: ' "$WORK/fast.txt" | diff "$WORK/plain.txt" - | head -n 10
+        FAILURES=$((FAILURES + 1))
+    elif [ "${skipped:-0}" -lt "$least" ]; then
+        echo "FAIL $name: skipped ${skipped:-0} cycles, expected at least $least"
+        FAILURES=$((FAILURES + 1))
+    else
+        echo "ok   $name: $skipped cycles skipped"
+    fi
+}
+
+# Lead-in instructions after START shift where in the loop the first probe lands
+for lead_in in 0 1 2 3; do
+    source="$WORK/fast_idle_poll_$lead_in.g312"
+    awk -v count="$lead_in" '{ print } /^START:/ { for (i = 1; i <= count; ++i) print "    SET " i " LEAD_IN" }' \
+        examples/fast_idle_poll.g312 > "$source"
+    "$ASSEMBLER" "$source" "${source%.g312}.img" "${source%.g312}_symbols.h" > /dev/null || exit 1
+    check "fast_idle_poll, $lead_in lead-in" "${source%.g312}.img" 0 4900000
+done
+
+"$ASSEMBLER" examples/os_scheduler_polling.g312 "$WORK/os_scheduler_polling.img" "$WORK/os_scheduler_polling_symbols.h" > /dev/null || exit 1
+check "os_scheduler_polling" "$WORK/os_scheduler_polling.img" 50000000 49000000
+
+exit $((FAILURES > 0))
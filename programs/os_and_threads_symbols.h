@@ -0,0 +1,163 @@
+// Auto-generated by GTU Assembler - DO NOT EDIT MANUALLY
+#ifndef ASSEMBLED_SYMBOLS_H
+#define ASSEMBLED_SYMBOLS_H
+
+// Memory Address Labels
+#define THREAD_3_PRINT_VALUE 1302
+#define THREAD_3_LIMIT 1301
+#define THREAD_2_SEARCH_RESULT 1251
+#define THREAD_2_SEARCH_TARGET 1250
+#define THREAD_2_SEARCH_ARRAY_9 1211
+#define THREAD_2_SEARCH_ARRAY_8 1210
+#define THREAD_2_SEARCH_ARRAY_7 1209
+#define THREAD_2_SEARCH_ARRAY_5 1207
+#define THREAD_2_SEARCH_ARRAY_4 1206
+#define THREAD_2_SEARCH_ARRAY_3 1205
+#define THREAD_2_ARRAY_START_ADDR 1201
+#define THREAD_2_ARRAY_SIZE 1200
+#define THREAD_1_TEMP_VAR_4 1153
+#define THREAD_2_SEARCH_ARRAY_6 1208
+#define THREAD_1_TEMP_VAR_3 1152
+#define THREAD_1_TEMP_VAR_2 1151
+#define THREAD_1_TEMP_VAR_1 1150
+#define THREAD_1_ARRAY_4 1105
+#define THREAD_1_ARRAY_2 1103
+#define THREAD_1_ARRAY_SIZE 1100
+#define THREAD_3_ID 327
+#define THREAD_2_ID 320
+#define THREAD_2_CURRENT_VALUE 1261
+#define THREAD_2_START_TIME 319
+#define THREAD_3_START_TIME 326
+#define THREAD_2_EXECS_USED 318
+#define THREAD_2_STATE 316
+#define THREAD_2_SP 315
+#define THREAD_1_ID 313
+#define THREAD_1_BLOCK_UNTIL 310
+#define THREAD_3_EXECS_USED 325
+#define BLOCK_TIME_PRN 26
+#define TCB_SIZE 27
+#define THREAD_2_CURRENT_INDEX 1260
+#define THREAD_2_SEARCH_ARRAY_2 1204
+#define MULTIPLY_ARG2 201
+#define THREAD_2_BLOCK_UNTIL 317
+#define THREAD_STATE_BLOCKED 23
+#define TOTAL_THREADS 29
+#define THREAD_1_ARRAY_1 1102
+#define THREAD_1_EXECS_USED 311
+#define CPU_OS_COMM_ADDR9 15
+#define ZERO_ADDR 20
+#define CPU_OS_COMM_ADDR 2
+#define CPU_OS_COMM_ADDR11 17
+#define SYSCALL_CODE_HLT 42
+#define CPU_OS_COMM_ADDR10 16
+#define NEXT_THREAD_TO_SCHEDULE 31
+#define CPU_OS_COMM_ADDR8 14
+#define THREAD_1_ARRAY_0 1101
+#define OS_THREAD_START_TIME 305
+#define THREAD_1_START_TIME 312
+#define CPU_OS_COMM_ADDR4 10
+#define THREAD_2_PC 314
+#define OS_THREAD_STATE 302
+#define THREAD_3_TEMP_VAR 1303
+#define SP_ADDR 1
+#define THREAD_2_SEARCH_ARRAY_1 1203
+#define TCB_TABLE_START 28
+#define SAVED_TRAP_PC_ADDR 4
+#define THREAD_1_ARRAY_3 1104
+#define THREAD_1_SP 308
+#define MULTIPLY_ARG1 200
+#define INSTR_COUNT_ADDR 3
+#define THREAD_STATE_READY 21
+#define THREAD_3_SP 322
+#define TEMP_VAR_1 32
+#define THREAD_3_COUNTER 1300
+#define THREAD_1_TEMP_VAR_5 1154
+#define MULTIPLY_COUNTER 203
+#define CPU_OS_COMM_ADDR7 13
+#define SYSCALL_ARG2_PASS_ADDR 6
+#define SYSCALL_ARG1_PASS_ADDR 5
+#define THREAD_STATE_RUNNING 22
+#define CPU_OS_COMM_ADDR2 8
+#define SYSCALL_ARG3_PASS_ADDR 7
+#define THREAD_2_TEMP_VAR 1262
+#define THREAD_3_BLOCK_UNTIL 324
+#define PC_ADDR 0
+#define CPU_OS_COMM_ADDR3 9
+#define THREAD_2_SEARCH_ARRAY_0 1202
+#define CPU_OS_COMM_ADDR13 19
+#define CPU_OS_COMM_ADDR5 11
+#define THREAD_STATE_TERMINATED 24
+#define CURRENT_THREAD_ID 30
+#define CPU_OS_COMM_ADDR6 12
+#define TEMP_VAR_2 33
+#define NEGATIVE_ONE 35
+#define TEMP_VAR_3 34
+#define MULTIPLY_RESULT 202
+#define KERNEL_STACK_POINTER 36
+#define ARE_EQUAL_TEMP2 205
+#define SYSCALL_CODE_PRN 41
+#define SYSCALL_CODE_YIELD 43
+#define ARE_EQUAL_TEMP1 204
+#define THREAD_3_STATE 323
+#define CPU_OS_COMM_ADDR12 18
+#define TEMP_VAR_5 39
+#define OS_THREAD_SP 301
+#define TEMP_VAR_4 38
+#define TEMP_VAR_6 40
+#define OS_THREAD_PC 300
+#define OS_THREAD_BLOCK_UNTIL 303
+#define OS_THREAD_EXECS_USED 304
+#define OS_THREAD_ID 306
+#define THREAD_3_PC 321
+#define THREAD_1_PC 307
+#define SCHEDULER_LOOP_COUNTER 37
+#define THREAD_1_STATE 309
+
+// Exported symbol addresses from assembly
+#define OS_SYSCALL_DISPATCHER 2
+#define OS_MEMORY_FAULT_HANDLER_PC 145
+#define OS_ARITHMETIC_FAULT_HANDLER_PC 147
+#define OS_UNKNOWN_INSTRUCTION_HANDLER_PC 150
+#define THREAD_1_START 153
+#define THREAD_2_START 163
+#define THREAD_3_START 185
+
+// All exported symbols
+#define SYMBOL_CUSTOM_DONE 195
+#define SYMBOL_CUSTOM_LOOP 186
+#define SYMBOL_SEARCH_NOT_FOUND 183
+#define SYMBOL_SEARCH_CONTINUE 169
+#define SYMBOL_CUSTOM_CONTINUE 191
+#define SYMBOL_SEARCH_LOOP_NEXT 177
+#define SYMBOL_FIND_LOOP_START_POINT 54
+#define SYMBOL_SCHEDULER_FIND_LOOP 55
+#define SYMBOL_ROUND_ROBIN_START_SEARCH 47
+#define SYMBOL_GET_TCB_DONE 125
+#define SYMBOL_OS_HANDLE_HLT_THREAD 31
+#define SYMBOL_CHECK_ID_3 120
+#define SYMBOL_SEARCH_LOOP 164
+#define SYMBOL_CHECK_FOR_YIELD 17
+#define SYMBOL_SEARCH_FOUND 180
+#define SYMBOL_CHECK_FOR_HALT 12
+#define SYMBOL_OS_HANDLE_YIELD 35
+#define SYMBOL_OS_BOOT_START 0
+#define SYMBOL_UNKNOWN_SYSCALL 22
+#define SYMBOL_ARE_EQUAL_THEY_ARE_EQUAL 143
+#define SYMBOL_OS_SCHEDULER 39
+#define SYMBOL_SCHEDULER_LOOP_NEXT 81
+#define SYMBOL_SCHEDULER_CHECK_READY 74
+#define SYMBOL_UNBLOCK_AND_DISPATCH 78
+#define SYMBOL_OS_DISPATCH_THREAD 89
+#define SYMBOL_CHECK_ID_2 114
+#define SYMBOL_MULTIPLY 100
+#define SYMBOL_OS_HANDLE_PRN 23
+#define SYMBOL_MULTIPLY_LOOP 102
+#define SYMBOL_GET_CURRENT_TCB_ADDR 126
+#define SYMBOL_MULTIPLY_END 106
+#define SYMBOL_GET_NEXT_TCB_AND_STATE 60
+#define SYMBOL_OS_HALT 99
+#define SYMBOL_GET_TCB_ADDR_FOR_ID 107
+#define SYMBOL_ARE_EQUAL_CHECK_SECOND_CONDITION 137
+#define SYMBOL_ARE_EQUAL 129
+
+#endif // ASSEMBLED_SYMBOLS_H
@@ -0,0 +1,469 @@
+// src/batch.cpp
+#include "batch.h"
+#include "ensemble.h"    // For --ensemble lockstep runs
+#include "memory.h"      // For per-job Memory copies
+#include "prn_sink.h"    // For recording PRN output
+#include "program.h"     // For the shared Program
+#include "snapshot.h"    // For jobs starting from a snapshot
+#include <algorithm>     // For std::min
+#include <chrono>        // For ensemble timings
+#include <deque>         // For per-worker task queues
+#include <fstream>       // For job and image files
+#include <functional>    // For std::function tasks
+#include <iomanip>       // For hex digests
+#include <iostream>      // For std::cerr
+#include <limits>        // For unlimited max-cycles
+#include <map>           // For the image cache
+#include <memory>        // For std::unique_ptr queues and shared programs
+#include <mutex>         // For queue locks
+#include <sstream>       // For line parsing
+#include <stdexcept>     // For runtime_error
+#include <thread>        // For worker threads
+
+namespace
+{
+
+// Fixed set of tasks spread over per-worker deques. A worker takes its own tasks from
+// the back and, once it runs dry, steals from the front of the others. Tasks do not
+// spawn tasks, so a worker that finds every queue empty is done.
+class WorkStealingPool
+{
+public:
+    explicit WorkStealingPool(unsigned workers) : queues_(workers == 0 ? 1 : workers)
+    {
+        for (auto &queue : queues_)
+            queue.reset(new WorkerQueue());
+    }
+
+    // Runs task(i) for every i in [0, count) and returns once all have finished.
+    // task must not throw.
+    void run(size_t count, const std::function<void(size_t)> &task)
+    {
+        for (size_t i = 0; i < count; ++i)
+            queues_[i % queues_.size()]->tasks.push_back(i);
+
+        std::vector<std::thread> threads;
+        for (size_t worker = 1; worker < queues_.size(); ++worker)
+            threads.emplace_back([this, worker, &task]
+                                 { work(worker, task); });
+        work(0, task);
+        for (std::thread &thread : threads)
+            thread.join();
+    }
+
+private:
+    struct WorkerQueue
+    {
+        std::mutex mutex;
+        std::deque<size_t> tasks;
+    };
+    std::vector<std::unique_ptr<WorkerQueue>> queues_;
+
+    bool take(size_t worker, size_t &task)
+    {
+        {
+            WorkerQueue &own = *queues_[worker];
+            std::lock_guard<std::mutex> lock(own.mutex);
+            if (!own.tasks.empty())
+            {
+                task = own.tasks.back();
+                own.tasks.pop_back();
+                return true;
+            }
+        }
+        for (size_t offset = 1; offset < queues_.size(); ++offset)
+        {
+            WorkerQueue &victim = *queues_[(worker + offset) % queues_.size()];
+            std::lock_guard<std::mutex> lock(victim.mutex);
+            if (!victim.tasks.empty())
+            {
+                task = victim.tasks.front();
+                victim.tasks.pop_front();
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void work(size_t worker, const std::function<void(size_t)> &task)
+    {
+        size_t index;
+        while (take(worker, index))
+            task(index);
+    }
+};
+
+// Program shared read-only by all jobs with the same file and memory size
+struct LoadedImage
+{
+    std::shared_ptr<const Program> program;
+    std::shared_ptr<const MachineSnapshot> snapshot; // Machine to start from, for snapshot files
+    std::string error;                               // Set if the image could not be loaded
+};
+
+struct BatchResult
+{
+    std::string status;
+    uint64_t cycles = 0;
+    std::vector<long> prn_output;
+    uint64_t memory_digest = 0;
+    std::string error;
+};
+
+LoadedImage loadImage(const std::string &filename, size_t memory_size)
+{
+    LoadedImage image;
+    try
+    {
+        if (isSnapshotFile(filename))
+        {
+            image.snapshot = std::make_shared<const MachineSnapshot>(loadSnapshot(filename));
+            image.program = image.snapshot->program;
+        }
+        else
+        {
+            image.program = Program::load(filename, memory_size);
+        }
+    }
+    catch (const std::runtime_error &e)
+    {
+        image.error = e.what();
+    }
+    return image;
+}
+
+// FNV-1a over the bytes of every cell
+uint64_t memoryDigest(const Memory &memory)
+{
+    uint64_t hash = 14695981039346656037ull;
+    for (size_t address = 0; address < memory.getSize(); ++address)
+    {
+        unsigned long value = static_cast<unsigned long>(memory.readUnchecked(static_cast<long>(address)));
+        for (size_t byte = 0; byte < sizeof(value); ++byte)
+        {
+            hash ^= (value >> (8 * byte)) & 0xff;
+            hash *= 1099511628211ull;
+        }
+    }
+    return hash;
+}
+
+void runJob(const BatchJob &job, const LoadedImage &image, CpuEngine engine, BatchResult &result)
+{
+    if (!image.program)
+    {
+        result.status = "error";
+        result.error = image.error;
+        return;
+    }
+    try
+    {
+        Memory memory(image.program->initialMemory());
+        MemoryPrnSink prn;
+        CPU cpu(memory, image.program, prnCallback(prn));
+        if (image.snapshot)
+            cpu.restore(*image.snapshot);
+
+        for (const auto &patch : job.patches)
+        {
+            if (!memory.isValidAddress(patch.first))
+                throw std::runtime_error("Error L" + std::to_string(job.source_line) + ": " + memory.outOfBoundsMessage(patch.first));
+            memory.write(patch.first, patch.second);
+        }
+        cpu.syncRegistersFromMemory(); // Patches may change the PC, SP or instruction counter
+        cpu.setEngine(engine);
+        cpu.setFaultLog(nullptr); // Jobs run concurrently; diagnostics would interleave
+
+        result.cycles = cpu.run(job.max_cycles).instructions_executed;
+        result.status = cpu.isHalted() ? "halted" : "cycle_limit";
+        result.prn_output = prn.take();
+        result.memory_digest = memoryDigest(memory);
+    }
+    catch (const std::exception &e)
+    {
+        result.status = "error";
+        result.error = e.what();
+    }
+}
+
+std::string jsonString(const std::string &text)
+{
+    std::ostringstream out;
+    out << '"';
+    for (char c : text)
+    {
+        if (c == '"' || c == '\\')
+            out << '\\' << c;
+        else if (static_cast<unsigned char>(c) < 0x20)
+            out << "\\u" << std::hex << std::setw(4) << std::setfill('0') << static_cast<int>(c) << std::dec;
+        else
+            out << c;
+    }
+    out << '"';
+    return out.str();
+}
+
+unsigned long parseUnsigned(const std::string &text, const BatchJob &job, const std::string &key)
+{
+    try
+    {
+        size_t used = 0;
+        unsigned long value = std::stoul(text, &used);
+        if (used == text.size() && text[0] != '-')
+            return value;
+    }
+    catch (const std::exception &)
+    {
+    }
+    throw std::runtime_error("Error L" + std::to_string(job.source_line) + ": Invalid value for " + key + ": '" + text + "'.");
+}
+
+long parseSigned(const std::string &text, const BatchJob &job)
+{
+    try
+    {
+        size_t used = 0;
+        long value = std::stol(text, &used);
+        if (used == text.size())
+            return value;
+    }
+    catch (const std::exception &)
+    {
+    }
+    throw std::runtime_error("Error L" + std::to_string(job.source_line) + ": Invalid patch number '" + text + "'.");
+}
+
+} // namespace
+
+std::vector<BatchJob> parseJobFile(const std::string &filename)
+{
+    std::ifstream file(filename);
+    if (!file.is_open())
+        throw std::runtime_error("Could not open job file '" + filename + "'.");
+
+    std::vector<BatchJob> jobs;
+    std::string line;
+    int line_number = 0;
+    while (std::getline(file, line))
+    {
+        ++line_number;
+        size_t comment = line.find('#');
+        if (comment != std::string::npos)
+            line.erase(comment);
+
+        std::istringstream fields(line);
+        BatchJob job;
+        job.source_line = line_number;
+        if (!(fields >> job.image))
+            continue; // Blank line
+
+        std::string field;
+        bool memory_size_given = false;
+        while (fields >> field)
+        {
+            size_t equals = field.find('=');
+            std::string key = field.substr(0, equals);
+            std::string value = equals == std::string::npos ? "" : field.substr(equals + 1);
+            if (value.empty())
+                throw std::runtime_error("Error L" + std::to_string(line_number) + ": Expected key=value, got '" + field + "'.");
+
+            if (key == "memory-size")
+            {
+                job.memory_size = parseUnsigned(value, job, key);
+                if (job.memory_size == 0)
+                    throw std::runtime_error("Error L" + std::to_string(line_number) + ": Memory size cannot be zero.");
+                memory_size_given = true;
+            }
+            else if (key == "max-cycles")
+            {
+                job.max_cycles = parseUnsigned(value, job, key);
+                if (job.max_cycles == 0)
+                    job.max_cycles = std::numeric_limits<uint64_t>::max(); // No limit
+            }
+            else if (key == "patch")
+            {
+                size_t colon = value.find(':');
+                if (colon == std::string::npos)
+                    throw std::runtime_error("Error L" + std::to_string(line_number) + ": Expected patch=ADDR:VALUE, got '" + field + "'.");
+                job.patches.emplace_back(parseSigned(value.substr(0, colon), job), parseSigned(value.substr(colon + 1), job));
+            }
+            else
+            {
+                throw std::runtime_error("Error L" + std::to_string(line_number) + ": Unknown job option '" + key + "'.");
+            }
+        }
+        if (memory_size_given && isSnapshotFile(job.image))
+            throw std::runtime_error("Error L" + std::to_string(line_number) + ": memory-size does not apply to snapshot '" +
+                                     job.image + "', which has its own memory size.");
+        jobs.push_back(job);
+    }
+    return jobs;
+}
+
+namespace
+{
+
+// Writes the summary lines and returns the number of failed jobs
+size_t writeSummary(const std::vector<BatchJob> &jobs, const std::vector<BatchResult> &results, std::ostream &summary)
+{
+    size_t failed = 0;
+    for (size_t i = 0; i < jobs.size(); ++i)
+    {
+        const BatchResult &result = results[i];
+        summary << "{\"job\":" << i + 1 << ",\"line\":" << jobs[i].source_line
+                << ",\"image\":" << jsonString(jobs[i].image)
+                << ",\"status\":\"" << result.status << "\"";
+        if (result.status == "error")
+        {
+            summary << ",\"error\":" << jsonString(result.error) << "}\n";
+            ++failed;
+            continue;
+        }
+        summary << ",\"cycles\":" << result.cycles << ",\"prn\":[";
+        for (size_t v = 0; v < result.prn_output.size(); ++v)
+            summary << (v ? "," : "") << result.prn_output[v];
+        summary << "],\"memory_digest\":\"" << std::hex << std::setw(16) << std::setfill('0')
+                << result.memory_digest << std::dec << std::setfill(' ') << "\"}\n";
+    }
+    summary.flush();
+    return failed;
+}
+
+double secondsSince(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+double mips(uint64_t instructions, double seconds)
+{
+    return seconds > 0 ? static_cast<double>(instructions) / seconds / 1e6 : 0.0;
+}
+
+// Jobs as lanes of one Ensemble; with options.verify_ensemble also verified against and
+// timed next to separate runs
+void runEnsemble(const std::vector<BatchJob> &jobs, const LoadedImage &image, const BatchOptions &options,
+                 std::vector<BatchResult> &results)
+{
+    // Jobs with an invalid patch fail on their own, as they would on the pool
+    std::vector<size_t> lane_jobs;
+    for (size_t i = 0; i < jobs.size(); ++i)
+    {
+        bool valid = true;
+        for (const auto &patch : jobs[i].patches)
+        {
+            if (!image.program->initialMemory().isValidAddress(patch.first))
+            {
+                results[i].status = "error";
+                results[i].error = "Error L" + std::to_string(jobs[i].source_line) + ": " +
+                                   image.program->initialMemory().outOfBoundsMessage(patch.first);
+                valid = false;
+                break;
+            }
+        }
+        if (valid)
+            lane_jobs.push_back(i);
+    }
+
+    Ensemble ensemble(image.program, lane_jobs.size());
+    if (image.snapshot)
+        ensemble.restore(*image.snapshot);
+    std::vector<uint64_t> max_cycles;
+    for (size_t lane = 0; lane < lane_jobs.size(); ++lane)
+    {
+        const BatchJob &job = jobs[lane_jobs[lane]];
+        for (const auto &patch : job.patches)
+            ensemble.patch(lane, patch.first, patch.second);
+        max_cycles.push_back(job.max_cycles);
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    ensemble.run(max_cycles);
+    double ensemble_seconds = secondsSince(start);
+
+    uint64_t instructions = 0;
+    Memory memory(image.program->memorySize());
+    for (size_t lane = 0; lane < lane_jobs.size(); ++lane)
+    {
+        BatchResult &result = results[lane_jobs[lane]];
+        result.cycles = ensemble.instructionsExecuted(lane);
+        result.status = ensemble.isHalted(lane) ? "halted" : "cycle_limit";
+        result.prn_output = ensemble.prnOutput(lane);
+        ensemble.copyLaneTo(lane, memory);
+        result.memory_digest = memoryDigest(memory);
+        instructions += result.cycles;
+    }
+
+    if (!options.show_stats && !options.verify_ensemble)
+        return;
+
+    double separate_seconds = 0;
+    if (options.verify_ensemble)
+    {
+        start = std::chrono::steady_clock::now();
+        std::vector<BatchResult> separate(lane_jobs.size());
+        for (size_t lane = 0; lane < lane_jobs.size(); ++lane)
+            runJob(jobs[lane_jobs[lane]], image, options.engine, separate[lane]);
+        separate_seconds = secondsSince(start);
+
+        for (size_t lane = 0; lane < lane_jobs.size(); ++lane)
+        {
+            const BatchResult &expected = separate[lane];
+            const BatchResult &actual = results[lane_jobs[lane]];
+            if (expected.status != actual.status || expected.cycles != actual.cycles ||
+                expected.prn_output != actual.prn_output || expected.memory_digest != actual.memory_digest)
+                throw std::runtime_error("Ensemble mismatch for job " + std::to_string(lane_jobs[lane] + 1) +
+                                         " (line " + std::to_string(jobs[lane_jobs[lane]].source_line) + ").");
+        }
+    }
+
+    std::cerr << std::fixed << std::setprecision(3)
+              << "Ensemble: " << lane_jobs.size() << " lanes (" << Ensemble::vectorIsa() << "), "
+              << instructions << " instructions in " << ensemble_seconds << " s, "
+              << mips(instructions, ensemble_seconds) << " MIPS aggregate" << std::endl;
+    if (options.verify_ensemble)
+        std::cerr << "Separate runs: " << separate_seconds << " s, " << mips(instructions, separate_seconds) << " MIPS" << std::endl;
+    std::cerr << "Lane instructions: " << ensemble.vectorLaneInstructions() << " vector, "
+              << ensemble.scalarLaneInstructions() << " lane by lane" << std::endl;
+    std::cerr.unsetf(std::ios::floatfield);
+}
+
+} // namespace
+
+size_t runBatch(const std::vector<BatchJob> &jobs, const BatchOptions &options, std::ostream &summary)
+{
+    // Parse each distinct image once, before any job starts. A snapshot brings its own
+    // memory size, so it is one image whatever the job's memory size.
+    std::map<std::pair<std::string, size_t>, LoadedImage> images;
+    std::map<std::string, bool> snapshot_files;
+    std::vector<const LoadedImage *> job_images;
+    for (const BatchJob &job : jobs)
+    {
+        auto snapshot = snapshot_files.find(job.image);
+        if (snapshot == snapshot_files.end())
+            snapshot = snapshot_files.emplace(job.image, isSnapshotFile(job.image)).first;
+        std::pair<std::string, size_t> key(job.image, snapshot->second ? 0 : job.memory_size);
+        auto found = images.find(key);
+        if (found == images.end())
+            found = images.emplace(key, loadImage(job.image, job.memory_size)).first;
+        job_images.push_back(&found->second);
+    }
+
+    std::vector<BatchResult> results(jobs.size());
+    if (options.ensemble)
+    {
+        if (images.size() > 1)
+            throw std::runtime_error("--ensemble needs every job to use the same image and memory size.");
+        if (images.size() == 1 && !images.begin()->second.program)
+            throw std::runtime_error(images.begin()->second.error);
+        if (!jobs.empty())
+            runEnsemble(jobs, images.begin()->second, options, results);
+        return writeSummary(jobs, results, summary);
+    }
+
+    unsigned threads = options.threads != 0 ? options.threads : std::thread::hardware_concurrency();
+    WorkStealingPool pool(static_cast<unsigned>(std::min<size_t>(threads, jobs.size())));
+    pool.run(jobs.size(), [&](size_t i)
+             { runJob(jobs[i], *job_images[i], options.engine, results[i]); });
+
+    return writeSummary(jobs, results, summary);
+}
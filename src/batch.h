@@ -0,0 +1,56 @@
+// src/batch.h
+#ifndef BATCH_H
+#define BATCH_H
+
+#include "cpu.h"   // For CpuEngine
+#include <cstdint> // For uint64_t cycle limits
+#include <iosfwd>  // For std::ostream summary output
+#include <string>  // For std::string paths
+#include <utility> // For std::pair data patches
+#include <vector>  // For std::vector job lists
+
+// One line of a job file:
+//   <image.img> [memory-size=N] [max-cycles=N] [patch=ADDR:VALUE ...]
+// Blank lines and text after '#' are ignored; max-cycles=0 means no limit. Patches are
+// applied to the loaded data section in order, before the first instruction runs. The
+// image may also be a snapshot file written by --save-snapshot: the job then continues
+// from the snapshot (memory size taken from it, so memory-size is rejected), and
+// max-cycles counts the instructions run after it.
+struct BatchJob
+{
+    std::string image;
+    size_t memory_size = 11000;
+    uint64_t max_cycles = 200000;
+    std::vector<std::pair<long, long>> patches;
+    int source_line = 0;
+};
+
+struct BatchOptions
+{
+    CpuEngine engine = CpuEngine::SWITCH;
+    unsigned threads = 0; // 0: one per hardware thread
+    bool ensemble = false; // Run all jobs in lockstep on one Ensemble instead of the pool
+    bool show_stats = false;      // With ensemble: report its throughput on std::cerr
+    bool verify_ensemble = false; // With ensemble: also run the jobs separately and compare
+};
+
+// Parses a job file. Throws std::runtime_error ("Error L<line>: ...") on malformed lines.
+std::vector<BatchJob> parseJobFile(const std::string &filename);
+
+// Runs every job on a work-stealing pool and writes one JSON object per job, in job
+// order, to summary:
+//   {"job":N,"image":"...","status":"halted"|"cycle_limit"|"error","cycles":N,
+//    "prn":[...],"memory_digest":"<FNV-1a 64 of all cells, hex>"}
+// Failed jobs carry "error" instead of the run fields. Jobs with the same image and
+// memory size share one Program (decoded code and initial data image). Returns the
+// number of jobs that failed to load.
+//
+// With options.ensemble every job must use the same image and memory size, and the jobs
+// run as lanes of one Ensemble. options.show_stats reports the ensemble's throughput on
+// std::cerr. options.verify_ensemble then runs the jobs once more, one after another on
+// options.engine, checks each lane against its separate run and reports the throughput
+// of both. Throws std::runtime_error if the jobs do not share an image or a verified
+// lane differs from its separate run.
+size_t runBatch(const std::vector<BatchJob> &jobs, const BatchOptions &options, std::ostream &summary);
+
+#endif // BATCH_H
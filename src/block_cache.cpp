@@ -0,0 +1,107 @@
+// src/block_cache.cpp
+#include "block_cache.h"
+
+BlockCache::BlockCache(const DecodedProgram &program, bool user_mode)
+    : program_(program),
+      mode_(user_mode ? 1 : 0),
+      is_jump_target_(program.size(), false),
+      block_at_pc_(program.size(), -1)
+{
+    // Static leaders. Dynamic targets (RET, USER, traps, PC_ADDR writes) get a block
+    // translated from wherever they land.
+    for (size_t pc = 0; pc < program.size(); ++pc)
+    {
+        const DecodedInstruction &instr = program.code[pc];
+        long target = -1;
+        if (instr.opcode == OpCode::JIF)
+            target = instr.arg2;
+        else if (instr.opcode == OpCode::CALL)
+            target = instr.arg1;
+        if (target >= 0 && static_cast<size_t>(target) < program.size())
+            is_jump_target_[static_cast<size_t>(target)] = true;
+    }
+}
+
+bool BlockCache::isTranslatable(const DecodedInstruction &instr) const
+{
+    switch (instr.opcode)
+    {
+    case OpCode::SET:
+    case OpCode::CPY:
+    case OpCode::ADD:
+    case OpCode::ADDI:
+    case OpCode::SUBI:
+        return instr.proven_operands[mode_] == directOperands(instr.opcode);
+    default:
+        return false;
+    }
+}
+
+int32_t BlockCache::blockAt(long pc)
+{
+    int32_t index = block_at_pc_[static_cast<size_t>(pc)];
+    return index >= 0 ? index : translate(pc);
+}
+
+int32_t BlockCache::translate(long pc)
+{
+    TranslatedBlock block;
+    block.start_pc = pc;
+    block.first_op = static_cast<uint32_t>(ops_.size());
+    block.next_fallthrough = -1;
+    block.next_taken = -1;
+    block.taken_pc = -1;
+
+    // The END sentinel is never translatable, so the scan stops at the latest there.
+    long end = pc;
+    while (isTranslatable(program_.code[static_cast<size_t>(end)]))
+    {
+        const DecodedInstruction &instr = program_.code[static_cast<size_t>(end)];
+        ops_.push_back({instr.opcode, instr.arg1, instr.arg2});
+        ++end;
+        if (static_cast<size_t>(end) < program_.size() && is_jump_target_[static_cast<size_t>(end)])
+            break;
+    }
+
+    block.end_pc = end;
+    block.num_ops = static_cast<uint32_t>(ops_.size()) - block.first_op;
+    const DecodedInstruction &last = program_.code[static_cast<size_t>(end)];
+    block.has_exit = !isTranslatable(last);
+    block.fallthrough_pc = block.has_exit ? end + 1 : end;
+    if (block.has_exit && last.opcode == OpCode::JIF)
+        block.taken_pc = last.arg2;
+    else if (block.has_exit && last.opcode == OpCode::CALL)
+        block.taken_pc = last.arg1;
+
+    int32_t index = static_cast<int32_t>(blocks_.size());
+    blocks_.push_back(block);
+    block_at_pc_[static_cast<size_t>(pc)] = index;
+    return index;
+}
+
+int32_t BlockCache::successor(int32_t index, long pc)
+{
+    if (pc < 0 || static_cast<size_t>(pc) >= program_.size())
+        return -1;
+
+    // Look up by value: translating may reallocate blocks_.
+    if (pc == blocks_[static_cast<size_t>(index)].fallthrough_pc)
+    {
+        if (blocks_[static_cast<size_t>(index)].next_fallthrough < 0)
+        {
+            int32_t next = blockAt(pc);
+            blocks_[static_cast<size_t>(index)].next_fallthrough = next;
+        }
+        return blocks_[static_cast<size_t>(index)].next_fallthrough;
+    }
+    if (pc == blocks_[static_cast<size_t>(index)].taken_pc)
+    {
+        if (blocks_[static_cast<size_t>(index)].next_taken < 0)
+        {
+            int32_t next = blockAt(pc);
+            blocks_[static_cast<size_t>(index)].next_taken = next;
+        }
+        return blocks_[static_cast<size_t>(index)].next_taken;
+    }
+    return blockAt(pc);
+}
@@ -0,0 +1,71 @@
+// src/block_cache.h
+#ifndef BLOCK_CACHE_H
+#define BLOCK_CACHE_H
+
+#include "decoder.h" // For DecodedProgram and OpCode
+#include <cstdint>   // For int32_t block indices
+#include <vector>    // For std::vector containers
+
+// Straight-line operation inside a translated block. Only instructions that cannot fault,
+// change the PC or touch the memory-mapped registers are translated: SET, CPY, ADD, ADDI
+// and SUBI whose direct operands are all proven for the privilege mode.
+struct BlockOp
+{
+    OpCode opcode;
+    long arg1;
+    long arg2;
+};
+
+struct TranslatedBlock
+{
+    long start_pc;
+    long end_pc;               // PC after the translated body: the exit instruction or the next block
+    uint32_t first_op;         // Body: BlockCache::ops()[first_op, first_op + num_ops)
+    uint32_t num_ops;
+    bool has_exit;             // The instruction at end_pc ends the block and is single-stepped
+    long fallthrough_pc;       // Static successors: the next sequential PC and the
+    long taken_pc;             // JIF/CALL target of the exit instruction (-1 if none)
+    int32_t next_fallthrough;  // Chained successor blocks, -1 until first followed
+    int32_t next_taken;
+};
+
+// Translation cache for one privilege mode. Blocks are keyed by their entry PC and
+// translated on first use. A block ends before a static jump target (JIF or CALL operand)
+// and at the first instruction that cannot be translated: JIF, CALL, RET, USER, SYSCALL,
+// HLT, holes, and anything that may fault or access addresses 0-3 (which includes every
+// data write to PC_ADDR). Entering in the middle of a block (e.g. through RET) translates
+// a new block from that PC.
+class BlockCache
+{
+public:
+    // proven_operands and the program must not change while the cache is in use.
+    BlockCache(const DecodedProgram &program, bool user_mode);
+
+    // Index of the block entered at pc (0 <= pc < program size), translating it if needed
+    int32_t blockAt(long pc);
+
+    // Block to run after block index once it left with the PC at pc, following (and
+    // filling in) the chain for static successors. -1 if pc is outside the program.
+    int32_t successor(int32_t index, long pc);
+
+    const TranslatedBlock &block(int32_t index) const { return blocks_[static_cast<size_t>(index)]; }
+    const BlockOp *ops() const { return ops_.data(); }
+    size_t blockCount() const { return blocks_.size(); }
+
+    // Instruction at the block's end_pc (the END sentinel if it runs off the program)
+    const DecodedInstruction &exitInstruction(const TranslatedBlock &block) const { return program_.code[static_cast<size_t>(block.end_pc)]; }
+    int mode() const { return mode_; }
+
+private:
+    const DecodedProgram &program_;
+    int mode_;                          // proven_operands index: 0 kernel, 1 user
+    std::vector<bool> is_jump_target_;  // Indexed by PC
+    std::vector<int32_t> block_at_pc_;  // Indexed by PC, -1 if not translated yet
+    std::vector<TranslatedBlock> blocks_;
+    std::vector<BlockOp> ops_;
+
+    bool isTranslatable(const DecodedInstruction &instr) const;
+    int32_t translate(long pc);
+};
+
+#endif // BLOCK_CACHE_H
@@ -6,12 +6,14 @@
 constexpr long PC_ADDR = 0;
 constexpr long SP_ADDR = 1;
 constexpr long CPU_OS_COMM_ADDR = 2;
-constexpr long INSTR_COUNT_ADDR = 3;
+constexpr long INSTR_COUNT_ADDR = 3; // Instructions executed; cells are 64-bit, so it does not wrap
 constexpr long SAVED_TRAP_PC_ADDR = 4;
 constexpr long SYSCALL_ARG1_PASS_ADDR = 5;
 constexpr long SYSCALL_ARG2_PASS_ADDR = 6;
 constexpr long REGISTERS_END_ADDR = 20;
 
+static_assert(sizeof(long) == 8, "memory cells and the instruction counter are 64-bit");
+
 // Try to include auto-generated symbols from assembler
 #ifdef USE_ASSEMBLED_SYMBOLS
 #include "os_and_threads_symbols.h"
@@ -1,64 +1,134 @@
 // src/cpu.cpp
 #include "cpu.h"
+#include "block_cache.h" // For the BLOCK engine
+#include "jit.h"         // For the JIT engine
+#include "opcode_costs.h" // For USE_OPCODE_COSTS
 #include "memory.h"      // Now included in implementation
+#include "program.h"     // For the shared Program
+#include "snapshot.h"    // For MachineSnapshot
 #include "instruction.h" // Now included in implementation  
 #include "common.h"
+#include <algorithm> // For std::min
+#include <climits>   // For LONG_MAX
 #include <iostream>  // For error messages, potentially for SYSCALL_PRN if callback not used externally
 #include <stdexcept> // For runtime_error
 #include <vector>    // For std::vector
-#include <sstream>   // For std::ostringstream
 
-// Constructor
+// Constructors
 CPU::CPU(Memory &mem,
-         const std::vector<Instruction> &instructions,
+         std::shared_ptr<const Program> program,
          std::function<void(long)> prn_callback)
     : memory_(mem),
-      program_instructions_(instructions),
+      shared_program_(std::move(program)),
+      program_(shared_program_->code()),
       prn_system_call_handler_(prn_callback),
+      fault_log_(&std::cerr),
       halted_flag_(false),
       user_mode_flag_(false),// CPU starts in KERNEL mode
-      pc_modified_by_data_operation_(false) 
+      engine_(CpuEngine::SWITCH),
+      stop_events_(0),
+      pc_(0),
+      next_pc_(0),
+      sp_(0),
+      instr_count_(0),
+      user_span_(0),
+      fused_op_counts_()
 {
     // Ensure memory has minimal size for registers
     if (memory_.getSize() < REGISTERS_END_ADDR + 1)
     { 
         throw std::runtime_error("Memory size too small for CPU registers.");
     }
+    // The operand proofs hold for the program's memory size only
+    if (memory_.getSize() != shared_program_->memorySize())
+    {
+        throw std::runtime_error("Memory has " + std::to_string(memory_.getSize()) + " cells, but the program was prepared for " +
+                                 std::to_string(shared_program_->memorySize()) + ".");
+    }
+    if (memory_.getSize() > static_cast<size_t>(USER_MEMORY_START_ADDR))
+        user_span_ = memory_.getSize() - USER_MEMORY_START_ADDR;
+#ifdef USE_OPCODE_COSTS
+    opcode_costs_.reset(new OpcodeCosts());
+#endif
     reset(); // Initialize registers from memory (or to defaults if memory is zeroed)
 }
 
+CPU::CPU(Memory &mem,
+         const std::vector<Instruction> &instructions,
+         std::function<void(long)> prn_callback)
+    : CPU(mem, Program::create(instructions, mem), std::move(prn_callback))
+{
+}
+
+CPU::~CPU() = default; // Out of line: BlockCache and OpcodeCosts are incomplete in cpu.h
+
 // Resets CPU state
 void CPU::reset()
 {
     halted_flag_ = false;
     user_mode_flag_ = false; // Start in kernel mode
-    pc_modified_by_data_operation_ = false;
+    fault_ = FaultRecord();
+    stop_events_ = 0;
+    syncRegistersFromMemory();
 }
 
-// --- Register Access Helper Methods ---
-long CPU::getPC() const
+// --- Snapshots ---
+
+MachineSnapshot CPU::snapshot(uint64_t cycles) const
 {
-    return memory_.read(PC_ADDR);
+    MachineSnapshot snapshot;
+    snapshot.program = shared_program_;
+    snapshot.memory = memory_;
+    snapshot.memory.write(PC_ADDR, pc_);
+    snapshot.memory.write(SP_ADDR, sp_);
+    snapshot.memory.write(INSTR_COUNT_ADDR, instr_count_);
+    snapshot.halted = halted_flag_;
+    snapshot.user_mode = user_mode_flag_;
+    snapshot.cycles = cycles;
+    return snapshot;
 }
 
-void CPU::setPC(long new_pc)
+void CPU::restore(const MachineSnapshot &snapshot)
 {
-    memory_.write(PC_ADDR, new_pc);
+    if (snapshot.program != shared_program_)
+    {
+        throw std::runtime_error("Snapshot was taken from a different program.");
+    }
+    memory_ = snapshot.memory; // Same size (same program), so the cells stay where they are
+    halted_flag_ = snapshot.halted;
+    user_mode_flag_ = snapshot.user_mode;
+    fault_ = FaultRecord();
+    stop_events_ = 0;
+    syncRegistersFromMemory();
 }
 
-long CPU::getSP() const
+// --- Register Cache ---
+// PC, SP and the instruction counter are kept in CPU fields while executing.
+// Their memory-mapped copies are refreshed only on request.
+
+void CPU::syncRegistersToMemory()
 {
-    return memory_.read(SP_ADDR);
+    memory_.write(PC_ADDR, pc_);
+    memory_.write(SP_ADDR, sp_);
+    memory_.write(INSTR_COUNT_ADDR, instr_count_);
 }
 
-void CPU::setSP(long new_sp)
+void CPU::syncRegistersFromMemory()
 {
-    memory_.write(SP_ADDR, new_sp);
+    pc_ = memory_.read(PC_ADDR);
+    sp_ = memory_.read(SP_ADDR);
+    instr_count_ = memory_.read(INSTR_COUNT_ADDR);
+    next_pc_ = pc_;
 }
 
-void CPU::incrementInstructionCounter()
+// Switches privilege mode, noting a mode switch for CPU::run() if it actually changes.
+void CPU::setUserMode(bool user_mode)
 {
-    memory_.write(INSTR_COUNT_ADDR, memory_.read(INSTR_COUNT_ADDR) + 1);
+    if (user_mode != user_mode_flag_)
+    {
+        user_mode_flag_ = user_mode;
+        stop_events_ |= STOP_ON_MODE_SWITCH;
+    }
 }
 
 void CPU::setCpuEvent(CpuEvent event)
@@ -66,65 +136,130 @@ void CPU::setCpuEvent(CpuEvent event)
     memory_.write(CPU_OS_COMM_ADDR, static_cast<long>(event));
 }
 
-long CPU::getCurrentProgramCounter() const
-{
-    return getPC();
-}
-
 // --- Memory Access with User Mode Protection ---
 
-// Privileged read: for CPU internal use, e.g., reading PC, SP, which are always accessible
-long CPU::privilegedRead(long address)
+// Checked accesses are specialised on the privilege mode. Kernel mode only needs the
+// bounds check. Every address user mode may touch lies in [USER_MEMORY_START_ADDR, size),
+// so it needs a single unsigned range compare and never reaches the register window;
+// the failing case is classified afterwards.
+
+// Checked read: enforces user mode restrictions
+template <bool UserMode>
+bool CPU::checkedRead(long address, long &value)
 {
-    try
+    if (UserMode)
     {
-        return memory_.read(address);
+        if (static_cast<unsigned long>(address) - USER_MEMORY_START_ADDR >= user_span_)
+        {
+            raiseFault(address >= 0 && address < USER_MEMORY_START_ADDR ? CpuFault::USER_READ_VIOLATION
+                                                                         : CpuFault::READ_OUT_OF_BOUNDS,
+                       address);
+            return false;
+        }
+        value = memory_.readUnchecked(address);
+        return true;
     }
-    catch (const std::out_of_range &e)
+    if (!memory_.isValidAddress(address))
     {
-        std::ostringstream oss;
-        oss << "CPU privileged memory read out of bounds at address " << address << ". Details: " << e.what();
-        throw std::runtime_error(oss.str());
+        raiseFault(CpuFault::READ_OUT_OF_BOUNDS, address);
+        return false;
     }
+    value = address <= INSTR_COUNT_ADDR ? readRegister(address) : memory_.readUnchecked(address);
+    return true;
 }
 
-// Checked read: enforces user mode restrictions
-long CPU::checkedRead(long address)
+// Checked write: enforces user mode restrictions
+template <bool UserMode>
+bool CPU::checkedWrite(long address, long value)
 {
-    if (user_mode_flag_ && address < USER_MEMORY_START_ADDR && address >= 0) // Check address >=0 to allow -1 like addresses to be caught by memory system
+    if (UserMode)
     {
-        throw UserMemoryFaultException("User mode read access violation", address);
+        if (static_cast<unsigned long>(address) - USER_MEMORY_START_ADDR >= user_span_)
+        {
+            raiseFault(address >= 0 && address < USER_MEMORY_START_ADDR ? CpuFault::USER_WRITE_VIOLATION
+                                                                         : CpuFault::WRITE_OUT_OF_BOUNDS,
+                       address);
+            return false;
+        }
+        memory_.writeUnchecked(address, value);
+        return true;
     }
-    try
+    if (!memory_.isValidAddress(address))
     {
-        return memory_.read(address);
+        raiseFault(CpuFault::WRITE_OUT_OF_BOUNDS, address);
+        return false;
     }
-    catch (const std::out_of_range &e)
+    if (address <= INSTR_COUNT_ADDR)
+        writeRegister(address, value);
+    else
+        memory_.writeUnchecked(address, value);
+    return true;
+}
+
+template <bool UserMode>
+bool CPU::readOperand(const DecodedInstruction &instr, unsigned operand, long &value)
+{
+    long address = operand == PROVEN_ARG1 ? instr.arg1 : instr.arg2;
+    if (instr.proven_operands[UserMode] & operand)
     {
-        std::ostringstream oss;
-        oss << "CPU memory read out of bounds at address " << address << ". Details: " << e.what();
-        throw std::runtime_error(oss.str()); // Re-throw as a more general CPU error or specific out of bounds
+        value = memory_.readUnchecked(address);
+        return true;
     }
+    return checkedRead<UserMode>(address, value);
 }
 
-// Checked write: enforces user mode restrictions
-void CPU::checkedWrite(long address, long value)
+template <bool UserMode>
+bool CPU::writeOperand(const DecodedInstruction &instr, unsigned operand, long value)
 {
-    if (user_mode_flag_ && address < USER_MEMORY_START_ADDR && address >= 0)
+    long address = operand == PROVEN_ARG1 ? instr.arg1 : instr.arg2;
+    if (instr.proven_operands[UserMode] & operand)
     {
-        throw UserMemoryFaultException("User mode write access violation", address);
+        memory_.writeUnchecked(address, value);
+        return true;
     }
-    try
+    return checkedWrite<UserMode>(address, value);
+}
+
+template <bool UserMode>
+bool CPU::isPlainAddress(long address) const
+{
+    if (UserMode)
+        return static_cast<unsigned long>(address) - USER_MEMORY_START_ADDR < user_span_;
+    return address > INSTR_COUNT_ADDR && memory_.isValidAddress(address);
+}
+
+// Guest access to the memory-mapped registers (addresses 0-3) goes to the cached copies.
+long CPU::readRegister(long address) const
+{
+    switch (address)
     {
-        memory_.write(address, value);
-        if (address == PC_ADDR) 
-            this->pc_modified_by_data_operation_ = true;
+    case PC_ADDR:
+        return pc_;
+    case SP_ADDR:
+        return sp_;
+    case INSTR_COUNT_ADDR:
+        return instr_count_;
+    default:
+        return memory_.readUnchecked(address);
     }
-    catch (const std::out_of_range &e)
+}
+
+void CPU::writeRegister(long address, long value)
+{
+    switch (address)
     {
-        std::ostringstream oss;
-        oss << "CPU memory write out of bounds at address " << address << ". Details: " << e.what();
-        throw std::runtime_error(oss.str()); // Re-throw
+    case PC_ADDR:
+        next_pc_ = value; // A data write to the PC redirects execution after this instruction
+        break;
+    case SP_ADDR:
+        sp_ = value;
+        break;
+    case INSTR_COUNT_ADDR:
+        instr_count_ = value;
+        break;
+    default:
+        memory_.writeUnchecked(address, value);
+        break;
     }
 }
 
@@ -136,354 +271,961 @@ void CPU::step()
         return; // CPU is halted, do nothing
     }
 
-    long current_pc = getPC();
-    this->pc_modified_by_data_operation_ = false;
+    if (user_mode_flag_)
+        stepIn<true>();
+    else
+        stepIn<false>();
+}
+
+// One instruction cycle in a known privilege mode; the CPU is not halted.
+template <bool UserMode>
+void CPU::stepIn()
+{
+    long current_pc = pc_;
+    next_pc_ = current_pc + 1; // Default next PC
 
-    Instruction instr_for_error_reporting;
-    instr_for_error_reporting.opcode = OpCode::UNKNOWN; // Initially unknown
+    // PCs outside the program fetch the END sentinel. Operand counts were verified when
+    // the program was decoded. The source text is looked up only on a fault.
+    const DecodedInstruction &instr = program_.fetch(current_pc);
+    const DecodedInstruction *fetched_instr = &instr;
+#ifdef USE_OPCODE_COSTS
+    OpcodeCosts::Scope cost_scope(*opcode_costs_, instr.opcode);
+#endif
 
-    long next_pc = current_pc + 1; // Default next PC
-    bool pc_modified_by_instruction = false;
-    
-    try
+    // A failed checked access records the fault and skips the rest of the instruction.
+    switch (instr.opcode)
     {
-        if (current_pc < 0 || static_cast<size_t>(current_pc) >= program_instructions_.size())
+    case OpCode::SET: 
+        writeOperand<UserMode>(instr, PROVEN_ARG2, instr.arg1);
+        break;
+
+    case OpCode::CPY: 
+        {
+            long val_a1;
+            if (readOperand<UserMode>(instr, PROVEN_ARG1, val_a1))
+                writeOperand<UserMode>(instr, PROVEN_ARG2, val_a1);
+        }
+        break;
+
+    case OpCode::CPYI: 
+        {
+            long addr_from_a1, val_at_indirect_addr;
+            if (readOperand<UserMode>(instr, PROVEN_ARG1, addr_from_a1) &&
+                checkedRead<UserMode>(addr_from_a1, val_at_indirect_addr))
+                writeOperand<UserMode>(instr, PROVEN_ARG2, val_at_indirect_addr);
+        }
+        break;
+
+    case OpCode::CPYI2:
+        {
+            long address_X, address_Y, value;
+            if (readOperand<UserMode>(instr, PROVEN_ARG1, address_X) &&
+                readOperand<UserMode>(instr, PROVEN_ARG2, address_Y) &&
+                checkedRead<UserMode>(address_X, value))
+                checkedWrite<UserMode>(address_Y, value);
+        }
+        break;
+
+    case OpCode::ADD: 
+        {
+            long val_a;
+            if (readOperand<UserMode>(instr, PROVEN_ARG1, val_a))
+                writeOperand<UserMode>(instr, PROVEN_ARG1, val_a + instr.arg2);
+        }
+        break;
+
+    case OpCode::ADDI: 
+        {
+            long val_a1, val_a2;
+            if (readOperand<UserMode>(instr, PROVEN_ARG1, val_a1) && readOperand<UserMode>(instr, PROVEN_ARG2, val_a2))
+                writeOperand<UserMode>(instr, PROVEN_ARG1, val_a1 + val_a2);
+        }
+        break;
+
+    case OpCode::SUBI: 
+        {
+            long val_a1, val_a2;
+            if (readOperand<UserMode>(instr, PROVEN_ARG1, val_a1) && readOperand<UserMode>(instr, PROVEN_ARG2, val_a2))
+                writeOperand<UserMode>(instr, PROVEN_ARG2, val_a1 - val_a2); 
+        }
+        break;
+
+    case OpCode::STOREI:
         {
-            std::ostringstream oss;
-            oss << "Program Counter (" << current_pc
-                << ") is out of instruction bounds (0-"
-                << (program_instructions_.empty() ? 0 : program_instructions_.size() - 1) << ").";
-            throw std::runtime_error(oss.str());
+            long src_value, ptr_addr_value;
+            if (readOperand<UserMode>(instr, PROVEN_ARG1, src_value) &&    // Get value from source address
+                readOperand<UserMode>(instr, PROVEN_ARG2, ptr_addr_value)) // Get pointer address
+                checkedWrite<UserMode>(ptr_addr_value, src_value);         // mem[mem[Ptr_Addr]] = mem[Src_Addr]
         }
+        break;
 
-        const Instruction &instr = program_instructions_[static_cast<size_t>(current_pc)];
-        instr_for_error_reporting = instr;
-
-        // Check for 'holes' in the instruction vector (parsedLineNum skipped)
-        // These are default-constructed Instructions with UNKNOWN opcode and empty original_line
-        if (instr.opcode == OpCode::UNKNOWN && instr.original_line.empty()) {
-            std::cerr << "CPU WARNING: Encountered uninitialized instruction (hole) at PC " << current_pc
-                      << ". Treating as HLT." << std::endl;
-            halted_flag_ = true;
-            next_pc = current_pc; // PC should point at this implicit HLT
-            pc_modified_by_instruction = true;
-        } else {
-            // Normal instruction processing via switch
-            switch (instr.opcode)
+    case OpCode::LOADI:
+        {
+            long ptr_addr_value, indirect_value;
+            if (readOperand<UserMode>(instr, PROVEN_ARG1, ptr_addr_value) && // Get pointer address
+                checkedRead<UserMode>(ptr_addr_value, indirect_value))      // Get value from indirect address
+                writeOperand<UserMode>(instr, PROVEN_ARG2, indirect_value); // mem[Dest_Addr] = mem[mem[Ptr_Addr]]
+        }
+        break;
+
+    case OpCode::JIF: 
+        {
+            long val_a;
+            if (readOperand<UserMode>(instr, PROVEN_ARG1, val_a) && val_a <= 0)
             {
-            case OpCode::SET: 
-                if (instr.num_operands != 2)
-                    throw std::runtime_error("SET: Invalid number of operands.");
-                checkedWrite(instr.arg2, instr.arg1);
-                break;
+                next_pc_ = instr.arg2; 
+            }
+        }
+        break;
 
-            case OpCode::CPY: 
-                if (instr.num_operands != 2)
-                    throw std::runtime_error("CPY: Invalid number of operands.");
-                {
-                    long val_a1 = checkedRead(instr.arg1);
-                    checkedWrite(instr.arg2, val_a1);
-                }
+    case OpCode::PUSH: 
+        {
+            long sp = sp_;
+            sp--; 
+            if (sp < 0) // Basic check, detailed bounds check by checkedWrite
+            {
+                raiseFault(CpuFault::STACK_OVERFLOW_PUSH, sp);
                 break;
+            }
+            sp_ = sp;
+            long val_a;
+            if (readOperand<UserMode>(instr, PROVEN_ARG1, val_a))
+                checkedWrite<UserMode>(sp, val_a);
+        }
+        break;
 
-            case OpCode::CPYI: 
-                if (instr.num_operands != 2)
-                    throw std::runtime_error("CPYI: Invalid number of operands.");
-                {
-                    long addr_from_a1 = checkedRead(instr.arg1);          
-                    long val_at_indirect_addr = checkedRead(addr_from_a1); 
-                    checkedWrite(instr.arg2, val_at_indirect_addr);       
-                }
+    case OpCode::POP: 
+        {
+            long sp = sp_;
+            long val_from_stack;
+            if (!checkedRead<UserMode>(sp, val_from_stack)) // This checks if sp is valid address
                 break;
+            sp_ = sp + 1; 
+            writeOperand<UserMode>(instr, PROVEN_ARG1, val_from_stack);
+        }
+        break;
 
-            case OpCode::CPYI2:
-                if (instr.num_operands != 2)
-                    throw std::runtime_error("CPYI2: Invalid number of operands.");
-                {
-                    long address_X = checkedRead(instr.arg1);
-                    long address_Y = checkedRead(instr.arg2);
-                    checkedWrite(address_Y, checkedRead(address_X));
-                }
+    case OpCode::CALL: 
+        {
+            long sp = sp_;
+            sp--; 
+            if (sp < 0)
+            {
+                raiseFault(CpuFault::STACK_OVERFLOW_CALL, sp);
                 break;
+            }
+            sp_ = sp;
+            checkedWrite<UserMode>(sp, current_pc + 1); // Push return address (PC of instruction AFTER call)
+            next_pc_ = instr.arg1; 
+        }
+        break;
 
-            case OpCode::ADD: 
-                if (instr.num_operands != 2)
-                    throw std::runtime_error("ADD: Invalid number of operands.");
-                {
-                    long val_a = checkedRead(instr.arg1);
-                    checkedWrite(instr.arg1, val_a + instr.arg2);
-                }
+    case OpCode::RET: 
+        {
+            long sp = sp_;
+            long return_addr;
+            if (!checkedRead<UserMode>(sp, return_addr)) // Check if sp is valid address
                 break;
+            sp_ = sp + 1;
+            next_pc_ = return_addr;
+        }
+        break;
 
-            case OpCode::ADDI: 
-                if (instr.num_operands != 2)
-                    throw std::runtime_error("ADDI: Invalid number of operands.");
-                {
-                    long val_a1 = checkedRead(instr.arg1);
-                    long val_a2 = checkedRead(instr.arg2);
-                    checkedWrite(instr.arg1, val_a1 + val_a2);
-                }
-                break;
+    case OpCode::HLT: 
+        halted_flag_ = true;
+        next_pc_ = current_pc; // PC remains at HLT instruction
+        break;
 
-            case OpCode::SUBI: 
-                if (instr.num_operands != 2)
-                    throw std::runtime_error("SUBI: Invalid number of operands.");
-                {
-                    long val_a1 = checkedRead(instr.arg1);
-                    long val_a2 = checkedRead(instr.arg2);
-                    checkedWrite(instr.arg2, val_a1 - val_a2); 
-                }
+    case OpCode::USER: 
+        // No check for already in user mode, OS might use it to re-enter with a new PC.
+        // CPU switches to kernel mode on syscall/fault. OS must use USER to return to thread.
+        {
+            long target_pc_value;
+            if (!checkedRead<UserMode>(instr.arg1, target_pc_value))
                 break;
+            next_pc_ = target_pc_value;                        
+            setUserMode(true);
+        }
+        break;
 
-            case OpCode::STOREI:
-                if (instr.num_operands != 2)
-                    throw std::runtime_error("STOREI: Invalid number of operands.");
-                {
-                    long src_value = checkedRead(instr.arg1);        // Get value from source address
-                    long ptr_addr_value = checkedRead(instr.arg2);   // Get pointer address
-                    checkedWrite(ptr_addr_value, src_value);         // mem[mem[Ptr_Addr]] = mem[Src_Addr]
-                }
-                break;
+    case OpCode::SYSCALL_PRN: 
+        {
+            setUserMode(false); // Enter Kernel mode for syscall
+            stop_events_ |= STOP_ON_SYSCALL;
 
-            case OpCode::LOADI:
-                if (instr.num_operands != 2)
-                    throw std::runtime_error("LOADI: Invalid number of operands.");
-                {
-                    long ptr_addr_value = checkedRead(instr.arg1);   // Get pointer address
-                    long indirect_value = checkedRead(ptr_addr_value); // Get value from indirect address
-                    checkedWrite(instr.arg2, indirect_value);        // mem[Dest_Addr] = mem[mem[Ptr_Addr]]
-                }
+            long val_to_print; // Read with kernel privileges
+            if (!checkedRead<false>(instr.arg1, val_to_print))
                 break;
+            if (prn_system_call_handler_)
+            {
+                prn_system_call_handler_(val_to_print);
+            }
+            else
+            {
+                std::cout << val_to_print << '\n';
+            }
 
-            case OpCode::JIF: 
-                if (instr.num_operands != 2)
-                    throw std::runtime_error("JIF: Invalid number of operands.");
-                {
-                    long val_a = checkedRead(instr.arg1);
-                    if (val_a <= 0)
-                    {
-                        next_pc = instr.arg2; 
-                        pc_modified_by_instruction = true;
-                    }
-                }
-                break;
+            memory_.write(SAVED_TRAP_PC_ADDR, current_pc + 1); // Save PC of *next* instruction
+            setCpuEvent(CpuEvent::SYSCALL_PRN);               
+            memory_.write(SYSCALL_ARG1_PASS_ADDR, instr.arg1); 
+            next_pc_ = OS_SYSCALL_DISPATCHER_PC;                  
+        }
+        break;
 
-            case OpCode::PUSH: 
-                if (instr.num_operands != 1)
-                    throw std::runtime_error("PUSH: Invalid number of operands.");
-                {
-                    long sp = getSP();
-                    sp--; 
-                    if (sp < 0) // Basic check, detailed bounds check by checkedWrite
-                        throw std::runtime_error("Stack overflow during PUSH (SP would be negative).");
-                    setSP(sp);
-                    long val_a = checkedRead(instr.arg1);
-                    checkedWrite(sp, val_a);
-                }
-                break;
+    case OpCode::SYSCALL_HLT_THREAD: 
+        {
+            setUserMode(false); 
+            stop_events_ |= STOP_ON_SYSCALL;
+            memory_.write(SAVED_TRAP_PC_ADDR, current_pc + 1);
+            setCpuEvent(CpuEvent::SYSCALL_HLT_THREAD); 
+            next_pc_ = OS_SYSCALL_DISPATCHER_PC;
+        }
+        break;
 
-            case OpCode::POP: 
-                if (instr.num_operands != 1)
-                    throw std::runtime_error("POP: Invalid number of operands.");
-                {
-                    long sp = getSP();
-                    // checkedRead will throw if sp is out of memory bounds.
-                    // No specific check like sp >= memory_.getSize() needed here if checkedRead is robust.
-                    long val_from_stack = checkedRead(sp); // This checks if sp is valid address
-                    setSP(sp + 1); 
-                    checkedWrite(instr.arg1, val_from_stack);
-                }
-                break;
+    case OpCode::SYSCALL_YIELD: 
+        {
+            setUserMode(false); 
+            stop_events_ |= STOP_ON_SYSCALL;
+            memory_.write(SAVED_TRAP_PC_ADDR, current_pc + 1);
+            setCpuEvent(CpuEvent::SYSCALL_YIELD); 
+            next_pc_ = OS_SYSCALL_DISPATCHER_PC;
+        }
+        break;
 
-            case OpCode::CALL: 
-                if (instr.num_operands != 1)
-                    throw std::runtime_error("CALL: Invalid number of operands.");
-                {
-                    long sp = getSP();
-                    sp--; 
-                    if (sp < 0)
-                        throw std::runtime_error("Stack overflow during CALL (SP would be negative).");
-                    setSP(sp);
-                    checkedWrite(sp, current_pc + 1); // Push return address (PC of instruction AFTER call)
-                    next_pc = instr.arg1; 
-                    pc_modified_by_instruction = true;
-                }
-                break;
+    case OpCode::HOLE: // Slot skipped by the instruction section
+        if (fault_log_)
+            *fault_log_ << "CPU WARNING: Encountered uninitialized instruction (hole) at PC " << current_pc
+                        << ". Treating as HLT." << std::endl;
+        halted_flag_ = true;
+        next_pc_ = current_pc; // PC should point at this implicit HLT
+        break;
 
-            case OpCode::RET: 
-                if (instr.num_operands != 0)
-                    throw std::runtime_error("RET: Invalid number of operands.");
-                {
-                    long sp = getSP();
-                    long return_addr = checkedRead(sp); // Check if sp is valid address
-                    setSP(sp + 1);
-                    next_pc = return_addr;
-                    pc_modified_by_instruction = true;
-                }
-                break;
+    case OpCode::END: // Fetched for any PC outside the program
+        fetched_instr = nullptr; // No source line to report
+        raiseFault(CpuFault::PC_OUT_OF_BOUNDS, current_pc);
+        break;
 
-            case OpCode::HLT: 
-                if (instr.num_operands != 0)
-                    throw std::runtime_error("HLT: Invalid number of operands.");
-                halted_flag_ = true;
-                next_pc = current_pc; // PC remains at HLT instruction
-                pc_modified_by_instruction = true; 
-                break;
+    case OpCode::UNKNOWN: // Genuine unknown/unimplemented instruction (not a hole)
+    default:
+#ifdef USE_OPCODE_COSTS
+        cost_scope.markFaulted();
+#endif
+        if (fault_log_)
+            *fault_log_ << "CPU FAULT: Unknown or unimplemented opcode encountered at PC " << current_pc
+                        << ". Instruction: " << program_.sources[static_cast<size_t>(current_pc)].original_line << std::endl;
+        stop_events_ |= STOP_ON_FAULT;
+        if (UserMode)
+        {
+            setUserMode(false);                          
+            memory_.write(SAVED_TRAP_PC_ADDR, current_pc);    
+            setCpuEvent(CpuEvent::UNKNOWN_INSTRUCTION_FAULT); 
+            next_pc_ = OS_UNKNOWN_INSTRUCTION_HANDLER_PC;              
+        }
+        else // Kernel mode unknown instruction is fatal
+        {
+            halted_flag_ = true; 
+            next_pc_ = current_pc; // PC points at the faulting unknown instruction
+        }
+        break;
+    }
 
-            case OpCode::USER: 
-                if (instr.num_operands != 1)
-                    throw std::runtime_error("USER: Invalid number of operands.");
-                // No check for already in user mode, OS might use it to re-enter with a new PC.
-                // CPU switches to kernel mode on syscall/fault. OS must use USER to return to thread.
-                {
-                    long target_pc_value = checkedRead(instr.arg1); 
-                    next_pc = target_pc_value;                        
-                    user_mode_flag_ = true;
-                    pc_modified_by_instruction = true;
-                }
-                break;
+    if (fault_.kind != CpuFault::NONE)
+    {
+#ifdef USE_OPCODE_COSTS
+        cost_scope.markFaulted();
+#endif
+        next_pc_ = deliverFault(current_pc, fetched_instr);
+    }
 
-            case OpCode::SYSCALL_PRN: 
-                if (instr.num_operands != 1)
-                    throw std::runtime_error("SYSCALL PRN: Invalid number of operands.");
-                {
-                    user_mode_flag_ = false; // Enter Kernel mode for syscall
-
-                    long val_to_print = checkedRead(instr.arg1); 
-                    if (prn_system_call_handler_)
-                    {
-                        prn_system_call_handler_(val_to_print);
-                    }
-                    else
-                    {
-                        std::cout << val_to_print << std::endl;
-                    }
-
-                    memory_.write(SAVED_TRAP_PC_ADDR, current_pc + 1); // Save PC of *next* instruction
-                    setCpuEvent(CpuEvent::SYSCALL_PRN);               
-                    memory_.write(SYSCALL_ARG1_PASS_ADDR, instr.arg1); 
-                    next_pc = OS_SYSCALL_DISPATCHER_PC;                  
-                    pc_modified_by_instruction = true;
-                }
-                break;
+    retire();
+}
 
-            case OpCode::SYSCALL_HLT_THREAD: 
-                if (instr.num_operands != 0)
-                    throw std::runtime_error("SYSCALL HLT_THREAD: Invalid number of operands.");
-                {
-                    user_mode_flag_ = false; 
-                    memory_.write(SAVED_TRAP_PC_ADDR, current_pc + 1);
-                    setCpuEvent(CpuEvent::SYSCALL_HLT_THREAD); 
-                    next_pc = OS_SYSCALL_DISPATCHER_PC;
-                    pc_modified_by_instruction = true;
-                }
-                break;
+// --- Batch Execution ---
+
+CpuRunResult CPU::run(uint64_t max_instructions, unsigned stop_mask)
+{
+    stop_events_ = 0;
+
+    // The engine loops are specialised on the privilege mode and return after a mode
+    // switch (USER, SYSCALL, fault delivery); the loop then continues in the other one.
+    unsigned exit_mask = stop_mask | STOP_ON_MODE_SWITCH;
+    uint64_t executed = 0;
+    while (executed < max_instructions && !halted_flag_)
+    {
+        uint64_t budget = max_instructions - executed;
+        if (engine_ == CpuEngine::THREADED)
+            executed += user_mode_flag_ ? runThreaded<true>(budget, exit_mask) : runThreaded<false>(budget, exit_mask);
+        else if (engine_ == CpuEngine::BLOCK || engine_ == CpuEngine::JIT)
+            executed += user_mode_flag_ ? runBlocks<true>(budget, exit_mask) : runBlocks<false>(budget, exit_mask);
+        else
+            executed += user_mode_flag_ ? runSwitch<true>(budget, exit_mask) : runSwitch<false>(budget, exit_mask);
+
+        if (stop_events_ & stop_mask)
+            break;
+        stop_events_ &= ~static_cast<unsigned>(STOP_ON_MODE_SWITCH); // Not requested by the caller
+    }
+    syncRegistersToMemory();
+
+    CpuRunResult result;
+    result.instructions_executed = executed;
+    unsigned hit = stop_events_ & stop_mask;
+    if (halted_flag_)
+        result.reason = CpuStopReason::HALTED;
+    else if (hit & STOP_ON_FAULT)
+        result.reason = CpuStopReason::FAULT;
+    else if (hit & STOP_ON_SYSCALL)
+        result.reason = CpuStopReason::SYSCALL;
+    else if (hit & STOP_ON_MODE_SWITCH)
+        result.reason = CpuStopReason::MODE_SWITCH;
+    else
+        result.reason = CpuStopReason::BUDGET_EXHAUSTED;
+    return result;
+}
+
+// Reference engine loop: stepIn() until the budget, a halt or an event in exit_mask.
+template <bool UserMode>
+uint64_t CPU::runSwitch(uint64_t max_instructions, unsigned exit_mask)
+{
+    uint64_t executed = 0;
+    while (executed < max_instructions && !halted_flag_)
+    {
+        stepIn<UserMode>();
+        ++executed;
+        if (stop_events_ & exit_mask)
+            break;
+    }
+    return executed;
+}
+
+// --- Basic-Block Engine ---
+// Runs the translated body of a block as one unit and bumps the instruction counter once
+// for it; the translated operations cannot fault or touch the registers, so this is exact.
+// The exit instruction, and anything the budget does not cover in full, is single-stepped.
+// With the JIT engine, hot blocks run as native code instead, which keeps the instruction
+// counter itself and returns before anything that needs the interpreter.
 
-            case OpCode::SYSCALL_YIELD: 
-                if (instr.num_operands != 0)
-                    throw std::runtime_error("SYSCALL YIELD: Invalid number of operands.");
+template <bool UserMode>
+uint64_t CPU::runBlocks(uint64_t max_instructions, unsigned exit_mask)
+{
+    std::unique_ptr<BlockCache> &cache = block_caches_[UserMode];
+    if (!cache)
+        cache.reset(new BlockCache(program_, UserMode));
+    JitCompiler *jit = nullptr;
+    if (engine_ == CpuEngine::JIT)
+    {
+        if (!jits_[UserMode])
+            jits_[UserMode].reset(new JitCompiler());
+        if (jits_[UserMode]->isAvailable())
+            jit = jits_[UserMode].get();
+    }
+
+    uint64_t executed = 0;
+    int32_t index = -1; // Block at pc_, or -1 if it has to be looked up
+    while (executed < max_instructions && !halted_flag_)
+    {
+        if (index < 0 && static_cast<size_t>(pc_) < program_.size())
+            index = cache->blockAt(pc_);
+
+        if (jit && index >= 0)
+        {
+            JitBlockFn native = jit->enter(*cache, index);
+            if (native)
+            {
+                uint64_t remaining = max_instructions - executed;
+                JitContext context = {instr_count_, static_cast<long>(std::min<uint64_t>(remaining, LONG_MAX))};
+                long next_pc = native(memory_.data(), &context);
+                if (context.instr_count != instr_count_)
                 {
-                    user_mode_flag_ = false; 
-                    memory_.write(SAVED_TRAP_PC_ADDR, current_pc + 1);
-                    setCpuEvent(CpuEvent::SYSCALL_YIELD); 
-                    next_pc = OS_SYSCALL_DISPATCHER_PC;
-                    pc_modified_by_instruction = true;
+                    executed += static_cast<uint64_t>(context.instr_count - instr_count_);
+                    instr_count_ = context.instr_count;
+                    pc_ = next_pc;
+                    index = -1;
+                    continue;
                 }
+                // Budget too small for the block: the interpreter takes it from here
+            }
+        }
+
+        const TranslatedBlock *block = index >= 0 ? &cache->block(index) : nullptr;
+        if (!block || max_instructions - executed < block->num_ops + (block->has_exit ? 1u : 0u))
+        {
+            // PC outside the program, or the block does not fit the budget
+            stepIn<UserMode>();
+            ++executed;
+            index = -1;
+            if (stop_events_ & exit_mask)
                 break;
+            continue;
+        }
 
-            case OpCode::UNKNOWN: // Genuine unknown/unimplemented instruction (not a hole)
-            default:
-                std::cerr << "CPU FAULT: Unknown or unimplemented opcode encountered at PC " << current_pc
-                          << ". Instruction: " << instr.original_line << std::endl;
-                if (user_mode_flag_)
-                {
-                    user_mode_flag_ = false;                          
-                    memory_.write(SAVED_TRAP_PC_ADDR, current_pc);    
-                    setCpuEvent(CpuEvent::UNKNOWN_INSTRUCTION_FAULT); 
-                    next_pc = OS_UNKNOWN_INSTRUCTION_HANDLER_PC;              
-                    pc_modified_by_instruction = true;
-                }
-                else // Kernel mode unknown instruction is fatal
-                {
-                    halted_flag_ = true; 
-                    next_pc = current_pc; // PC points at the faulting unknown instruction
-                    pc_modified_by_instruction = true;
-                }
+        const BlockOp *op = cache->ops() + block->first_op;
+        for (const BlockOp *end = op + block->num_ops; op != end; ++op)
+        {
+            switch (op->opcode)
+            {
+            case OpCode::SET:
+                memory_.writeUnchecked(op->arg2, op->arg1);
+                break;
+            case OpCode::CPY:
+                memory_.writeUnchecked(op->arg2, memory_.readUnchecked(op->arg1));
+                break;
+            case OpCode::ADD:
+                memory_.writeUnchecked(op->arg1, memory_.readUnchecked(op->arg1) + op->arg2);
+                break;
+            case OpCode::ADDI:
+                memory_.writeUnchecked(op->arg1, memory_.readUnchecked(op->arg1) + memory_.readUnchecked(op->arg2));
+                break;
+            default: // SUBI
+                memory_.writeUnchecked(op->arg2, memory_.readUnchecked(op->arg1) - memory_.readUnchecked(op->arg2));
                 break;
             }
-        } // End of 'else' for hole check
+        }
+        instr_count_ += block->num_ops;
+        executed += block->num_ops;
+        pc_ = block->end_pc;
+
+        if (block->has_exit)
+        {
+            stepIn<UserMode>();
+            ++executed;
+            if (halted_flag_ || (stop_events_ & exit_mask))
+                break;
+        }
+        index = cache->successor(index, pc_);
     }
-    catch (const UserMemoryFaultException &umf)
+    return executed;
+}
+
+size_t CPU::getJitCompiledBlockCount() const
+{
+    return (jits_[0] ? jits_[0]->compiledBlockCount() : 0) + (jits_[1] ? jits_[1]->compiledBlockCount() : 0);
+}
+
+// --- Direct-Threaded Engine ---
+// Each instruction is resolved once to the offset of its handler, and every handler
+// ends with its own copy of the dispatch jump, so the branch predictor sees one
+// indirect branch per handler instead of the single shared one behind the switch.
+// Semantics are identical to step(); opcodes that are rare in practice are delegated to it.
+
+#if defined(__GNUC__)
+// Jumps to the handler of the instruction at next_ip, which must be the record for pc_.
+#define THREADED_DISPATCH_AT(next_ip)                                               \
+    do                                                                              \
+    {                                                                               \
+        if (executed >= max_instructions)                                           \
+            goto threaded_done;                                                     \
+        current_pc = pc_;                                                           \
+        next_pc_ = current_pc + 1;                                                  \
+        ip = (next_ip);                                                             \
+        goto *(handler_base + ip->handler_offset[UserMode]);                        \
+    } while (0)
+
+// Fetches the instruction at the current PC (the END sentinel if it is out of range)
+// and jumps straight to its handler.
+#define THREADED_DISPATCH() THREADED_DISPATCH_AT(&program_.fetch(pc_))
+
+// Completes a sequential instruction (or delivers its fault) and dispatches the next one.
+// User mode cannot write PC_ADDR, so there the next record is simply the following one;
+// falling off the end reaches the END sentinel.
+#define THREADED_NEXT()                          \
+    do                                           \
+    {                                            \
+        if (fault_.kind != CpuFault::NONE)       \
+            goto threaded_fault;                 \
+        retire();                                \
+        ++executed;                              \
+        if (UserMode)                            \
+            THREADED_DISPATCH_AT(ip + 1);        \
+        THREADED_DISPATCH();                     \
+    } while (0)
+
+// THREADED_NEXT() for handlers that cannot raise a fault. Their operands are proven to
+// lie past the registers, so they cannot write PC_ADDR either.
+#define THREADED_NEXT_NO_FAULT()                 \
+    do                                           \
+    {                                            \
+        retire();                                \
+        ++executed;                              \
+        THREADED_DISPATCH_AT(ip + 1);            \
+    } while (0)
+
+// Completes a fused run of count instructions that continues at target. A fused run
+// cannot fault, halt or write PC_ADDR, so retiring it is plain bookkeeping.
+#define THREADED_FUSED_JUMP(op, count, target)                  \
+    do                                                          \
+    {                                                           \
+        ++fused_op_counts_[static_cast<size_t>(FusedOp::op)];   \
+        instr_count_ += (count);                                \
+        executed += (count);                                    \
+        pc_ = (target);                                         \
+        THREADED_DISPATCH();                                    \
+    } while (0)
+
+// Completes a fused run of count instructions that falls through to the next one.
+#define THREADED_FUSED_NEXT(op, count)                          \
+    do                                                          \
+    {                                                           \
+        ++fused_op_counts_[static_cast<size_t>(FusedOp::op)];   \
+        instr_count_ += (count);                                \
+        executed += (count);                                    \
+        pc_ = current_pc + (count);                             \
+        THREADED_DISPATCH_AT(ip + (count));                     \
+    } while (0)
+
+// Completes an instruction that set the PC explicitly (or delivers its fault) and dispatches the next one.
+#define THREADED_JUMP(target)                    \
+    do                                           \
+    {                                            \
+        if (fault_.kind != CpuFault::NONE)       \
+            goto threaded_fault;                 \
+        next_pc_ = (target);                     \
+        retire();                                \
+        ++executed;                              \
+        THREADED_DISPATCH();                     \
+    } while (0)
+#endif
+
+template <bool UserMode>
+uint64_t CPU::runThreaded(uint64_t max_instructions, unsigned exit_mask)
+{
+#if defined(__GNUC__)
+    uint64_t executed = 0;
+
+    // Handlers are stored as offsets from op_set because each privilege mode
+    // specialisation has its own copy of them.
+    char *const handler_base = static_cast<char *>(&&op_set);
+
     {
-        std::cerr << "CPU FAULT: User mode memory fault during execution of instruction at PC "
-                  << current_pc;
-        if (!instr_for_error_reporting.original_line.empty()) { // If instruction was fetched
-            std::cerr << " (" << instr_for_error_reporting.original_line << ")";
-        }
-        std::cerr << ":\n" << "  " << umf.what() << " at address " << umf.faulting_address << std::endl;
+        // Indexed by OpCode; keep in enum order.
+        void *const handler_table[] = {
+            &&op_set, &&op_cpy, &&op_cpyi, &&op_cpyi2,
+            &&op_add, &&op_addi, &&op_subi, &&op_jif,
+            &&op_push, &&op_pop, &&op_call, &&op_ret,
+            &&op_reference,                                 // HLT
+            &&op_reference,                                 // USER
+            &&op_storei, &&op_loadi,
+            &&op_reference, &&op_reference, &&op_reference, // SYSCALL_PRN, SYSCALL_HLT_THREAD, SYSCALL_YIELD
+            &&op_reference, &&op_reference,                 // HOLE, END
+            &&op_reference};                                // UNKNOWN
+        static_assert(sizeof(handler_table) / sizeof(handler_table[0]) == static_cast<size_t>(OpCode::UNKNOWN) + 1,
+                      "handler_table needs one entry per OpCode");
+
+        // Unchecked variants, used when every direct operand is proven (nullptr: none).
+        void *const direct_table[] = {
+            &&op_set_direct, &&op_cpy_direct, nullptr, nullptr,
+            &&op_add_direct, &&op_addi_direct, &&op_subi_direct, &&op_jif_direct,
+            &&op_push_direct, &&op_pop_direct, nullptr, nullptr,
+            nullptr, nullptr, nullptr, nullptr,
+            nullptr, nullptr, nullptr,
+            nullptr, nullptr,
+            nullptr};
+        static_assert(sizeof(direct_table) == sizeof(handler_table), "direct_table needs one entry per OpCode");
+
+        // Indexed by FusedOp; keep in enum order.
+        void *const fused_table[] = {
+            nullptr, // NONE
+            &&op_fused_cpy_cpy, &&op_fused_cpy_cpy_call, &&op_fused_cpy_call,
+            &&op_fused_set_call, &&op_fused_subi_jif, &&op_fused_set_ret};
+        static_assert(sizeof(fused_table) / sizeof(fused_table[0]) == static_cast<size_t>(FusedOp::COUNT),
+                      "fused_table needs one entry per FusedOp");
+
+        // Label addresses are the same for every CPU in the process, so this runs once per program.
+        shared_program_->resolveHandlers(UserMode, [&](DecodedProgram &code)
+                                         {
+            for (DecodedInstruction &instr : code.code) // Including the END sentinel
+            {
+                size_t op = static_cast<size_t>(instr.opcode);
+                void *handler = handler_table[op];
+                if (instr.fused_op[UserMode] != FusedOp::NONE)
+                    handler = fused_table[static_cast<size_t>(instr.fused_op[UserMode])];
+                else if (direct_table[op] && instr.proven_operands[UserMode] == directOperands(instr.opcode))
+                    handler = direct_table[op];
+                instr.handler_offset[UserMode] = static_cast<int32_t>(static_cast<char *>(handler) - handler_base);
+            } });
+    }
+
+    long current_pc = 0;
+    const DecodedInstruction *ip = nullptr;
+
+    if (halted_flag_)
+        goto threaded_done;
+    THREADED_DISPATCH();
+
+op_set:
+    writeOperand<UserMode>(*ip, PROVEN_ARG2, ip->arg1);
+    THREADED_NEXT();
+
+op_cpy:
+{
+    long val_a1;
+    if (readOperand<UserMode>(*ip, PROVEN_ARG1, val_a1))
+        writeOperand<UserMode>(*ip, PROVEN_ARG2, val_a1);
+}
+    THREADED_NEXT();
+
+op_cpyi:
+{
+    long addr_from_a1, val_at_indirect_addr;
+    if (readOperand<UserMode>(*ip, PROVEN_ARG1, addr_from_a1) && checkedRead<UserMode>(addr_from_a1, val_at_indirect_addr))
+        writeOperand<UserMode>(*ip, PROVEN_ARG2, val_at_indirect_addr);
+}
+    THREADED_NEXT();
+
+op_cpyi2:
+{
+    long address_X, address_Y, value;
+    if (readOperand<UserMode>(*ip, PROVEN_ARG1, address_X) && readOperand<UserMode>(*ip, PROVEN_ARG2, address_Y) && checkedRead<UserMode>(address_X, value))
+        checkedWrite<UserMode>(address_Y, value);
+}
+    THREADED_NEXT();
+
+op_add:
+{
+    long val_a;
+    if (readOperand<UserMode>(*ip, PROVEN_ARG1, val_a))
+        writeOperand<UserMode>(*ip, PROVEN_ARG1, val_a + ip->arg2);
+}
+    THREADED_NEXT();
+
+op_addi:
+{
+    long val_a1, val_a2;
+    if (readOperand<UserMode>(*ip, PROVEN_ARG1, val_a1) && readOperand<UserMode>(*ip, PROVEN_ARG2, val_a2))
+        writeOperand<UserMode>(*ip, PROVEN_ARG1, val_a1 + val_a2);
+}
+    THREADED_NEXT();
+
+op_subi:
+{
+    long val_a1, val_a2;
+    if (readOperand<UserMode>(*ip, PROVEN_ARG1, val_a1) && readOperand<UserMode>(*ip, PROVEN_ARG2, val_a2))
+        writeOperand<UserMode>(*ip, PROVEN_ARG2, val_a1 - val_a2);
+}
+    THREADED_NEXT();
+
+op_storei:
+{
+    long src_value, ptr_addr_value;
+    if (readOperand<UserMode>(*ip, PROVEN_ARG1, src_value) && readOperand<UserMode>(*ip, PROVEN_ARG2, ptr_addr_value))
+        checkedWrite<UserMode>(ptr_addr_value, src_value);
+}
+    THREADED_NEXT();
+
+op_loadi:
+{
+    long ptr_addr_value, indirect_value;
+    if (readOperand<UserMode>(*ip, PROVEN_ARG1, ptr_addr_value) && checkedRead<UserMode>(ptr_addr_value, indirect_value))
+        writeOperand<UserMode>(*ip, PROVEN_ARG2, indirect_value);
+}
+    THREADED_NEXT();
+
+op_jif:
+{
+    long val_a;
+    if (readOperand<UserMode>(*ip, PROVEN_ARG1, val_a) && val_a <= 0)
+        THREADED_JUMP(ip->arg2);
+}
+    THREADED_NEXT();
+
+op_push:
+{
+    long sp = sp_ - 1;
+    if (sp < 0)
+    {
+        raiseFault(CpuFault::STACK_OVERFLOW_PUSH, sp);
+        goto threaded_fault;
+    }
+    sp_ = sp;
+    long val_a;
+    if (readOperand<UserMode>(*ip, PROVEN_ARG1, val_a))
+        checkedWrite<UserMode>(sp, val_a);
+}
+    THREADED_NEXT();
+
+op_pop:
+{
+    long sp = sp_;
+    long val_from_stack;
+    if (checkedRead<UserMode>(sp, val_from_stack))
+    {
+        sp_ = sp + 1;
+        writeOperand<UserMode>(*ip, PROVEN_ARG1, val_from_stack);
+    }
+}
+    THREADED_NEXT();
+
+op_call:
+{
+    long sp = sp_ - 1;
+    if (sp < 0)
+    {
+        raiseFault(CpuFault::STACK_OVERFLOW_CALL, sp);
+        goto threaded_fault;
+    }
+    sp_ = sp;
+    checkedWrite<UserMode>(sp, current_pc + 1);
+}
+    THREADED_JUMP(ip->arg1);
+
+op_ret:
+{
+    long sp = sp_;
+    long return_addr;
+    if (!checkedRead<UserMode>(sp, return_addr))
+        goto threaded_fault;
+    sp_ = sp + 1;
+    THREADED_JUMP(return_addr);
+}
+
+// Variants for instructions whose direct operands are all proven in range. They cannot
+// fault, except through the stack accesses of PUSH and POP.
+op_set_direct:
+    memory_.writeUnchecked(ip->arg2, ip->arg1);
+    THREADED_NEXT_NO_FAULT();
+
+op_cpy_direct:
+    memory_.writeUnchecked(ip->arg2, memory_.readUnchecked(ip->arg1));
+    THREADED_NEXT_NO_FAULT();
+
+op_add_direct:
+    memory_.writeUnchecked(ip->arg1, memory_.readUnchecked(ip->arg1) + ip->arg2);
+    THREADED_NEXT_NO_FAULT();
+
+op_addi_direct:
+    memory_.writeUnchecked(ip->arg1, memory_.readUnchecked(ip->arg1) + memory_.readUnchecked(ip->arg2));
+    THREADED_NEXT_NO_FAULT();
+
+op_subi_direct:
+    memory_.writeUnchecked(ip->arg2, memory_.readUnchecked(ip->arg1) - memory_.readUnchecked(ip->arg2));
+    THREADED_NEXT_NO_FAULT();
+
+op_jif_direct:
+    if (memory_.readUnchecked(ip->arg1) <= 0)
+        THREADED_JUMP(ip->arg2);
+    THREADED_NEXT_NO_FAULT();
+
+op_push_direct:
+{
+    long sp = sp_ - 1;
+    if (sp < 0)
+    {
+        raiseFault(CpuFault::STACK_OVERFLOW_PUSH, sp);
+        goto threaded_fault;
+    }
+    sp_ = sp;
+    checkedWrite<UserMode>(sp, memory_.readUnchecked(ip->arg1));
+}
+    THREADED_NEXT();
+
+op_pop_direct:
+{
+    long sp = sp_;
+    long val_from_stack;
+    if (checkedRead<UserMode>(sp, val_from_stack))
+    {
+        sp_ = sp + 1;
+        memory_.writeUnchecked(ip->arg1, val_from_stack);
+    }
+}
+    THREADED_NEXT();
+
+// Fused runs (see FusedOp). All direct operands are proven, so the only checks left are
+// the remaining budget and the stack slot of CALL/RET. If either fails, the run falls back
+// to the handler of its first instruction and the rest executes one by one.
+op_fused_cpy_cpy:
+    if (max_instructions - executed < 2)
+        goto op_cpy_direct;
+    memory_.writeUnchecked(ip[0].arg2, memory_.readUnchecked(ip[0].arg1));
+    memory_.writeUnchecked(ip[1].arg2, memory_.readUnchecked(ip[1].arg1));
+    THREADED_FUSED_NEXT(CPY_CPY, 2);
+
+op_fused_cpy_cpy_call:
+{
+    long sp = sp_ - 1;
+    if (max_instructions - executed < 3 || sp < 0 || !isPlainAddress<UserMode>(sp))
+        goto op_cpy_direct;
+    memory_.writeUnchecked(ip[0].arg2, memory_.readUnchecked(ip[0].arg1));
+    memory_.writeUnchecked(ip[1].arg2, memory_.readUnchecked(ip[1].arg1));
+    sp_ = sp;
+    memory_.writeUnchecked(sp, current_pc + 3); // Return address pushed by the CALL
+    THREADED_FUSED_JUMP(CPY_CPY_CALL, 3, ip[2].arg1);
+}
+
+op_fused_cpy_call:
+{
+    long sp = sp_ - 1;
+    if (max_instructions - executed < 2 || sp < 0 || !isPlainAddress<UserMode>(sp))
+        goto op_cpy_direct;
+    memory_.writeUnchecked(ip[0].arg2, memory_.readUnchecked(ip[0].arg1));
+    sp_ = sp;
+    memory_.writeUnchecked(sp, current_pc + 2);
+    THREADED_FUSED_JUMP(CPY_CALL, 2, ip[1].arg1);
+}
+
+op_fused_set_call:
+{
+    long sp = sp_ - 1;
+    if (max_instructions - executed < 2 || sp < 0 || !isPlainAddress<UserMode>(sp))
+        goto op_set_direct;
+    memory_.writeUnchecked(ip[0].arg2, ip[0].arg1);
+    sp_ = sp;
+    memory_.writeUnchecked(sp, current_pc + 2);
+    THREADED_FUSED_JUMP(SET_CALL, 2, ip[1].arg1);
+}
 
-        user_mode_flag_ = false; // Switch to Kernel mode
+op_fused_subi_jif:
+    if (max_instructions - executed < 2)
+        goto op_subi_direct;
+    memory_.writeUnchecked(ip[0].arg2, memory_.readUnchecked(ip[0].arg1) - memory_.readUnchecked(ip[0].arg2));
+    if (memory_.readUnchecked(ip[1].arg1) <= 0)
+        THREADED_FUSED_JUMP(SUBI_JIF, 2, ip[1].arg2);
+    THREADED_FUSED_NEXT(SUBI_JIF, 2);
+
+op_fused_set_ret:
+{
+    long sp = sp_;
+    if (max_instructions - executed < 2 || !isPlainAddress<UserMode>(sp))
+        goto op_set_direct;
+    memory_.writeUnchecked(ip[0].arg2, ip[0].arg1);
+    long return_addr = memory_.readUnchecked(sp);
+    sp_ = sp + 1;
+    THREADED_FUSED_JUMP(SET_RET, 2, return_addr);
+}
+
+op_reference:
+    stepIn<UserMode>();
+    ++executed;
+    if (halted_flag_ || (stop_events_ & exit_mask))
+        goto threaded_done;
+    THREADED_DISPATCH();
+
+threaded_fault:
+    next_pc_ = deliverFault(current_pc, ip);
+    retire();
+    ++executed;
+    if (halted_flag_ || (stop_events_ & exit_mask))
+        goto threaded_done;
+    THREADED_DISPATCH();
+
+threaded_done:
+    return executed;
+#else
+    // No labels-as-values support: fall back to the reference interpreter.
+    return runSwitch<UserMode>(max_instructions, exit_mask);
+#endif
+}
+
+#undef THREADED_DISPATCH_AT
+#undef THREADED_DISPATCH
+#undef THREADED_NEXT
+#undef THREADED_NEXT_NO_FAULT
+#undef THREADED_FUSED_JUMP
+#undef THREADED_FUSED_NEXT
+#undef THREADED_JUMP
+
+// --- Fault Delivery (shared by all engines) ---
+
+// Consumes the pending fault: reports it and traps to the matching OS handler
+// (user mode) or halts the CPU (kernel mode). Returns the PC to continue at.
+long CPU::deliverFault(long current_pc, const DecodedInstruction *fetched_instr)
+{
+    FaultRecord fault = fault_;
+    fault_ = FaultRecord();
+    stop_events_ |= STOP_ON_FAULT;
+
+    if (fault_log_)
+        reportFault(*fault_log_, fault, current_pc, fetched_instr);
+
+    if (fault.kind == CpuFault::USER_READ_VIOLATION || fault.kind == CpuFault::USER_WRITE_VIOLATION)
+    {
+        setUserMode(false); // Switch to Kernel mode
         memory_.write(SAVED_TRAP_PC_ADDR, current_pc); // Save faulting PC
         setCpuEvent(CpuEvent::MEMORY_FAULT_USER);      
-        memory_.write(SYSCALL_ARG1_PASS_ADDR, umf.faulting_address); 
-        next_pc = OS_MEMORY_FAULT_HANDLER_PC; 
-        pc_modified_by_instruction = true; 
+        memory_.write(SYSCALL_ARG1_PASS_ADDR, fault.address); 
+        return OS_MEMORY_FAULT_HANDLER_PC; 
     }
-    catch (const std::runtime_error &e)
-    { 
-        std::cerr << "CPU FAULT: Runtime error during execution of instruction at PC " << current_pc;
-        if (!instr_for_error_reporting.original_line.empty() && instr_for_error_reporting.opcode != OpCode::UNKNOWN) {
-            std::cerr << " (" << instr_for_error_reporting.original_line << ")";
-        }
-        std::cerr << ":\n  " << e.what() << std::endl;
-
-        if (user_mode_flag_) { 
-            user_mode_flag_ = false; 
-            memory_.write(SAVED_TRAP_PC_ADDR, current_pc); 
-            // Determine fault type. For now, assume arithmetic or generic.
-            // This could be more specific if ArithmeticFaultException is thrown by ops.
-            bool is_stack_issue = (std::string(e.what()).find("Stack overflow") != std::string::npos ||
-                                   std::string(e.what()).find("Stack underflow") != std::string::npos);
-            if (is_stack_issue) {
-                 setCpuEvent(CpuEvent::MEMORY_FAULT_USER); // Treat stack issues as memory faults
-                 next_pc = OS_MEMORY_FAULT_HANDLER_PC;
-            } else if (std::string(e.what()).find("out of instruction bounds") != std::string::npos) {
-                 setCpuEvent(CpuEvent::UNKNOWN_INSTRUCTION_FAULT); // PC out of bounds
-                 next_pc = OS_UNKNOWN_INSTRUCTION_HANDLER_PC;
-            }
-            else {
-                 setCpuEvent(CpuEvent::ARITHMETIC_FAULT); // Generic runtime error in user, assume arithmetic or similar
-                 next_pc = OS_ARITHMETIC_FAULT_HANDLER_PC;
-            }
-        } else { // Kernel mode runtime error
-            halted_flag_ = true; 
-            next_pc = current_pc; // PC points at the faulting instruction
+
+    if (!user_mode_flag_) { // Kernel mode runtime error
+        halted_flag_ = true; 
+        return current_pc; // PC points at the faulting instruction
+    }
+
+    setUserMode(false); 
+    memory_.write(SAVED_TRAP_PC_ADDR, current_pc); 
+    switch (fault.kind)
+    {
+    case CpuFault::STACK_OVERFLOW_PUSH:
+    case CpuFault::STACK_OVERFLOW_CALL:
+        setCpuEvent(CpuEvent::MEMORY_FAULT_USER); // Treat stack issues as memory faults
+        return OS_MEMORY_FAULT_HANDLER_PC;
+    case CpuFault::PC_OUT_OF_BOUNDS:
+        setCpuEvent(CpuEvent::UNKNOWN_INSTRUCTION_FAULT);
+        return OS_UNKNOWN_INSTRUCTION_HANDLER_PC;
+    default:
+        setCpuEvent(CpuEvent::ARITHMETIC_FAULT); // Generic runtime error in user, assume arithmetic or similar
+        return OS_ARITHMETIC_FAULT_HANDLER_PC;
+    }
+}
+
+// Formats the diagnostic for a fault. Only called when the text is actually printed.
+void CPU::reportFault(std::ostream &out, const FaultRecord &fault, long current_pc, const DecodedInstruction *fetched_instr) const
+{
+    const std::string *source_line = fetched_instr ? &program_.sources[static_cast<size_t>(current_pc)].original_line : nullptr;
+
+    if (fault.kind == CpuFault::USER_READ_VIOLATION || fault.kind == CpuFault::USER_WRITE_VIOLATION)
+    {
+        out << "CPU FAULT: User mode memory fault during execution of instruction at PC " << current_pc;
+        if (source_line && !source_line->empty()) {
+            out << " (" << *source_line << ")";
         }
-        pc_modified_by_instruction = true; 
+        out << ":\n" << "  User mode " << (fault.kind == CpuFault::USER_READ_VIOLATION ? "read" : "write")
+            << " access violation at address " << fault.address << std::endl;
+        return;
+    }
+
+    out << "CPU FAULT: Runtime error during execution of instruction at PC " << current_pc;
+    if (source_line && fetched_instr->opcode != OpCode::UNKNOWN) {
+        out << " (" << *source_line << ")";
     }
+    out << ":\n  ";
+
+    switch (fault.kind)
+    {
+    case CpuFault::READ_OUT_OF_BOUNDS:
+    case CpuFault::WRITE_OUT_OF_BOUNDS:
+        out << "CPU memory " << (fault.kind == CpuFault::READ_OUT_OF_BOUNDS ? "read" : "write")
+            << " out of bounds at address " << fault.address << ". Details: "
+            << memory_.outOfBoundsMessage(fault.address);
+        break;
+    case CpuFault::STACK_OVERFLOW_PUSH:
+        out << "Stack overflow during PUSH (SP would be negative).";
+        break;
+    case CpuFault::STACK_OVERFLOW_CALL:
+        out << "Stack overflow during CALL (SP would be negative).";
+        break;
+    case CpuFault::PC_OUT_OF_BOUNDS:
+        out << "Program Counter (" << fault.address << ") is out of instruction bounds (0-"
+            << (program_.empty() ? 0 : program_.size() - 1) << ").";
+        break;
+    default:
+        out << "Unknown fault.";
+        break;
+    }
+    out << std::endl;
+}
 
+// Completes an instruction: bumps the instruction counter and commits the next PC.
+// next_pc_ holds current_pc + 1, the target set by the instruction (JIF, CALL, RET,
+// USER, SYSCALL, trap to OS) or the value of a data write to PC_ADDR.
+void CPU::retire()
+{
     // Increment instruction counter for any processed instruction/attempt,
     // unless CPU was already halted before this step.
     // HLT executed in this step still counts. Faults also count.
-    incrementInstructionCounter();
+    ++instr_count_;
 
+    // If halted_flag_ is true (either from HLT or kernel fault), the PC is not updated,
+    // preserving the PC of the HLT/faulting instruction.
     if (!halted_flag_)
-    {
-        if (pc_modified_by_instruction) {
-            // PC was determined by the instruction (JIF, CALL, RET, USER, SYSCALL, trap to OS)
-            // or by HLT (next_pc = current_pc, but halted_flag_ will be true).
-            // The value in 'next_pc' is the target.
-            setPC(next_pc);
-        } else if (this->pc_modified_by_data_operation_) {
-            // PC was directly written by SET/CPY to PC_ADDR.
-            // The new PC value is already in memory_[PC_ADDR].
-            // No further setPC() needed here, as getPC() in the next cycle will read it.
-        } else {
-            // Normal instruction, PC not modified by instruction or data op.
-            // next_pc here is still current_pc + 1.
-            setPC(next_pc);
-        }
-    }
-    // If halted_flag_ is true (either from HLT or kernel fault), PC will not be updated here,
-    // preserving current_pc (or the PC of HLT/faulting instruction) in memory_[PC_ADDR].
-}
\ No newline at end of file
+        pc_ = next_pc_;
+}
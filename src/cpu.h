@@ -3,72 +3,213 @@
 #define CPU_H
 
 #include "common.h"      // For memory layout constants and CpuEvent - needed for inlines
+#include "decoder.h"     // For DecodedProgram - held by value
+#include <cstdint>       // For uint64_t instruction counts
 #include <functional>    // For std::function - needed for member
-#include <stdexcept>     // For std::runtime_error - needed for exceptions
+#include <iosfwd>        // For std::ostream used as the fault log
+#include <memory>        // For std::unique_ptr<BlockCache>
 #include <vector>        // For std::vector<Instruction> member - required for member variables
 
 // Forward declarations to reduce compilation dependencies
+class BlockCache;
+class JitCompiler;
 class Memory;
+class OpcodeCosts;
+class Program;
+struct MachineSnapshot;
 struct Instruction;
 enum class OpCode;
 
-class UserMemoryFaultException : public std::runtime_error
+// Faults detected while executing an instruction. They are returned by value
+// rather than thrown; the diagnostic text is only built when it is printed.
+enum class CpuFault
 {
-public:
-    UserMemoryFaultException(const std::string& msg, long addr)
-        : std::runtime_error(msg), faulting_address(addr) {}
-    
-    long faulting_address;
+    NONE = 0,
+    USER_READ_VIOLATION,   // User mode read below USER_MEMORY_START_ADDR
+    USER_WRITE_VIOLATION,  // User mode write below USER_MEMORY_START_ADDR
+    READ_OUT_OF_BOUNDS,    // Read outside of Memory
+    WRITE_OUT_OF_BOUNDS,   // Write outside of Memory
+    STACK_OVERFLOW_PUSH,   // PUSH with SP already at 0
+    STACK_OVERFLOW_CALL,   // CALL with SP already at 0
+    PC_OUT_OF_BOUNDS       // PC outside of the instruction section
+};
+
+struct FaultRecord
+{
+    CpuFault kind = CpuFault::NONE;
+    long address = 0; // Faulting memory address, or the PC for PC_OUT_OF_BOUNDS
+};
+
+// Interpreter engines. SWITCH (CPU::step()) is the reference implementation.
+enum class CpuEngine
+{
+    SWITCH,
+    THREADED, // Direct-threaded dispatch using GCC labels-as-values
+    BLOCK,    // Translated basic blocks (see BlockCache), single-stepping the rest
+    JIT       // BLOCK with hot blocks compiled to x86-64 (see JitCompiler); BLOCK elsewhere
+};
+
+// Events that end CPU::run() before its budget is used up. Combine with |.
+// Halting always ends a run.
+enum CpuStopCondition : unsigned
+{
+    STOP_ON_NONE = 0,
+    STOP_ON_SYSCALL = 1u << 0,     // A SYSCALL instruction trapped to the OS
+    STOP_ON_MODE_SWITCH = 1u << 1, // The CPU changed between user and kernel mode
+    STOP_ON_FAULT = 1u << 2        // A fault was delivered (including unknown instructions)
+};
+
+enum class CpuStopReason
+{
+    BUDGET_EXHAUSTED,
+    HALTED,
+    SYSCALL,
+    MODE_SWITCH,
+    FAULT
+};
+
+struct CpuRunResult
+{
+    CpuStopReason reason;
+    uint64_t instructions_executed;
 };
 
 class CPU
 {
 public:
-    // Constructor
+    // Runs a shared program. mem must have program->memorySize() cells, and is usually a
+    // copy of program->initialMemory(). Any number of CPUs may share one program.
+    CPU(Memory &mem,
+        std::shared_ptr<const Program> program,
+        std::function<void(long)> prn_callback);
+
+    // Builds a private program from instructions, with mem's current contents as its
+    // initial data image.
     CPU(Memory &mem,
         const std::vector<Instruction> &instructions,
         std::function<void(long)> prn_callback);
+    ~CPU();
 
     // Executes a single instruction cycle
     void step();
 
+    // Executes up to max_instructions with the selected engine without returning to the
+    // caller in between. Stops early on halt or on any event in stop_mask (CpuStopCondition
+    // bits); the instruction that raised the event has completed. Registers are synced to
+    // memory on return.
+    CpuRunResult run(uint64_t max_instructions, unsigned stop_mask = STOP_ON_NONE);
+
+    const std::shared_ptr<const Program> &getProgram() const { return shared_program_; }
+
+    // Engine used by run(). step() always uses the reference switch interpreter.
+    void setEngine(CpuEngine engine) { engine_ = engine; }
+    CpuEngine getEngine() const { return engine_; }
+
     // Checks if the CPU has been halted by an HLT instruction
     bool isHalted() const { return halted_flag_; }
 
     // Resets CPU state (PC, SP from memory, flags, instruction count)
     void reset();
 
+    // Copies the whole machine (memory with registers synced, privilege mode and halt
+    // flag) between two instructions. cycles is stored as given, for the caller's count.
+    MachineSnapshot snapshot(uint64_t cycles = 0) const;
+
+    // Returns the machine to snapshot, overwriting all of memory. The snapshot must be of
+    // this CPU's program; throws std::runtime_error otherwise.
+    void restore(const MachineSnapshot &snapshot);
+
     // (Optional) Getters for CPU state, useful for debugging or OS
     bool isInUserMode() const { return user_mode_flag_; }
-    long getCurrentProgramCounter() const; // Reads from memory_[PC_ADDR]
+    long getCurrentProgramCounter() const { return pc_; }
+
+    // PC, SP and the instruction counter (addresses 0, 1 and 3) are kept in CPU fields
+    // while executing, and guest accesses to those addresses use the fields. Sync them
+    // to memory before dumping or inspecting it, and back from memory after changing
+    // them from outside the CPU.
+    void syncRegistersToMemory();
+    void syncRegistersFromMemory();
+
+    // Stream that receives CPU fault and warning diagnostics (std::cerr by default).
+    // Pass nullptr to skip formatting them altogether, e.g. for fault-heavy runs.
+    void setFaultLog(std::ostream *log) { fault_log_ = log; }
+
+    // Number of times the threaded engine executed a fused op since construction
+    uint64_t getFusedOpCount(FusedOp op) const { return fused_op_counts_[static_cast<size_t>(op)]; }
+
+    // Number of blocks the JIT engine compiled to native code (0 if it is unavailable)
+    size_t getJitCompiledBlockCount() const;
+
+    // Host cost per opcode of every instruction the reference interpreter executed;
+    // nullptr unless cpu.cpp was built with USE_OPCODE_COSTS (make OPCODE_COSTS=1)
+    const OpcodeCosts *getOpcodeCosts() const { return opcode_costs_.get(); }
 
 private:
-    Memory &memory_;                                       // Reference to the system memory
-    const std::vector<Instruction> &program_instructions_; // Reference to parsed instructions
-    std::function<void(long)> prn_system_call_handler_;    // Callback for SYSCALL PRN
+    Memory &memory_;                                    // Reference to the system memory
+    std::shared_ptr<const Program> shared_program_;     // Keeps program_ alive
+    const DecodedProgram &program_;                     // Packed instructions + cold source table
+    std::function<void(long)> prn_system_call_handler_; // Callback for SYSCALL PRN
+    std::ostream *fault_log_;                           // Diagnostics sink, may be nullptr
 
     bool halted_flag_;    // True if CPU HLT instruction has been executed
     bool user_mode_flag_; // True if CPU is in user mode, false for kernel mode
-    bool pc_modified_by_data_operation_;
-
-    // Helper methods for memory access with user mode protection
-    long privilegedRead(long address); // Internal read, bypasses user mode checks for registers
-    long checkedRead(long address);
-    void checkedWrite(long address, long value);
-
-    // Helper methods for register access (which are memory-mapped)
-    long getPC() const;
-    void setPC(long new_pc);
-    long getSP() const;
-    void setSP(long new_sp);
-    void incrementInstructionCounter();
+    CpuEngine engine_;
+    FaultRecord fault_;           // Fault raised by the current instruction (NONE otherwise)
+    unsigned stop_events_;        // CpuStopCondition bits raised since run() started
+
+    // Authoritative copies of the memory-mapped registers
+    long pc_;          // PC of the instruction being executed
+    long next_pc_;     // Where execution continues; data writes to PC_ADDR land here
+    long sp_;
+    long instr_count_;
+
+    unsigned long user_span_; // Number of addresses user mode may touch (from USER_MEMORY_START_ADDR up)
+
+    uint64_t fused_op_counts_[static_cast<size_t>(FusedOp::COUNT)]; // Indexed by FusedOp
+
+    std::unique_ptr<BlockCache> block_caches_[2]; // Per privilege mode, created on first use
+    std::unique_ptr<JitCompiler> jits_[2];         // Per privilege mode, JIT engine only
+
+    // Filled by stepIn() with USE_OPCODE_COSTS. Held by pointer so that the flag does
+    // not change the layout of CPU for objects built without it.
+    std::unique_ptr<OpcodeCosts> opcode_costs_;
+
+    // Helper methods for memory access with user mode protection.
+    // They return false and record the fault in fault_ instead of throwing.
+    // UserMode selects the privilege checks at compile time.
+    template <bool UserMode> bool checkedRead(long address, long &value);
+    template <bool UserMode> bool checkedWrite(long address, long value);
+    void raiseFault(CpuFault kind, long address) { fault_ = {kind, address}; }
+
+    // Access to a direct operand of instr (operand is PROVEN_ARG1 or PROVEN_ARG2). Skips
+    // the checks if the decoder proved the address in range for this privilege mode.
+    template <bool UserMode> bool readOperand(const DecodedInstruction &instr, unsigned operand, long &value);
+    template <bool UserMode> bool writeOperand(const DecodedInstruction &instr, unsigned operand, long value);
+
+    // True if address needs no checks in this privilege mode (the rule markProvenOperands()
+    // applies to constant operands, evaluated at run time for stack slots)
+    template <bool UserMode> bool isPlainAddress(long address) const;
+
+    // Guest access to addresses 0-3 (valid, already privilege-checked)
+    long readRegister(long address) const;
+    void writeRegister(long address, long value);
     void setCpuEvent(CpuEvent event);
-};
+    void setUserMode(bool user_mode);
 
-// Custom exception for arithmetic faults
-class ArithmeticFaultException : public std::runtime_error {
-public:
-    ArithmeticFaultException(const std::string& msg) : std::runtime_error(msg) {}
+    // step() for a known privilege mode
+    template <bool UserMode> void stepIn();
+
+    // Engine loops behind run(), specialised on the privilege mode they start in. They
+    // return the number of instructions executed, at the latest after a mode switch.
+    // The threaded engine delegates rare opcodes (HLT, USER, SYSCALL, HOLE, END) to stepIn().
+    template <bool UserMode> uint64_t runSwitch(uint64_t max_instructions, unsigned exit_mask);
+    template <bool UserMode> uint64_t runThreaded(uint64_t max_instructions, unsigned exit_mask);
+    template <bool UserMode> uint64_t runBlocks(uint64_t max_instructions, unsigned exit_mask);
+
+    // Shared by all engines: fault delivery (returning the PC to continue at) and instruction completion
+    long deliverFault(long current_pc, const DecodedInstruction *fetched_instr);
+    void reportFault(std::ostream &out, const FaultRecord &fault, long current_pc, const DecodedInstruction *fetched_instr) const;
+    void retire();
 };
 
-#endif // CPU_H
\ No newline at end of file
+#endif // CPU_H
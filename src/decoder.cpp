@@ -0,0 +1,167 @@
+// src/decoder.cpp
+#include "decoder.h"
+#include "common.h"  // For the register and user memory boundaries
+#include <stdexcept> // For runtime_error
+#include <string>    // For std::to_string
+#include <vector>
+
+// Number of operands each opcode carries, or -1 if the opcode takes no fixed count.
+static int expectedOperandCount(OpCode op)
+{
+    switch (op)
+    {
+    case OpCode::RET:
+    case OpCode::HLT:
+    case OpCode::SYSCALL_HLT_THREAD:
+    case OpCode::SYSCALL_YIELD:
+        return 0;
+    case OpCode::PUSH:
+    case OpCode::POP:
+    case OpCode::CALL:
+    case OpCode::USER:
+    case OpCode::SYSCALL_PRN:
+        return 1;
+    case OpCode::HOLE:
+    case OpCode::END:
+    case OpCode::UNKNOWN:
+        return -1;
+    default:
+        return 2;
+    }
+}
+
+DecodedProgram decodeProgram(const std::vector<Instruction> &instructions)
+{
+    DecodedProgram program;
+    program.code.reserve(instructions.size() + 1);
+    program.sources.reserve(instructions.size());
+
+    for (size_t pc = 0; pc < instructions.size(); ++pc)
+    {
+        const Instruction &instr = instructions[pc];
+        OpCode opcode = instr.opcode;
+
+        // Slots the instruction section skipped are default-constructed Instructions
+        if (opcode == OpCode::UNKNOWN && instr.original_line.empty())
+        {
+            opcode = OpCode::HOLE;
+        }
+        else
+        {
+            int expected = expectedOperandCount(opcode);
+            if (expected >= 0 && instr.num_operands != expected)
+            {
+                throw std::runtime_error("Error L" + std::to_string(instr.source_line) + ": Instruction at PC " +
+                                         std::to_string(pc) + " (" + opCodeToString(opcode) + ") has " +
+                                         std::to_string(instr.num_operands) + " operand(s), expects " +
+                                         std::to_string(expected) + ".");
+            }
+        }
+
+        program.code.push_back({opcode, {0, 0}, {FusedOp::NONE, FusedOp::NONE}, instr.arg1, instr.arg2, {0, 0}});
+        program.sources.push_back({instr.original_line, instr.source_line});
+    }
+
+    program.code.push_back({OpCode::END, {0, 0}, {FusedOp::NONE, FusedOp::NONE}, 0, 0, {0, 0}});
+    return program;
+}
+
+unsigned directOperands(OpCode op)
+{
+    switch (op)
+    {
+    case OpCode::SET: // arg1 is an immediate
+        return PROVEN_ARG2;
+    case OpCode::ADD: // arg2 is an immediate
+    case OpCode::JIF: // arg2 is a PC
+    case OpCode::PUSH:
+    case OpCode::POP:
+        return PROVEN_ARG1;
+    case OpCode::CPY:
+    case OpCode::CPYI:
+    case OpCode::CPYI2:
+    case OpCode::ADDI:
+    case OpCode::SUBI:
+    case OpCode::STOREI:
+    case OpCode::LOADI:
+        return PROVEN_ARG1 | PROVEN_ARG2;
+    default:
+        return 0;
+    }
+}
+
+void markProvenOperands(DecodedProgram &program, size_t memory_size)
+{
+    const long size = static_cast<long>(memory_size);
+    const long lowest[2] = {INSTR_COUNT_ADDR + 1, USER_MEMORY_START_ADDR}; // Per privilege mode
+
+    for (DecodedInstruction &instr : program.code)
+    {
+        unsigned direct = directOperands(instr.opcode);
+        for (int mode = 0; mode < 2; ++mode)
+        {
+            unsigned proven = 0;
+            if ((direct & PROVEN_ARG1) && instr.arg1 >= lowest[mode] && instr.arg1 < size)
+                proven |= PROVEN_ARG1;
+            if ((direct & PROVEN_ARG2) && instr.arg2 >= lowest[mode] && instr.arg2 < size)
+                proven |= PROVEN_ARG2;
+            instr.proven_operands[mode] = static_cast<uint8_t>(proven);
+        }
+    }
+}
+
+// Fused op for the run starting at code[pc] in the given privilege mode.
+//
+// "JIF ZERO_ADDR L" is not turned into an unconditional jump. ZERO_ADDR is only a
+// convention of the OS source: every cell a mode may read, it may also write (kernel
+// mode all of memory, user mode everything from USER_MEMORY_START_ADDR), and indirect
+// writes, stack operations, batch patches and --resume can all change the cell. So
+// its value cannot be proven at decode time, and the JIF keeps its load and test.
+static FusedOp matchFusedOp(const DecodedProgram &program, size_t pc, int mode)
+{
+    // The END sentinel never matches, so looking one record ahead is always safe.
+    auto is = [&](size_t at, OpCode op) {
+        if (at >= program.code.size())
+            return false;
+        const DecodedInstruction &instr = program.code[at];
+        return instr.opcode == op && instr.proven_operands[mode] == directOperands(op);
+    };
+
+    if (is(pc, OpCode::CPY))
+    {
+        if (is(pc + 1, OpCode::CPY))
+            return is(pc + 2, OpCode::CALL) ? FusedOp::CPY_CPY_CALL : FusedOp::CPY_CPY;
+        if (is(pc + 1, OpCode::CALL))
+            return FusedOp::CPY_CALL;
+    }
+    else if (is(pc, OpCode::SET))
+    {
+        if (is(pc + 1, OpCode::CALL))
+            return FusedOp::SET_CALL;
+        if (is(pc + 1, OpCode::RET))
+            return FusedOp::SET_RET;
+    }
+    else if (is(pc, OpCode::SUBI) && is(pc + 1, OpCode::JIF))
+    {
+        return FusedOp::SUBI_JIF;
+    }
+    return FusedOp::NONE;
+}
+
+void markFusedOps(DecodedProgram &program)
+{
+    for (size_t pc = 0; pc < program.size(); ++pc)
+    {
+        for (int mode = 0; mode < 2; ++mode)
+            program.code[pc].fused_op[mode] = matchFusedOp(program, pc, mode);
+    }
+}
+
+const char *fusedOpName(FusedOp op)
+{
+    static const char *const names[] = {
+        "NONE", "CPY+CPY", "CPY+CPY+CALL", "CPY+CALL", "SET+CALL", "SUBI+JIF", "SET+RET"};
+    static_assert(sizeof(names) / sizeof(names[0]) == static_cast<size_t>(FusedOp::COUNT),
+                  "names needs one entry per FusedOp");
+    return names[static_cast<size_t>(op)];
+}
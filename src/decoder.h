@@ -0,0 +1,101 @@
+// src/decoder.h
+#ifndef DECODER_H
+#define DECODER_H
+
+#include "instruction.h" // For OpCode and Instruction
+#include <cstdint>       // For int32_t handler offsets
+#include <string>        // For std::string in the cold side table
+#include <vector>        // For std::vector containers
+
+// Bits of DecodedInstruction::proven_operands. Combine with |.
+enum ProvenOperand : uint8_t
+{
+    PROVEN_ARG1 = 1u << 0,
+    PROVEN_ARG2 = 1u << 1
+};
+
+// Superinstructions: fixed runs of instructions that the threaded engine executes with a
+// single handler. The run starts at the tagged record; the records after it are unchanged,
+// so jumping into the middle of a run still works.
+enum class FusedOp : uint8_t
+{
+    NONE = 0,
+    CPY_CPY,      // CPY a b; CPY c d
+    CPY_CPY_CALL, // CPY a b; CPY c d; CALL f  (passing two arguments)
+    CPY_CALL,     // CPY a b; CALL f
+    SET_CALL,     // SET v a; CALL f
+    SUBI_JIF,     // SUBI a b; JIF c L         (compare and branch)
+    SET_RET,      // SET v a; RET              (return a value)
+    COUNT
+};
+
+// Hot-path form of an Instruction. Fixed-size and free of owning members so
+// the interpreter can walk a packed array without touching the heap.
+// Aligned (and sized) so that a record never straddles a cache line.
+struct alignas(32) DecodedInstruction
+{
+    OpCode opcode;
+    // Direct operands (addresses used as they are) known to be in range, per privilege
+    // mode (index 0 kernel, 1 user). Set by markProvenOperands().
+    uint8_t proven_operands[2];
+    FusedOp fused_op[2]; // Run starting here, per privilege mode. Set by markFusedOps().
+    long arg1;
+    long arg2;
+    // Threaded engine handler as an offset from its base label, one per privilege
+    // mode (index 0 kernel, 1 user). Resolved lazily by each specialisation.
+    int32_t handler_offset[2];
+};
+
+// Cold per-instruction data, only consulted when reporting a fault.
+struct InstructionSource
+{
+    std::string original_line; // Empty for holes in the instruction section
+    int line_number;           // Line in the .img file (0 for holes)
+};
+
+// Program as seen by the CPU: hot records and their cold side table, both indexed by PC.
+// code holds one extra END record after the last instruction, so sequential execution
+// runs into it instead of needing a bounds check.
+struct DecodedProgram
+{
+    std::vector<DecodedInstruction> code;
+    std::vector<InstructionSource> sources;
+
+    // Number of instructions, not counting the END sentinel
+    size_t size() const { return code.size() - 1; }
+    bool empty() const { return size() == 0; }
+
+    // Record for pc; PCs outside the program map to the END sentinel.
+    const DecodedInstruction &fetch(long pc) const
+    {
+        size_t index = static_cast<unsigned long>(pc) < size() ? static_cast<size_t>(pc) : size();
+        return code[index];
+    }
+};
+
+// Verifies parsed instructions and splits them into the packed hot array and the cold
+// side table. Holes become HOLE records and the END sentinel is appended. Throws
+// std::runtime_error for an instruction with the wrong number of operands.
+DecodedProgram decodeProgram(const std::vector<Instruction> &instructions);
+
+// ProvenOperand bits for the operands of op that are direct memory addresses. Operands
+// that are immediates or PC targets are not included, and neither are those of USER
+// and SYSCALL PRN, which always take the checked path.
+unsigned directOperands(OpCode op);
+
+// Checks every direct operand once against a Memory of memory_size cells. An operand is
+// proven for kernel mode if it lies past the cached CPU registers (PC, SP, CPU/OS comm
+// and the instruction counter, which need the register path), and for user mode if it
+// lies in the user region.
+void markProvenOperands(DecodedProgram &program, size_t memory_size);
+
+// Tags the start of every run that can be fused, per privilege mode. Only instructions
+// whose direct operands are all proven take part, so a fused run cannot fault except on
+// the stack access of CALL or RET, which the handler checks before doing anything.
+// Call after markProvenOperands().
+void markFusedOps(DecodedProgram &program);
+
+// Name of a fused op for reports, e.g. "CPY+CPY+CALL"
+const char *fusedOpName(FusedOp op);
+
+#endif // DECODER_H
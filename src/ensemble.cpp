@@ -0,0 +1,639 @@
+// src/ensemble.cpp
+#include "ensemble.h"
+#include "common.h"      // For memory layout constants and OS handler PCs
+#include "instruction.h" // For OpCode
+#include "memory.h"      // For copyLaneTo
+#include "program.h"     // For the shared Program
+#include "snapshot.h"    // For MachineSnapshot
+#include <algorithm>     // For std::min
+#include <climits>       // For LONG_MAX
+#include <stdexcept>     // For out_of_range, runtime_error
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h> // For SSE2/AVX2 intrinsics
+#define ENSEMBLE_X86 1
+#else
+#define ENSEMBLE_X86 0
+#endif
+
+namespace
+{
+
+// Masked row operations. mask[i] is -1 for lanes that execute and 0 for the others; n is
+// a multiple of 4. Rows of the same address alias, which every variant handles because
+// it loads all operands of a vector before storing.
+struct RowKernels
+{
+    void (*set)(long *dst, long value, const long *mask, size_t n);             // dst = value
+    void (*copy)(long *dst, const long *src, const long *mask, size_t n);       // dst = src
+    void (*add)(long *dst, long value, const long *mask, size_t n);             // dst += value
+    void (*add_row)(long *dst, const long *src, const long *mask, size_t n);    // dst += src
+    void (*sub_from)(long *dst, const long *minuend, const long *mask, size_t n); // dst = minuend - dst
+};
+
+void setScalar(long *dst, long value, const long *mask, size_t n)
+{
+    for (size_t i = 0; i < n; ++i)
+        dst[i] = (value & mask[i]) | (dst[i] & ~mask[i]);
+}
+void copyScalar(long *dst, const long *src, const long *mask, size_t n)
+{
+    for (size_t i = 0; i < n; ++i)
+        dst[i] = (src[i] & mask[i]) | (dst[i] & ~mask[i]);
+}
+void addScalar(long *dst, long value, const long *mask, size_t n)
+{
+    for (size_t i = 0; i < n; ++i)
+        dst[i] = static_cast<long>(static_cast<unsigned long>(dst[i]) + static_cast<unsigned long>(value & mask[i]));
+}
+void addRowScalar(long *dst, const long *src, const long *mask, size_t n)
+{
+    for (size_t i = 0; i < n; ++i)
+        dst[i] = static_cast<long>(static_cast<unsigned long>(dst[i]) + static_cast<unsigned long>(src[i] & mask[i]));
+}
+void subFromScalar(long *dst, const long *minuend, const long *mask, size_t n)
+{
+    for (size_t i = 0; i < n; ++i)
+    {
+        long difference = static_cast<long>(static_cast<unsigned long>(minuend[i]) - static_cast<unsigned long>(dst[i]));
+        dst[i] = (difference & mask[i]) | (dst[i] & ~mask[i]);
+    }
+}
+
+#if ENSEMBLE_X86
+// SSE2 is part of x86-64, so these need no run-time check.
+inline __m128i loadSse(const long *p) { return _mm_loadu_si128(reinterpret_cast<const __m128i *>(p)); }
+inline void storeSse(long *p, __m128i v) { _mm_storeu_si128(reinterpret_cast<__m128i *>(p), v); }
+inline __m128i blendSse(__m128i old_value, __m128i new_value, __m128i mask)
+{
+    return _mm_or_si128(_mm_and_si128(mask, new_value), _mm_andnot_si128(mask, old_value));
+}
+
+void setSse2(long *dst, long value, const long *mask, size_t n)
+{
+    __m128i v = _mm_set1_epi64x(value);
+    for (size_t i = 0; i < n; i += 2)
+        storeSse(dst + i, blendSse(loadSse(dst + i), v, loadSse(mask + i)));
+}
+void copySse2(long *dst, const long *src, const long *mask, size_t n)
+{
+    for (size_t i = 0; i < n; i += 2)
+        storeSse(dst + i, blendSse(loadSse(dst + i), loadSse(src + i), loadSse(mask + i)));
+}
+void addSse2(long *dst, long value, const long *mask, size_t n)
+{
+    __m128i v = _mm_set1_epi64x(value);
+    for (size_t i = 0; i < n; i += 2)
+        storeSse(dst + i, _mm_add_epi64(loadSse(dst + i), _mm_and_si128(v, loadSse(mask + i))));
+}
+void addRowSse2(long *dst, const long *src, const long *mask, size_t n)
+{
+    for (size_t i = 0; i < n; i += 2)
+        storeSse(dst + i, _mm_add_epi64(loadSse(dst + i), _mm_and_si128(loadSse(src + i), loadSse(mask + i))));
+}
+void subFromSse2(long *dst, const long *minuend, const long *mask, size_t n)
+{
+    for (size_t i = 0; i < n; i += 2)
+    {
+        __m128i old_value = loadSse(dst + i);
+        storeSse(dst + i, blendSse(old_value, _mm_sub_epi64(loadSse(minuend + i), old_value), loadSse(mask + i)));
+    }
+}
+
+#define ENSEMBLE_AVX2 __attribute__((target("avx2")))
+ENSEMBLE_AVX2 inline __m256i loadAvx(const long *p) { return _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p)); }
+ENSEMBLE_AVX2 inline void storeAvx(long *p, __m256i v) { _mm256_storeu_si256(reinterpret_cast<__m256i *>(p), v); }
+
+ENSEMBLE_AVX2 void setAvx2(long *dst, long value, const long *mask, size_t n)
+{
+    __m256i v = _mm256_set1_epi64x(value);
+    for (size_t i = 0; i < n; i += 4)
+        storeAvx(dst + i, _mm256_blendv_epi8(loadAvx(dst + i), v, loadAvx(mask + i)));
+}
+ENSEMBLE_AVX2 void copyAvx2(long *dst, const long *src, const long *mask, size_t n)
+{
+    for (size_t i = 0; i < n; i += 4)
+        storeAvx(dst + i, _mm256_blendv_epi8(loadAvx(dst + i), loadAvx(src + i), loadAvx(mask + i)));
+}
+ENSEMBLE_AVX2 void addAvx2(long *dst, long value, const long *mask, size_t n)
+{
+    __m256i v = _mm256_set1_epi64x(value);
+    for (size_t i = 0; i < n; i += 4)
+        storeAvx(dst + i, _mm256_add_epi64(loadAvx(dst + i), _mm256_and_si256(v, loadAvx(mask + i))));
+}
+ENSEMBLE_AVX2 void addRowAvx2(long *dst, const long *src, const long *mask, size_t n)
+{
+    for (size_t i = 0; i < n; i += 4)
+        storeAvx(dst + i, _mm256_add_epi64(loadAvx(dst + i), _mm256_and_si256(loadAvx(src + i), loadAvx(mask + i))));
+}
+ENSEMBLE_AVX2 void subFromAvx2(long *dst, const long *minuend, const long *mask, size_t n)
+{
+    for (size_t i = 0; i < n; i += 4)
+    {
+        __m256i old_value = loadAvx(dst + i);
+        storeAvx(dst + i, _mm256_blendv_epi8(old_value, _mm256_sub_epi64(loadAvx(minuend + i), old_value), loadAvx(mask + i)));
+    }
+}
+#undef ENSEMBLE_AVX2
+#endif // ENSEMBLE_X86
+
+enum class VectorIsa
+{
+    SCALAR,
+    SSE2,
+    AVX2
+};
+
+VectorIsa detectVectorIsa()
+{
+#if ENSEMBLE_X86
+    return __builtin_cpu_supports("avx2") ? VectorIsa::AVX2 : VectorIsa::SSE2;
+#else
+    return VectorIsa::SCALAR;
+#endif
+}
+
+const RowKernels &rowKernels()
+{
+    static const RowKernels kernels = []
+    {
+        switch (detectVectorIsa())
+        {
+#if ENSEMBLE_X86
+        case VectorIsa::AVX2:
+            return RowKernels{setAvx2, copyAvx2, addAvx2, addRowAvx2, subFromAvx2};
+        case VectorIsa::SSE2:
+            return RowKernels{setSse2, copySse2, addSse2, addRowSse2, subFromSse2};
+#endif
+        default:
+            return RowKernels{setScalar, copyScalar, addScalar, addRowScalar, subFromScalar};
+        }
+    }();
+    return kernels;
+}
+
+constexpr size_t LANES_PER_VECTOR = 4; // Widest vector: AVX2, 4 x 64 bits
+
+} // namespace
+
+const char *Ensemble::vectorIsa()
+{
+    switch (detectVectorIsa())
+    {
+    case VectorIsa::AVX2:
+        return "avx2";
+    case VectorIsa::SSE2:
+        return "sse2";
+    default:
+        return "scalar";
+    }
+}
+
+Ensemble::Ensemble(std::shared_ptr<const Program> program, size_t lanes)
+    : program_(std::move(program)),
+      lanes_(lanes),
+      stride_((lanes + LANES_PER_VECTOR - 1) / LANES_PER_VECTOR * LANES_PER_VECTOR),
+      memory_size_(program_->memorySize()),
+      user_span_(0),
+      cells_(memory_size_ * stride_, 0),
+      pc_(lanes, 0),
+      user_(lanes, 0),
+      halted_(lanes, 0),
+      executed_(stride_, 0),
+      prn_output_(lanes),
+      mask_(stride_, 0),
+      group_begin_(0),
+      group_end_(0),
+      group_pc_(0),
+      group_user_(false),
+      group_budget_(0),
+      next_merge_pc_(0),
+      vector_lane_instructions_(0),
+      scalar_lane_instructions_(0)
+{
+    if (memory_size_ < REGISTERS_END_ADDR + 1)
+        throw std::runtime_error("Memory size too small for CPU registers.");
+    if (memory_size_ > static_cast<size_t>(USER_MEMORY_START_ADDR))
+        user_span_ = memory_size_ - USER_MEMORY_START_ADDR;
+
+    const Memory &initial = program_->initialMemory();
+    for (size_t address = 0; address < memory_size_; ++address)
+    {
+        long value = initial.readUnchecked(static_cast<long>(address));
+        for (size_t lane = 0; lane < lanes_; ++lane)
+            cells_[address * stride_ + lane] = value;
+    }
+    for (size_t lane = 0; lane < lanes_; ++lane)
+        pc_[lane] = cell(PC_ADDR, lane);
+}
+
+void Ensemble::restore(const MachineSnapshot &snapshot)
+{
+    if (snapshot.program != program_)
+        throw std::runtime_error("Snapshot was taken from a different program.");
+    for (size_t address = 0; address < memory_size_; ++address)
+    {
+        long value = snapshot.memory.readUnchecked(static_cast<long>(address));
+        for (size_t lane = 0; lane < lanes_; ++lane)
+            cells_[address * stride_ + lane] = value;
+    }
+    for (size_t lane = 0; lane < lanes_; ++lane)
+    {
+        pc_[lane] = cell(PC_ADDR, lane);
+        user_[lane] = snapshot.user_mode;
+        halted_[lane] = snapshot.halted;
+    }
+}
+
+void Ensemble::patch(size_t lane, long address, long value)
+{
+    if (address < 0 || static_cast<size_t>(address) >= memory_size_)
+        throw std::out_of_range(program_->initialMemory().outOfBoundsMessage(address));
+    cell(address, lane) = value;
+    if (address == PC_ADDR)
+        pc_[lane] = value;
+}
+
+void Ensemble::copyLaneTo(size_t lane, Memory &memory) const
+{
+    for (size_t address = 0; address < memory_size_; ++address)
+        memory.writeUnchecked(static_cast<long>(address), cells_[address * stride_ + lane]);
+}
+
+// Makes the waiting lanes with the lowest (PC, mode) the current group, kernel mode first.
+// Returns false once no lane is waiting.
+bool Ensemble::selectGroup(const std::vector<uint64_t> &max_cycles)
+{
+    for (size_t lane : group_)
+        mask_[lane] = 0;
+
+    if (waiting_[0].empty() && waiting_[1].empty())
+        return false;
+    const int mode = waiting_[0].empty() || (!waiting_[1].empty() && waiting_[1].begin()->first < waiting_[0].begin()->first) ? 1 : 0;
+    auto first = waiting_[mode].begin();
+    group_pc_ = first->first;
+    group_user_ = mode == 1;
+    group_ = std::move(first->second);
+    waiting_[mode].erase(first);
+    next_merge_pc_ = waiting_[mode].empty() ? LONG_MAX : waiting_[mode].begin()->first;
+
+    size_t lowest = group_.front(), highest = group_.front();
+    group_budget_ = UINT64_MAX;
+    for (size_t lane : group_)
+    {
+        mask_[lane] = -1;
+        lowest = std::min(lowest, lane);
+        highest = std::max(highest, lane);
+        group_budget_ = std::min(group_budget_, max_cycles[lane] - static_cast<uint64_t>(executed_[lane]));
+    }
+    group_begin_ = lowest / LANES_PER_VECTOR * LANES_PER_VECTOR;
+    group_end_ = (highest / LANES_PER_VECTOR + 1) * LANES_PER_VECTOR;
+    return true;
+}
+
+// Puts a lane that can still run back among the waiting lanes, joining any at its PC
+void Ensemble::enqueue(size_t lane, const std::vector<uint64_t> &max_cycles)
+{
+    if (!halted_[lane] && static_cast<uint64_t>(executed_[lane]) < max_cycles[lane])
+        waiting_[user_[lane] ? 1 : 0][pc_[lane]].push_back(lane);
+}
+
+// Executes instr for the whole group if it has a vector form, advancing pc. Returns false
+// (having changed nothing) if the group has to go lane by lane.
+bool Ensemble::runVector(const DecodedInstruction &instr, long &pc)
+{
+    const int mode = group_user_ ? 1 : 0;
+    if (instr.proven_operands[mode] != directOperands(instr.opcode))
+        return false;
+
+    const RowKernels &kernels = rowKernels();
+    const long *mask = mask_.data() + group_begin_;
+    const size_t width = group_end_ - group_begin_;
+    switch (instr.opcode)
+    {
+    case OpCode::SET:
+        kernels.set(groupRow(instr.arg2), instr.arg1, mask, width);
+        break;
+    case OpCode::CPY:
+        kernels.copy(groupRow(instr.arg2), groupRow(instr.arg1), mask, width);
+        break;
+    case OpCode::ADD:
+        kernels.add(groupRow(instr.arg1), instr.arg2, mask, width);
+        break;
+    case OpCode::ADDI:
+        kernels.add_row(groupRow(instr.arg1), groupRow(instr.arg2), mask, width);
+        break;
+    case OpCode::SUBI:
+        kernels.sub_from(groupRow(instr.arg2), groupRow(instr.arg1), mask, width);
+        break;
+    case OpCode::JIF:
+    {
+        // Stays in the vector path only if every lane takes the same branch
+        const long *values = row(instr.arg1);
+        bool taken = values[group_.front()] <= 0;
+        for (size_t lane : group_)
+        {
+            if ((values[lane] <= 0) != taken)
+                return false;
+        }
+        pc = taken ? instr.arg2 : pc + 1;
+        return true;
+    }
+    default:
+        return false;
+    }
+    ++pc;
+    return true;
+}
+
+void Ensemble::run(const std::vector<uint64_t> &max_cycles)
+{
+    const DecodedProgram &code = program_->code();
+    const RowKernels &kernels = rowKernels();
+
+    for (size_t lane = 0; lane < lanes_; ++lane)
+        enqueue(lane, max_cycles);
+
+    while (selectGroup(max_cycles))
+    {
+        if (group_.size() == 1)
+        {
+            // Nothing to share a vector with: step the lane until it catches up with another
+            size_t lane = group_.front();
+            uint64_t steps = 0;
+            do
+            {
+                stepLane(lane);
+                ++steps;
+            } while (steps < group_budget_ && !halted_[lane] && (user_[lane] != 0) == group_user_ && pc_[lane] < next_merge_pc_);
+            scalar_lane_instructions_ += steps;
+        }
+        else
+        {
+            // Uniform run: the group stays together until it reaches another lane in the
+            // same mode (to merge with it), runs out of budget, or needs the lane-by-lane
+            // path. Vector instructions never touch addresses 0-3, so the PC and the
+            // instruction counters are brought up to date once at the end.
+            long pc = group_pc_;
+            uint64_t steps = 0;
+            while (steps < group_budget_ && pc < next_merge_pc_ && runVector(code.fetch(pc), pc))
+                ++steps;
+
+            if (steps > 0)
+            {
+                const long *mask = mask_.data() + group_begin_;
+                const size_t width = group_end_ - group_begin_;
+                kernels.add(groupRow(INSTR_COUNT_ADDR), static_cast<long>(steps), mask, width);
+                kernels.add(executed_.data() + group_begin_, static_cast<long>(steps), mask, width);
+                for (size_t lane : group_)
+                    pc_[lane] = pc;
+                vector_lane_instructions_ += steps * group_.size();
+            }
+            else
+            {
+                for (size_t lane : group_)
+                    stepLane(lane);
+                scalar_lane_instructions_ += group_.size();
+            }
+        }
+
+        for (size_t lane : group_)
+            enqueue(lane, max_cycles);
+    }
+
+    for (size_t lane = 0; lane < lanes_; ++lane)
+        cell(PC_ADDR, lane) = pc_[lane];
+}
+
+// --- Lane-by-lane execution ---
+// Mirrors CPU::stepIn() and CPU::deliverFault() on one lane's cells. The PC lives in pc_;
+// SP and the instruction counter are plain cells here, which CPU's register cache
+// makes equivalent.
+
+bool Ensemble::laneRead(size_t lane, long address, long &value, FaultRecord &fault)
+{
+    if (user_[lane])
+    {
+        if (static_cast<unsigned long>(address) - USER_MEMORY_START_ADDR >= user_span_)
+        {
+            fault = {address >= 0 && address < USER_MEMORY_START_ADDR ? CpuFault::USER_READ_VIOLATION : CpuFault::READ_OUT_OF_BOUNDS, address};
+            return false;
+        }
+    }
+    else if (address < 0 || static_cast<size_t>(address) >= memory_size_)
+    {
+        fault = {CpuFault::READ_OUT_OF_BOUNDS, address};
+        return false;
+    }
+    value = address == PC_ADDR ? pc_[lane] : cell(address, lane);
+    return true;
+}
+
+bool Ensemble::laneWrite(size_t lane, long address, long value, long &next_pc, FaultRecord &fault)
+{
+    if (user_[lane])
+    {
+        if (static_cast<unsigned long>(address) - USER_MEMORY_START_ADDR >= user_span_)
+        {
+            fault = {address >= 0 && address < USER_MEMORY_START_ADDR ? CpuFault::USER_WRITE_VIOLATION : CpuFault::WRITE_OUT_OF_BOUNDS, address};
+            return false;
+        }
+    }
+    else if (address < 0 || static_cast<size_t>(address) >= memory_size_)
+    {
+        fault = {CpuFault::WRITE_OUT_OF_BOUNDS, address};
+        return false;
+    }
+    if (address == PC_ADDR)
+        next_pc = value; // A data write to the PC redirects execution after this instruction
+    else
+        cell(address, lane) = value;
+    return true;
+}
+
+long Ensemble::deliverLaneFault(size_t lane, long current_pc, const FaultRecord &fault)
+{
+    if (fault.kind == CpuFault::USER_READ_VIOLATION || fault.kind == CpuFault::USER_WRITE_VIOLATION)
+    {
+        user_[lane] = 0;
+        cell(SAVED_TRAP_PC_ADDR, lane) = current_pc;
+        cell(CPU_OS_COMM_ADDR, lane) = static_cast<long>(CpuEvent::MEMORY_FAULT_USER);
+        cell(SYSCALL_ARG1_PASS_ADDR, lane) = fault.address;
+        return OS_MEMORY_FAULT_HANDLER_PC;
+    }
+    if (!user_[lane])
+    {
+        halted_[lane] = 1;
+        return current_pc;
+    }
+
+    user_[lane] = 0;
+    cell(SAVED_TRAP_PC_ADDR, lane) = current_pc;
+    switch (fault.kind)
+    {
+    case CpuFault::STACK_OVERFLOW_PUSH:
+    case CpuFault::STACK_OVERFLOW_CALL:
+        cell(CPU_OS_COMM_ADDR, lane) = static_cast<long>(CpuEvent::MEMORY_FAULT_USER);
+        return OS_MEMORY_FAULT_HANDLER_PC;
+    case CpuFault::PC_OUT_OF_BOUNDS:
+        cell(CPU_OS_COMM_ADDR, lane) = static_cast<long>(CpuEvent::UNKNOWN_INSTRUCTION_FAULT);
+        return OS_UNKNOWN_INSTRUCTION_HANDLER_PC;
+    default:
+        cell(CPU_OS_COMM_ADDR, lane) = static_cast<long>(CpuEvent::ARITHMETIC_FAULT);
+        return OS_ARITHMETIC_FAULT_HANDLER_PC;
+    }
+}
+
+void Ensemble::stepLane(size_t lane)
+{
+    const long current_pc = pc_[lane];
+    const DecodedInstruction &instr = program_->code().fetch(current_pc);
+    long next_pc = current_pc + 1;
+    FaultRecord fault;
+    long a, b, value;
+
+    switch (instr.opcode)
+    {
+    case OpCode::SET:
+        laneWrite(lane, instr.arg2, instr.arg1, next_pc, fault);
+        break;
+    case OpCode::CPY:
+        if (laneRead(lane, instr.arg1, value, fault))
+            laneWrite(lane, instr.arg2, value, next_pc, fault);
+        break;
+    case OpCode::CPYI:
+        if (laneRead(lane, instr.arg1, a, fault) && laneRead(lane, a, value, fault))
+            laneWrite(lane, instr.arg2, value, next_pc, fault);
+        break;
+    case OpCode::CPYI2:
+        if (laneRead(lane, instr.arg1, a, fault) && laneRead(lane, instr.arg2, b, fault) && laneRead(lane, a, value, fault))
+            laneWrite(lane, b, value, next_pc, fault);
+        break;
+    case OpCode::ADD:
+        if (laneRead(lane, instr.arg1, a, fault))
+            laneWrite(lane, instr.arg1, a + instr.arg2, next_pc, fault);
+        break;
+    case OpCode::ADDI:
+        if (laneRead(lane, instr.arg1, a, fault) && laneRead(lane, instr.arg2, b, fault))
+            laneWrite(lane, instr.arg1, a + b, next_pc, fault);
+        break;
+    case OpCode::SUBI:
+        if (laneRead(lane, instr.arg1, a, fault) && laneRead(lane, instr.arg2, b, fault))
+            laneWrite(lane, instr.arg2, a - b, next_pc, fault);
+        break;
+    case OpCode::STOREI:
+        if (laneRead(lane, instr.arg1, value, fault) && laneRead(lane, instr.arg2, b, fault))
+            laneWrite(lane, b, value, next_pc, fault);
+        break;
+    case OpCode::LOADI:
+        if (laneRead(lane, instr.arg1, a, fault) && laneRead(lane, a, value, fault))
+            laneWrite(lane, instr.arg2, value, next_pc, fault);
+        break;
+    case OpCode::JIF:
+        if (laneRead(lane, instr.arg1, a, fault) && a <= 0)
+            next_pc = instr.arg2;
+        break;
+    case OpCode::PUSH:
+    {
+        long sp = cell(SP_ADDR, lane) - 1;
+        if (sp < 0)
+        {
+            fault = {CpuFault::STACK_OVERFLOW_PUSH, sp};
+            break;
+        }
+        cell(SP_ADDR, lane) = sp;
+        if (laneRead(lane, instr.arg1, value, fault))
+            laneWrite(lane, sp, value, next_pc, fault);
+        break;
+    }
+    case OpCode::POP:
+    {
+        long sp = cell(SP_ADDR, lane);
+        if (!laneRead(lane, sp, value, fault))
+            break;
+        cell(SP_ADDR, lane) = sp + 1;
+        laneWrite(lane, instr.arg1, value, next_pc, fault);
+        break;
+    }
+    case OpCode::CALL:
+    {
+        long sp = cell(SP_ADDR, lane) - 1;
+        if (sp < 0)
+        {
+            fault = {CpuFault::STACK_OVERFLOW_CALL, sp};
+            break;
+        }
+        cell(SP_ADDR, lane) = sp;
+        laneWrite(lane, sp, current_pc + 1, next_pc, fault);
+        next_pc = instr.arg1;
+        break;
+    }
+    case OpCode::RET:
+    {
+        long sp = cell(SP_ADDR, lane);
+        if (!laneRead(lane, sp, value, fault))
+            break;
+        cell(SP_ADDR, lane) = sp + 1;
+        next_pc = value;
+        break;
+    }
+    case OpCode::HLT:
+        halted_[lane] = 1;
+        next_pc = current_pc;
+        break;
+    case OpCode::USER:
+        if (!laneRead(lane, instr.arg1, value, fault))
+            break;
+        next_pc = value;
+        user_[lane] = 1;
+        break;
+    case OpCode::SYSCALL_PRN:
+        user_[lane] = 0; // Reads with kernel privileges
+        if (!laneRead(lane, instr.arg1, value, fault))
+            break;
+        prn_output_[lane].push_back(value);
+        cell(SAVED_TRAP_PC_ADDR, lane) = current_pc + 1;
+        cell(CPU_OS_COMM_ADDR, lane) = static_cast<long>(CpuEvent::SYSCALL_PRN);
+        cell(SYSCALL_ARG1_PASS_ADDR, lane) = instr.arg1;
+        next_pc = OS_SYSCALL_DISPATCHER_PC;
+        break;
+    case OpCode::SYSCALL_HLT_THREAD:
+    case OpCode::SYSCALL_YIELD:
+        user_[lane] = 0;
+        cell(SAVED_TRAP_PC_ADDR, lane) = current_pc + 1;
+        cell(CPU_OS_COMM_ADDR, lane) = static_cast<long>(instr.opcode == OpCode::SYSCALL_YIELD ? CpuEvent::SYSCALL_YIELD
+                                                                                               : CpuEvent::SYSCALL_HLT_THREAD);
+        next_pc = OS_SYSCALL_DISPATCHER_PC;
+        break;
+    case OpCode::HOLE:
+        halted_[lane] = 1;
+        next_pc = current_pc;
+        break;
+    case OpCode::END:
+        fault = {CpuFault::PC_OUT_OF_BOUNDS, current_pc};
+        break;
+    case OpCode::UNKNOWN:
+    default:
+        if (user_[lane])
+        {
+            user_[lane] = 0;
+            cell(SAVED_TRAP_PC_ADDR, lane) = current_pc;
+            cell(CPU_OS_COMM_ADDR, lane) = static_cast<long>(CpuEvent::UNKNOWN_INSTRUCTION_FAULT);
+            next_pc = OS_UNKNOWN_INSTRUCTION_HANDLER_PC;
+        }
+        else
+        {
+            halted_[lane] = 1;
+            next_pc = current_pc;
+        }
+        break;
+    }
+
+    if (fault.kind != CpuFault::NONE)
+        next_pc = deliverLaneFault(lane, current_pc, fault);
+
+    ++cell(INSTR_COUNT_ADDR, lane);
+    ++executed_[lane];
+    if (!halted_[lane])
+        pc_[lane] = next_pc;
+}
@@ -0,0 +1,103 @@
+// src/ensemble.h
+#ifndef ENSEMBLE_H
+#define ENSEMBLE_H
+
+#include "cpu.h"   // For CpuFault and FaultRecord
+#include <cstdint> // For uint64_t counters
+#include <map>     // For lanes waiting at each PC
+#include <memory>  // For std::shared_ptr<const Program>
+#include <vector>  // For std::vector lane state
+
+class Memory;
+class Program;
+struct MachineSnapshot;
+struct DecodedInstruction;
+
+// Runs one program on many machines ("lanes") in lockstep. Memories are stored as
+// structure of arrays, cells_[address * stride + lane], so one instruction touches a
+// contiguous row of cells across all lanes.
+//
+// Lanes are grouped by PC and privilege mode; the group with the lowest PC runs next,
+// which lets lanes that took different branches meet again. A group of one lane runs
+// on its own until it reaches another lane's PC. SET, CPY, ADD, ADDI and SUBI
+// with proven operands run as masked vector operations over the row (AVX2 or SSE2,
+// chosen at run time), as does a JIF on which every lane of the group agrees. Everything
+// else, including a JIF that splits the group, is executed lane by lane with the same
+// semantics as CPU::step(). Fault diagnostics are not printed.
+class Ensemble
+{
+public:
+    // lanes copies of program->initialMemory(), all starting in kernel mode
+    Ensemble(std::shared_ptr<const Program> program, size_t lanes);
+
+    // Sets every lane to snapshot, which must be of the same program. Throws
+    // std::runtime_error otherwise.
+    void restore(const MachineSnapshot &snapshot);
+
+    // Changes a cell of one lane before run(). Throws std::out_of_range for an invalid address.
+    void patch(size_t lane, long address, long value);
+
+    // Runs every lane until it halts or has executed its cycle limit.
+    void run(const std::vector<uint64_t> &max_cycles);
+
+    size_t laneCount() const { return lanes_; }
+    bool isHalted(size_t lane) const { return halted_[lane] != 0; }
+    uint64_t instructionsExecuted(size_t lane) const { return static_cast<uint64_t>(executed_[lane]); }
+    const std::vector<long> &prnOutput(size_t lane) const { return prn_output_[lane]; }
+
+    // Copies a lane's memory (registers synced) into memory, which must have the program's size.
+    void copyLaneTo(size_t lane, Memory &memory) const;
+
+    // Lane instructions executed by the vector path and lane by lane
+    uint64_t vectorLaneInstructions() const { return vector_lane_instructions_; }
+    uint64_t scalarLaneInstructions() const { return scalar_lane_instructions_; }
+
+    // Instruction set used for the vector path: "avx2", "sse2" or "scalar"
+    static const char *vectorIsa();
+
+private:
+    std::shared_ptr<const Program> program_;
+    size_t lanes_;
+    size_t stride_;     // lanes_ rounded up to a whole vector; padding lanes never run
+    size_t memory_size_;
+    unsigned long user_span_;
+
+    std::vector<long> cells_;    // memory_size_ rows of stride_ cells
+    std::vector<long> pc_;       // Per lane; cell 0 is only written back after run()
+    std::vector<char> user_;     // Per lane privilege mode
+    std::vector<char> halted_;
+    std::vector<long> executed_; // Per lane, stride_ entries so it can be updated as a row
+    std::vector<std::vector<long>> prn_output_;
+
+    // Lanes that can still run, by PC, per privilege mode (0 kernel, 1 user)
+    std::map<long, std::vector<size_t>> waiting_[2];
+
+    // Current group, from selectGroup()
+    std::vector<long> mask_;     // stride_ entries, -1 for lanes in the group
+    std::vector<size_t> group_;  // Lane indices
+    size_t group_begin_;         // Whole vectors of lanes covering the group: [begin, end)
+    size_t group_end_;
+    long group_pc_;
+    bool group_user_;
+    uint64_t group_budget_;      // Instructions every lane of the group may still run
+    long next_merge_pc_;         // Lowest PC of another waiting lane in the same mode
+
+    uint64_t vector_lane_instructions_;
+    uint64_t scalar_lane_instructions_;
+
+    long &cell(long address, size_t lane) { return cells_[static_cast<size_t>(address) * stride_ + lane]; }
+    long *row(long address) { return &cells_[static_cast<size_t>(address) * stride_]; }
+    long *groupRow(long address) { return row(address) + group_begin_; }
+
+    bool selectGroup(const std::vector<uint64_t> &max_cycles);
+    void enqueue(size_t lane, const std::vector<uint64_t> &max_cycles);
+    bool runVector(const DecodedInstruction &instr, long &pc);
+
+    // CPU::step() for one lane
+    void stepLane(size_t lane);
+    bool laneRead(size_t lane, long address, long &value, FaultRecord &fault);
+    bool laneWrite(size_t lane, long address, long value, long &next_pc, FaultRecord &fault);
+    long deliverLaneFault(size_t lane, long current_pc, const FaultRecord &fault);
+};
+
+#endif // ENSEMBLE_H
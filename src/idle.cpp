@@ -0,0 +1,297 @@
+// src/idle.cpp
+#include "idle.h"
+#include "common.h"      // For the memory-mapped registers
+#include "cpu.h"         // For the probed CPU
+#include "decoder.h"     // For DecodedInstruction
+#include "instruction.h" // For OpCode
+#include "memory.h"      // For cell values
+#include "program.h"     // For the code being probed
+#include <algorithm>     // For std::min
+#include <limits>        // For the range of a cell
+#include <unordered_map> // For per-cell coefficients and live-in values
+#include <unordered_set> // For the cells written
+#include <vector>        // For the JIF conditions
+
+namespace
+{
+
+// Larger multiples of the instruction counter are not worth modelling
+constexpr long MAX_COEFFICIENT = 1l << 20;
+
+// A JIF on a counter-derived cell: it jumps while value + coefficient * (counter change) <= 0
+struct CounterCondition
+{
+    long value;
+    long coefficient;
+};
+
+// Symbolic effect of one probed iteration. Every cell's value is modelled as
+// coefficient * (instruction counter) + constant; the constant is the cell's actual
+// value, so only the coefficients are tracked (0 for cells that do not depend on the
+// counter, 1 for the counter itself).
+class IterationModel
+{
+public:
+    explicit IterationModel(const Memory &memory) : memory_(memory), valid_(true) {}
+
+    bool valid() const { return valid_; }
+
+    // Starts a new iteration from the current memory
+    void reset();
+
+    // Applies instr, about to be executed with registers synced to memory
+    void apply(const DecodedInstruction &instr);
+
+    // True if all cells read before being written still hold their initial values
+    bool liveInUnchanged() const;
+
+    const std::unordered_map<long, long> &coefficients() const { return coefficients_; }
+    const std::vector<CounterCondition> &conditions() const { return conditions_; }
+
+private:
+    const Memory &memory_;
+    bool valid_;
+    std::unordered_map<long, long> coefficients_; // Non-zero only
+    std::unordered_map<long, long> live_in_;      // Cells read before being written, with their initial values
+    std::unordered_set<long> written_;
+    std::vector<CounterCondition> conditions_;
+
+    long value(long address);
+    long read(long address);
+    long pointer(long address);
+    void write(long address, long coefficient);
+};
+
+long IterationModel::value(long address)
+{
+    if (!memory_.isValidAddress(address))
+    {
+        valid_ = false; // The CPU faults
+        return 0;
+    }
+    return memory_.readUnchecked(address);
+}
+
+// Coefficient of a cell being read
+long IterationModel::read(long address)
+{
+    if (address == INSTR_COUNT_ADDR)
+        return 1;
+    if (address == PC_ADDR)
+        return 0; // The PC of this instruction, the same in every iteration
+    long cell = value(address);
+    if (!written_.count(address))
+        live_in_.emplace(address, cell);
+    auto it = coefficients_.find(address);
+    return it == coefficients_.end() ? 0 : it->second;
+}
+
+// Value of a cell used as an address, which must not depend on the counter
+long IterationModel::pointer(long address)
+{
+    if (read(address) != 0)
+        valid_ = false;
+    return value(address);
+}
+
+void IterationModel::write(long address, long coefficient)
+{
+    // The guest setting the counter, or jumping or moving the stack by it, is not a polling loop
+    bool register_by_counter = (address == PC_ADDR || address == SP_ADDR) && coefficient != 0;
+    if (address == INSTR_COUNT_ADDR || register_by_counter || coefficient > MAX_COEFFICIENT ||
+        coefficient < -MAX_COEFFICIENT || !memory_.isValidAddress(address))
+    {
+        valid_ = false;
+        return;
+    }
+    written_.insert(address);
+    if (coefficient != 0)
+        coefficients_[address] = coefficient;
+    else
+        coefficients_.erase(address);
+}
+
+void IterationModel::apply(const DecodedInstruction &instr)
+{
+    const long sp = memory_.readUnchecked(SP_ADDR);
+    switch (instr.opcode)
+    {
+    case OpCode::SET:
+        write(instr.arg2, 0);
+        break;
+    case OpCode::CPY:
+        write(instr.arg2, read(instr.arg1));
+        break;
+    case OpCode::CPYI:
+        write(instr.arg2, read(pointer(instr.arg1)));
+        break;
+    case OpCode::CPYI2:
+    {
+        long source = read(pointer(instr.arg1));
+        write(pointer(instr.arg2), source);
+        break;
+    }
+    case OpCode::ADD:
+        write(instr.arg1, read(instr.arg1));
+        break;
+    case OpCode::ADDI:
+        write(instr.arg1, read(instr.arg1) + read(instr.arg2));
+        break;
+    case OpCode::SUBI:
+        write(instr.arg2, read(instr.arg1) - read(instr.arg2));
+        break;
+    case OpCode::JIF:
+    {
+        long coefficient = read(instr.arg1);
+        if (coefficient != 0)
+            conditions_.push_back({value(instr.arg1), coefficient});
+        break;
+    }
+    case OpCode::PUSH:
+    {
+        long source = read(instr.arg1);
+        read(SP_ADDR);
+        write(sp - 1, source);
+        write(SP_ADDR, 0);
+        break;
+    }
+    case OpCode::POP:
+    {
+        read(SP_ADDR);
+        long source = read(sp);
+        write(SP_ADDR, 0);
+        write(instr.arg1, source);
+        break;
+    }
+    case OpCode::CALL:
+        read(SP_ADDR);
+        write(sp - 1, 0);
+        write(SP_ADDR, 0);
+        break;
+    case OpCode::RET:
+        read(SP_ADDR);
+        pointer(sp); // The return address
+        write(SP_ADDR, 0);
+        break;
+    case OpCode::LOADI:
+        write(instr.arg2, read(pointer(instr.arg1)));
+        break;
+    case OpCode::STOREI:
+    {
+        long source = read(instr.arg1);
+        write(pointer(instr.arg2), source);
+        break;
+    }
+    default: // HLT, USER, syscalls, holes: not an idle loop
+        valid_ = false;
+        break;
+    }
+}
+
+void IterationModel::reset()
+{
+    valid_ = true;
+    coefficients_.clear();
+    live_in_.clear();
+    written_.clear();
+    conditions_.clear();
+}
+
+bool IterationModel::liveInUnchanged() const
+{
+    for (const auto &cell : live_in_)
+    {
+        if (coefficients_.count(cell.first) || memory_.readUnchecked(cell.first) != cell.second)
+            return false;
+    }
+    return true;
+}
+
+} // namespace
+
+IdleProbeResult probeIdleLoop(CPU &cpu, Memory &memory, uint64_t max_cycles, size_t max_period)
+{
+    IdleProbeResult result;
+    if (cpu.isHalted() || max_cycles == 0)
+        return result;
+
+    const DecodedProgram &code = cpu.getProgram()->code();
+    long head = cpu.getCurrentProgramCounter();
+    const bool user_mode = cpu.isInUserMode();
+    cpu.syncRegistersToMemory();
+    long start_count = memory.readUnchecked(INSTR_COUNT_ADDR);
+
+    // One iteration: from head back to head, possibly passing it on the way (a loop
+    // body may call a subroutine the probe started in, or take several rounds to come
+    // back to the same state). A probe that starts in the middle of the loop, after the
+    // counter-derived values are computed, would see them as inputs of the iteration that
+    // then change; so it starts over once, at the target of the first backward JIF taken.
+    IterationModel model(memory);
+    size_t period = 0;
+    bool anchored = false;
+    bool repeated = false;
+    while (!repeated && period < max_period && result.executed < max_cycles)
+    {
+        const DecodedInstruction &instr = code.fetch(cpu.getCurrentProgramCounter());
+        const long pc = cpu.getCurrentProgramCounter();
+        model.apply(instr);
+        cpu.step();
+        ++result.executed;
+        ++period;
+        cpu.syncRegistersToMemory();
+        if (!model.valid() || cpu.isHalted() || cpu.isInUserMode() != user_mode)
+            return result;
+
+        const long next_pc = cpu.getCurrentProgramCounter();
+        if (!anchored && instr.opcode == OpCode::JIF && next_pc == instr.arg2 && next_pc <= pc)
+        {
+            anchored = true;
+            if (next_pc != head)
+            {
+                head = next_pc;
+                start_count = memory.readUnchecked(INSTR_COUNT_ADDR);
+                model.reset();
+                period = 0;
+                continue;
+            }
+        }
+        repeated = next_pc == head && model.liveInUnchanged();
+    }
+
+    if (!repeated || memory.readUnchecked(INSTR_COUNT_ADDR) != start_count + static_cast<long>(period))
+        return result;
+
+    // Iteration n after this one sees every counter-derived value shifted by
+    // coefficient * n * period; skip the iterations whose JIFs all still go the same way.
+    __int128 iterations = (max_cycles - result.executed) / period;
+    for (const CounterCondition &condition : model.conditions())
+    {
+        __int128 shift = static_cast<__int128>(condition.coefficient) * static_cast<long>(period); // Per iteration
+        if (condition.value <= 0 && shift > 0)
+            iterations = std::min<__int128>(iterations, -static_cast<__int128>(condition.value) / shift);
+        else if (condition.value > 0 && shift < 0)
+            iterations = std::min<__int128>(iterations, (static_cast<__int128>(condition.value) - 1) / -shift);
+    }
+    if (iterations <= 0)
+        return result;
+
+    // New values, all of which must still fit in a cell
+    const __int128 cycles = iterations * static_cast<long>(period);
+    std::vector<std::pair<long, long>> updates;
+    updates.reserve(model.coefficients().size() + 1);
+    updates.push_back({INSTR_COUNT_ADDR, 1});
+    updates.insert(updates.end(), model.coefficients().begin(), model.coefficients().end());
+    for (auto &update : updates)
+    {
+        __int128 shifted = memory.readUnchecked(update.first) + update.second * cycles;
+        if (shifted < std::numeric_limits<long>::min() || shifted > std::numeric_limits<long>::max())
+            return result;
+        update.second = static_cast<long>(shifted);
+    }
+    for (const auto &update : updates)
+        memory.write(update.first, update.second);
+    cpu.syncRegistersFromMemory();
+
+    result.skipped = static_cast<uint64_t>(cycles);
+    return result;
+}
@@ -0,0 +1,35 @@
+// src/idle.h
+#ifndef IDLE_H
+#define IDLE_H
+
+#include <cstddef> // For size_t
+#include <cstdint> // For cycle counts
+
+class CPU;
+class Memory;
+
+struct IdleProbeResult
+{
+    uint64_t executed = 0; // Instructions single-stepped by the probe
+    uint64_t skipped = 0;  // Cycles fast-forwarded without executing them
+};
+
+// --fast-idle: single-steps cpu from its current PC until the PC comes back to it with
+// the loop state repeated, at most max_period instructions per attempt and max_cycles
+// in total. If the first backward JIF taken jumps elsewhere, that target is the loop
+// head and the probe starts over from it, so it may begin anywhere in the loop. If
+// that iteration is a polling loop, the remaining iterations are skipped: the
+// instruction counter, and every cell whose value the loop derives from it, jump
+// straight to their values at the first iteration whose branches would go differently
+// (or at the end of max_cycles).
+//
+// An iteration counts as polling if every cell it reads before writing it is unchanged
+// at its end (apart from the instruction counter), and every other value it computes is
+// the instruction counter plus or minus constants. The next iterations then differ only
+// in those values, and the JIFs on them give the exact iteration at which the loop
+// leaves. Syscalls, USER, HLT, faults and indirect accesses through counter-derived
+// pointers end the probe without skipping. The skip is exact: memory, output and cycle
+// counts are the same as when executing every instruction.
+IdleProbeResult probeIdleLoop(CPU &cpu, Memory &memory, uint64_t max_cycles, size_t max_period = 2048);
+
+#endif // IDLE_H
@@ -7,13 +7,13 @@
 std::string opCodeToString(OpCode op)
 {
     // Using std::array as the size is fixed at compile time.
-    static const std::array<std::string, 20> opCodeStrings = {{
+    static const std::array<std::string, 22> opCodeStrings = {{
         "SET", "CPY", "CPYI", "CPYI2",
         "ADD", "ADDI", "SUBI", "JIF",
         "PUSH", "POP", "CALL", "RET", "HLT",
         "USER", "STOREI", "LOADI",
         "SYSCALL_PRN", "SYSCALL_HLT_THREAD", "SYSCALL_YIELD",
-        "UNKNOWN"}};
+        "HOLE", "END", "UNKNOWN"}};
     
     // Cast OpCode to its underlying type (usually int), then to size_t for bounds checking.
     size_t op_index = static_cast<size_t>(static_cast<std::underlying_type_t<OpCode>>(op));
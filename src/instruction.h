@@ -26,6 +26,8 @@ enum class OpCode
     SYSCALL_PRN,
     SYSCALL_HLT_THREAD,
     SYSCALL_YIELD,
+    HOLE,   // Unused slot in the instruction section (set by the decoder; halts with a warning)
+    END,    // Sentinel after the last instruction (set by the decoder; PC out of bounds)
     UNKNOWN // Placeholder for parsing errors or uninitialized instructions
 };
 
@@ -37,10 +39,11 @@ struct Instruction
     long arg2;
     int num_operands;
     std::string original_line; // Store the original instruction string for debugging
+    int source_line;           // Line number in the .img file (0 if not parsed from a file)
 
     // Default constructor
-    Instruction(OpCode op = OpCode::UNKNOWN, long a1 = 0, long a2 = 0, int num_ops = 0, std::string line = "")
-        : opcode(op), arg1(a1), arg2(a2), num_operands(num_ops), original_line(std::move(line)) {}
+    Instruction(OpCode op = OpCode::UNKNOWN, long a1 = 0, long a2 = 0, int num_ops = 0, std::string line = "", int src_line = 0)
+        : opcode(op), arg1(a1), arg2(a2), num_operands(num_ops), original_line(std::move(line)), source_line(src_line) {}
 };
 
 // Helper function to convert OpCode to string (declared, defined in a .cpp file)
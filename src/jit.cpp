@@ -0,0 +1,279 @@
+// src/jit.cpp
+#include "jit.h"
+#include "block_cache.h"
+#include <algorithm> // For std::fill
+#include <climits> // For INT32_MAX displacement limits
+#include <cstring> // For memcpy of immediates
+#include <initializer_list> // For Emitter::bytes
+
+#if defined(__x86_64__) && defined(__linux__)
+#include <sys/mman.h> // For mmap and mprotect of the code buffer
+#define JIT_SUPPORTED 1
+#else
+#define JIT_SUPPORTED 0
+#endif
+
+JitCompiler::JitCompiler(size_t code_capacity)
+    : buffer_(nullptr),
+      capacity_(code_capacity),
+      used_(0),
+      compiled_blocks_(0)
+{
+#if JIT_SUPPORTED
+    // The buffer is never writable and executable at once: compile() makes it writable
+    // while it emits and patches code, then executable again. Hosts that refuse
+    // executable memory are found here, before anything is compiled.
+    void *mapping = mmap(nullptr, capacity_, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mapping != MAP_FAILED)
+    {
+        buffer_ = static_cast<uint8_t *>(mapping);
+        if (!setWritable(false))
+        {
+            munmap(buffer_, capacity_);
+            buffer_ = nullptr;
+        }
+    }
+#endif
+}
+
+JitCompiler::~JitCompiler()
+{
+#if JIT_SUPPORTED
+    if (buffer_)
+        munmap(buffer_, capacity_);
+#endif
+}
+
+bool JitCompiler::setWritable(bool writable)
+{
+#if JIT_SUPPORTED
+    return mprotect(buffer_, capacity_, writable ? PROT_READ | PROT_WRITE : PROT_READ | PROT_EXEC) == 0;
+#else
+    (void)writable;
+    return false;
+#endif
+}
+
+void JitCompiler::growTables(size_t block_count)
+{
+    if (entries_.size() >= block_count)
+        return;
+    entry_counts_.resize(block_count, 0);
+    entries_.resize(block_count, nullptr);
+    uncompilable_.resize(block_count, false);
+    pending_exits_.resize(block_count);
+}
+
+JitBlockFn JitCompiler::enter(BlockCache &cache, int32_t index)
+{
+    size_t i = static_cast<size_t>(index);
+    growTables(cache.blockCount());
+    if (entries_[i] || uncompilable_[i] || !buffer_)
+        return entries_[i];
+    if (++entry_counts_[i] < HOT_THRESHOLD)
+        return nullptr;
+    entries_[i] = compile(cache, index);
+    uncompilable_[i] = entries_[i] == nullptr;
+    return entries_[i];
+}
+
+namespace
+{
+// Minimal x86-64 emitter. Register use: rdi = memory base, rsi = JitContext, rax/rcx scratch.
+class Emitter
+{
+public:
+    explicit Emitter(std::vector<uint8_t> &out) : out_(out) {}
+
+    void bytes(std::initializer_list<uint8_t> b) { out_.insert(out_.end(), b); }
+    void imm32(int32_t v) { append(&v, 4); }
+    void imm64(long v) { append(&v, 8); }
+
+    // mov rax, [rdi + disp]
+    void loadRax(int32_t disp) { bytes({0x48, 0x8B, 0x87}); imm32(disp); }
+    // mov [rdi + disp], rax
+    void storeRax(int32_t disp) { bytes({0x48, 0x89, 0x87}); imm32(disp); }
+    // add rax, [rdi + disp]
+    void addRaxMem(int32_t disp) { bytes({0x48, 0x03, 0x87}); imm32(disp); }
+    // sub rax, [rdi + disp]
+    void subRaxMem(int32_t disp) { bytes({0x48, 0x2B, 0x87}); imm32(disp); }
+    // mov rax, imm64
+    void movRaxImm(long v) { bytes({0x48, 0xB8}); imm64(v); }
+    // mov rcx, imm64; add rax, rcx
+    void addRaxImm(long v) { bytes({0x48, 0xB9}); imm64(v); bytes({0x48, 0x01, 0xC8}); }
+
+    // Exit stub: mov eax, pc; ret. Six bytes, so it can be patched into a jmp rel32.
+    size_t returnStub(long pc)
+    {
+        size_t at = out_.size();
+        bytes({0xB8});
+        imm32(static_cast<int32_t>(pc));
+        bytes({0xC3});
+        return at;
+    }
+
+    // Jump with a rel32 placeholder; returns the offset of the placeholder.
+    size_t jccRel32(uint8_t condition) { bytes({0x0F, condition}); size_t at = out_.size(); imm32(0); return at; }
+    void patchRel32(size_t at, size_t target)
+    {
+        int32_t rel = static_cast<int32_t>(static_cast<long>(target) - static_cast<long>(at + 4));
+        std::memcpy(&out_[at], &rel, 4);
+    }
+    size_t size() const { return out_.size(); }
+
+private:
+    std::vector<uint8_t> &out_;
+    void append(const void *p, size_t n) { const uint8_t *b = static_cast<const uint8_t *>(p); out_.insert(out_.end(), b, b + n); }
+};
+
+constexpr uint8_t JL = 0x8C;
+constexpr uint8_t JLE = 0x8E;
+
+bool fitsDisplacement(long address)
+{
+    return address >= 0 && address <= INT32_MAX / static_cast<long>(sizeof(long));
+}
+
+int32_t displacement(long address)
+{
+    return static_cast<int32_t>(address * static_cast<long>(sizeof(long)));
+}
+} // namespace
+
+JitBlockFn JitCompiler::compile(BlockCache &cache, int32_t index)
+{
+    // Copy: resolving successors below may translate blocks and move the cache's storage.
+    const TranslatedBlock block = cache.block(index);
+    const DecodedInstruction &exit = cache.exitInstruction(block);
+    const BlockOp *ops = cache.ops() + block.first_op;
+
+    bool native_jif = block.has_exit && exit.opcode == OpCode::JIF &&
+                      (exit.proven_operands[cache.mode()] & PROVEN_ARG1) != 0;
+    long cost = static_cast<long>(block.num_ops) + (native_jif ? 1 : 0);
+    if (cost == 0 || block.start_pc > INT32_MAX || block.fallthrough_pc > INT32_MAX ||
+        (native_jif && (!fitsDisplacement(exit.arg1) || exit.arg2 < 0 || exit.arg2 > INT32_MAX)))
+        return nullptr;
+    for (uint32_t i = 0; i < block.num_ops; ++i)
+    {
+        unsigned direct = directOperands(ops[i].opcode);
+        if (((direct & PROVEN_ARG1) && !fitsDisplacement(ops[i].arg1)) ||
+            ((direct & PROVEN_ARG2) && !fitsDisplacement(ops[i].arg2)))
+            return nullptr;
+    }
+
+    std::vector<uint8_t> code;
+    Emitter emit(code);
+
+    // Budget check and instruction counter, once for the whole block
+    emit.bytes({0x48, 0x8B, 0x46, 0x08});                  // mov rax, [rsi + 8]
+    emit.bytes({0x48, 0x3D}); emit.imm32(static_cast<int32_t>(cost)); // cmp rax, cost
+    size_t no_budget = emit.jccRel32(JL);
+    emit.bytes({0x48, 0x2D}); emit.imm32(static_cast<int32_t>(cost)); // sub rax, cost
+    emit.bytes({0x48, 0x89, 0x46, 0x08});                  // mov [rsi + 8], rax
+    emit.bytes({0x48, 0x81, 0x06}); emit.imm32(static_cast<int32_t>(cost)); // add qword [rsi], cost
+
+    for (uint32_t i = 0; i < block.num_ops; ++i)
+    {
+        const BlockOp &op = ops[i];
+        switch (op.opcode)
+        {
+        case OpCode::SET:
+            emit.movRaxImm(op.arg1);
+            emit.storeRax(displacement(op.arg2));
+            break;
+        case OpCode::CPY:
+            emit.loadRax(displacement(op.arg1));
+            emit.storeRax(displacement(op.arg2));
+            break;
+        case OpCode::ADD:
+            emit.loadRax(displacement(op.arg1));
+            emit.addRaxImm(op.arg2);
+            emit.storeRax(displacement(op.arg1));
+            break;
+        case OpCode::ADDI:
+            emit.loadRax(displacement(op.arg1));
+            emit.addRaxMem(displacement(op.arg2));
+            emit.storeRax(displacement(op.arg1));
+            break;
+        default: // SUBI
+            emit.loadRax(displacement(op.arg1));
+            emit.subRaxMem(displacement(op.arg2));
+            emit.storeRax(displacement(op.arg2));
+            break;
+        }
+    }
+
+    // Exits: (successor PC, stub offset). Only the fallthrough of a block without an exit
+    // instruction, and both sides of a native JIF, lead to blocks; any other exit returns
+    // to the interpreter at the exit instruction.
+    struct Exit { long pc; size_t stub; bool chainable; };
+    std::vector<Exit> exits;
+    if (native_jif)
+    {
+        emit.loadRax(displacement(exit.arg1));
+        emit.bytes({0x48, 0x85, 0xC0}); // test rax, rax
+        size_t taken = emit.jccRel32(JLE);
+        exits.push_back({block.fallthrough_pc, emit.returnStub(block.fallthrough_pc), true});
+        emit.patchRel32(taken, emit.size());
+        exits.push_back({exit.arg2, emit.returnStub(exit.arg2), true});
+    }
+    else
+    {
+        exits.push_back({block.end_pc, emit.returnStub(block.end_pc), !block.has_exit});
+    }
+
+    emit.patchRel32(no_budget, emit.size());
+    emit.returnStub(block.start_pc); // Nothing executed
+
+    if (used_ + code.size() > capacity_ || !setWritable(true))
+        return nullptr;
+    uint8_t *entry = buffer_ + used_;
+    std::memcpy(entry, code.data(), code.size());
+    used_ += code.size();
+    ++compiled_blocks_;
+
+    // Chain exits to successors that are already compiled, and remember the others.
+    for (const Exit &e : exits)
+    {
+        if (!e.chainable)
+            continue;
+        int32_t next = cache.successor(index, e.pc);
+        if (next < 0)
+            continue;
+        growTables(cache.blockCount());
+        size_t site = static_cast<size_t>(entry - buffer_) + e.stub;
+        if (entries_[static_cast<size_t>(next)])
+        {
+            uint8_t *target = reinterpret_cast<uint8_t *>(entries_[static_cast<size_t>(next)]);
+            int32_t rel = static_cast<int32_t>(target - (buffer_ + site + 5));
+            buffer_[site] = 0xE9; // jmp rel32
+            std::memcpy(buffer_ + site + 1, &rel, 4);
+        }
+        else
+        {
+            pending_exits_[static_cast<size_t>(next)].push_back(site);
+        }
+    }
+
+    // Patch exits of earlier blocks that were waiting for this one.
+    growTables(cache.blockCount());
+    for (size_t site : pending_exits_[static_cast<size_t>(index)])
+    {
+        int32_t rel = static_cast<int32_t>(entry - (buffer_ + site + 5));
+        buffer_[site] = 0xE9;
+        std::memcpy(buffer_ + site + 1, &rel, 4);
+    }
+    pending_exits_[static_cast<size_t>(index)].clear();
+
+    if (!setWritable(false))
+    {
+        // No compiled code can run any more: drop it all and stay on the block engine
+#if JIT_SUPPORTED
+        munmap(buffer_, capacity_);
+#endif
+        buffer_ = nullptr;
+        std::fill(entries_.begin(), entries_.end(), nullptr);
+        return nullptr;
+    }
+    return reinterpret_cast<JitBlockFn>(entry);
+}
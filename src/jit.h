@@ -0,0 +1,63 @@
+// src/jit.h
+#ifndef JIT_H
+#define JIT_H
+
+#include <cstddef> // For size_t
+#include <cstdint> // For uint8_t code bytes
+#include <vector>  // For std::vector per-block tables
+
+class BlockCache;
+
+// State shared with generated code. The layout is hard-coded in the emitted instructions.
+struct JitContext
+{
+    long instr_count; // Offset 0: the CPU's instruction counter, bumped per block
+    long budget;      // Offset 8: instructions the code may still execute
+};
+
+// Compiled block: runs from the block's entry and follows compiled successors until it
+// reaches code that is not compiled or the budget is too small for the next block.
+// Returns the PC to continue at.
+using JitBlockFn = long (*)(long *memory, JitContext *context);
+
+// x86-64 code generator for translated blocks (see BlockCache). Only the block body,
+// which cannot fault or touch the registers, and a JIF exit on a proven operand are
+// compiled; everything else returns to the interpreter. Compiled exits start as returns
+// and are patched into direct jumps once their successor block is compiled.
+class JitCompiler
+{
+public:
+    // Blocks are compiled once they have been entered this many times.
+    static constexpr uint32_t HOT_THRESHOLD = 16;
+
+    explicit JitCompiler(size_t code_capacity = 1 << 20);
+    ~JitCompiler();
+    JitCompiler(const JitCompiler &) = delete;
+    JitCompiler &operator=(const JitCompiler &) = delete;
+
+    // False if the host is not x86-64 Linux or no executable memory could be mapped.
+    bool isAvailable() const { return buffer_ != nullptr; }
+
+    // Compiled code for block index, counting the entry and compiling the block once it
+    // is hot. nullptr while the block is cold or could not be compiled.
+    JitBlockFn enter(BlockCache &cache, int32_t index);
+
+    size_t compiledBlockCount() const { return compiled_blocks_; }
+
+private:
+    uint8_t *buffer_;
+    size_t capacity_;
+    size_t used_;
+    size_t compiled_blocks_;
+    std::vector<uint32_t> entry_counts_;             // Per block index
+    std::vector<JitBlockFn> entries_;                // Per block index, nullptr if not compiled
+    std::vector<bool> uncompilable_;                 // Per block index
+    std::vector<std::vector<size_t>> pending_exits_; // Per block index: exit stubs to patch to it
+
+    // Switches the whole code buffer between read-write and read-execute
+    bool setWritable(bool writable);
+    void growTables(size_t block_count);
+    JitBlockFn compile(BlockCache &cache, int32_t index);
+};
+
+#endif // JIT_H
@@ -8,20 +8,44 @@
 #include <iomanip>
 #include <cctype>
 #include <cstring>
+#include <chrono>
+#include <algorithm>
+#include <memory>
+#include <unistd.h>
 
+#include "batch.h"
 #include "memory.h"
 #include "cpu.h"
 #include "common.h"
+#include "idle.h"
 #include "instruction.h"
+#include "opcode_costs.h"
 #include "parser.h"
+#include "prn_sink.h"
+#include "profile.h"
+#include "program.h"
+#include "snapshot.h"
+#include "trace.h"
 
-void handlePrnSyscall(long value)
+// Memory view after a -D1/-D2 step. With delta_dumps only the cells changed since the
+// previous dump are printed, except for full dumps, which become the new reference.
+// A sparse Memory leaves out all-zero pages in full dumps.
+void dumpStepMemory(Memory &mem, bool delta_dumps, bool full_dump)
 {
-    std::cout << value << std::endl;
+    if (delta_dumps && !full_dump)
+    {
+        std::cerr << "--- Changed Cells ---" << std::endl;
+        mem.dumpChanges(std::cerr);
+        return;
+    }
+    mem.dumpMemoryRange(std::cerr, 0, mem.getSize() - 1, mem.getBackend() == MemoryBackend::SPARSE);
+    if (delta_dumps)
+        mem.markClean();
 }
 
 // Dump for -D0 (after halt) or -D1/-D2 (after each step)
-void dumpMemoryForDebug(const Memory &mem, int debug_mode, bool after_halt = false)
+void dumpMemoryForDebug(Memory &mem, int debug_mode, bool after_halt = false,
+                        bool delta_dumps = false, bool full_dump = true)
 {
     if (debug_mode == 0 && after_halt)
     {
@@ -31,12 +55,12 @@ void dumpMemoryForDebug(const Memory &mem, int debug_mode, bool after_halt = fal
     else if (debug_mode == 1)
     {
         // std::cerr << "--- Memory Dump After Step ---" << std::endl; // Optional header
-        mem.dumpMemoryRange(std::cerr, 0, mem.getSize() - 1);
+        dumpStepMemory(mem, delta_dumps, full_dump);
     }
     else if (debug_mode == 2)
     {
         std::cerr << "--- Memory Dump After Step ---" << std::endl;
-        mem.dumpMemoryRange(std::cerr, 0, mem.getSize() - 1);
+        dumpStepMemory(mem, delta_dumps, full_dump);
         std::cerr << "--- Press ENTER to continue to next tick ---" << std::endl;
         std::cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
     }
@@ -109,11 +133,89 @@ void dumpThreadTableForDebug3(const Memory &mem, std::ostream &out)
     out << "---------------------------------------------------------" << std::endl;
 }
 
+// Differential testing for --lockstep: runs cpu in chunks of varying size, replays each
+// chunk on reference (a switch-engine CPU over its own copy of the initial memory) and
+// compares the whole machine after it. Adds the instructions run to cycle_count. Returns false at the first divergence, which is
+// reported to std::cerr.
+bool runLockstep(CPU &cpu, const Memory &memory, const std::vector<long> &prn_output,
+                 CPU &reference, const Memory &reference_memory, const std::vector<long> &reference_prn_output,
+                 uint64_t max_cycles, uint64_t &cycle_count)
+{
+    uint64_t executed = 0;
+    for (uint64_t chunk_index = 0; executed < max_cycles && !cpu.isHalted(); ++chunk_index)
+    {
+        uint64_t chunk = std::min<uint64_t>(1 + (chunk_index * 7) % 61, max_cycles - executed);
+        uint64_t ran = cpu.run(chunk).instructions_executed;
+        uint64_t reference_ran = reference.run(ran).instructions_executed;
+        executed += ran;
+        cycle_count += ran;
+
+        std::ostringstream divergence;
+        if (reference_ran != ran)
+            divergence << "executed " << ran << " instructions, reference " << reference_ran;
+        else if (cpu.isHalted() != reference.isHalted())
+            divergence << "halted " << cpu.isHalted() << ", reference " << reference.isHalted();
+        else if (cpu.isInUserMode() != reference.isInUserMode())
+            divergence << "user mode " << cpu.isInUserMode() << ", reference " << reference.isInUserMode();
+        else if (prn_output != reference_prn_output)
+            divergence << "PRN output differs (" << prn_output.size() << " values, reference "
+                       << reference_prn_output.size() << ")";
+        else
+        {
+            for (size_t address = 0; address < memory.getSize(); ++address)
+            {
+                long value = memory.readUnchecked(static_cast<long>(address));
+                long reference_value = reference_memory.readUnchecked(static_cast<long>(address));
+                if (value != reference_value)
+                {
+                    divergence << "memory[" << address << "] = " << value << ", reference " << reference_value;
+                    break;
+                }
+            }
+        }
+
+        if (!divergence.str().empty())
+        {
+            std::cerr << "Lockstep divergence after " << executed << " instructions: " << divergence.str() << std::endl;
+            return false;
+        }
+    }
+    std::cerr << "Lockstep: " << executed << " instructions matched the switch interpreter." << std::endl;
+    return true;
+}
+
 struct ProgramArgs
 {
     std::string filename;
     int debug_mode = -1;        // Default to no debug mode explicitly set
     size_t memory_size = 11000; // Default memory size
+    bool memory_size_given = false; // --memory-size was on the command line
+    uint64_t max_cycles = 200000; // Cycle budget, 0 for no limit
+    double max_wall_seconds = 0;  // Wall-time budget, 0 for no limit
+    bool fast_idle = false;       // Skip guest polling loops that only wait for the instruction counter
+    MemoryBackend memory_backend = MemoryBackend::DENSE;
+    bool memory_backend_given = false; // --memory-backend was on the command line
+    CpuEngine engine = CpuEngine::SWITCH;
+    bool show_stats = false;    // Print instruction throughput after the run
+    bool quiet_faults = false;  // Do not print CPU fault diagnostics
+    bool lockstep = false;      // Check the engine against the switch interpreter while running
+    std::string batch_file;     // Job file for --batch (replaces the program filename)
+    unsigned threads = 0;       // Worker threads for --batch, 0 for one per hardware thread
+    bool ensemble = false;      // Run the --batch jobs in lockstep as one SIMD ensemble
+    bool verify_ensemble = false; // Check --ensemble lanes against separate runs
+    std::string resume_file;    // Snapshot to continue from (replaces the program filename)
+    std::string snapshot_file;  // Where --save-snapshot writes the machine
+    long snapshot_at = -1;      // Cycle count to snapshot at, -1 for the end of OS boot
+    bool delta_dumps = false;   // -D1/-D2 print only the cells changed since the previous dump
+    unsigned long full_dump_every = 0; // With delta_dumps: steps between full dumps, 0 for only the first
+    std::string trace_file;     // Where --trace writes one binary record per instruction
+    std::string prn_file;       // Where SYSCALL PRN output goes instead of stdout
+    unsigned long flush_every = 0; // PRN values between flushes, 0 to flush only when the buffer is full
+    bool prn_interleaved = true; // Flush PRN output before each stderr diagnostic
+    bool profile = false;        // Count executions per PC, label and call stack
+    std::string profile_file;    // Where --profile writes its report, empty for stderr
+    std::string folded_file;     // Where --profile-folded writes folded call stacks
+    std::string symbols_file;    // Labels for --profile, empty for <image>_symbols.h
 };
 
 ProgramArgs parseArguments(int argc, char *argv[])
@@ -147,6 +249,7 @@ ProgramArgs parseArguments(int argc, char *argv[])
                 try
                 {
                     args.memory_size = std::stoul(argv[++i]);
+                    args.memory_size_given = true;
                 }
                 catch (const std::exception &e)
                 {
@@ -168,6 +271,221 @@ ProgramArgs parseArguments(int argc, char *argv[])
                 throw std::runtime_error("--memory-size option requires a value.");
             }
         }
+        else if (arg_str.rfind("--engine=", 0) == 0)
+        {
+            std::string engine_name = arg_str.substr(9);
+            if (engine_name == "switch")
+                args.engine = CpuEngine::SWITCH;
+            else if (engine_name == "threaded")
+                args.engine = CpuEngine::THREADED;
+            else if (engine_name == "block")
+                args.engine = CpuEngine::BLOCK;
+            else if (engine_name == "jit")
+                args.engine = CpuEngine::JIT;
+            else
+                throw std::runtime_error("Unknown engine '" + engine_name + "'. Expected 'switch', 'threaded', 'block' or 'jit'.");
+        }
+        else if (arg_str.rfind("--memory-backend=", 0) == 0)
+        {
+            std::string backend_name = arg_str.substr(17);
+            args.memory_backend_given = true;
+            if (backend_name == "dense")
+                args.memory_backend = MemoryBackend::DENSE;
+            else if (backend_name == "sparse")
+                args.memory_backend = MemoryBackend::SPARSE;
+            else
+                throw std::runtime_error("Unknown memory backend '" + backend_name + "'. Expected 'dense' or 'sparse'.");
+        }
+        else if (arg_str == "--delta-dumps")
+        {
+            args.delta_dumps = true;
+        }
+        else if (arg_str == "--full-dump-every")
+        {
+            if (i + 1 >= argc)
+                throw std::runtime_error("--full-dump-every option requires a step count.");
+            try
+            {
+                args.full_dump_every = std::stoul(argv[++i]);
+            }
+            catch (const std::exception &e)
+            {
+                throw std::runtime_error("Invalid value for --full-dump-every: " + std::string(argv[i]));
+            }
+            args.delta_dumps = true;
+        }
+        else if (arg_str == "--stats")
+        {
+            args.show_stats = true;
+        }
+        else if (arg_str == "--quiet-faults")
+        {
+            args.quiet_faults = true;
+        }
+        else if (arg_str == "--lockstep")
+        {
+            args.lockstep = true;
+        }
+        else if (arg_str == "--fast-idle")
+        {
+            args.fast_idle = true;
+        }
+        else if (arg_str == "--max-cycles")
+        {
+            if (i + 1 >= argc)
+                throw std::runtime_error("--max-cycles option requires a cycle count (0 for no limit).");
+            try
+            {
+                size_t used = 0;
+                std::string count = argv[++i];
+                args.max_cycles = std::stoull(count, &used);
+                if (used != count.size() || count[0] == '-')
+                    throw std::invalid_argument(count);
+            }
+            catch (const std::exception &e)
+            {
+                throw std::runtime_error("Invalid value for --max-cycles: " + std::string(argv[i]));
+            }
+        }
+        else if (arg_str == "--max-wall-time")
+        {
+            if (i + 1 >= argc)
+                throw std::runtime_error("--max-wall-time option requires a number of seconds (0 for no limit).");
+            try
+            {
+                size_t used = 0;
+                std::string seconds = argv[++i];
+                args.max_wall_seconds = std::stod(seconds, &used);
+                if (used != seconds.size() || !(args.max_wall_seconds >= 0))
+                    throw std::invalid_argument(seconds);
+            }
+            catch (const std::exception &e)
+            {
+                throw std::runtime_error("Invalid value for --max-wall-time: " + std::string(argv[i]));
+            }
+        }
+        else if (arg_str.rfind("--prn-file=", 0) == 0)
+        {
+            args.prn_file = arg_str.substr(11);
+            if (args.prn_file.empty())
+                throw std::runtime_error("--prn-file option requires a file name.");
+        }
+        else if (arg_str == "--flush-every")
+        {
+            if (i + 1 >= argc)
+                throw std::runtime_error("--flush-every option requires a value count.");
+            try
+            {
+                args.flush_every = std::stoul(argv[++i]);
+            }
+            catch (const std::exception &e)
+            {
+                throw std::runtime_error("Invalid value for --flush-every: " + std::string(argv[i]));
+            }
+        }
+        else if (arg_str.rfind("--prn-order=", 0) == 0)
+        {
+            std::string order = arg_str.substr(12);
+            if (order == "interleaved")
+                args.prn_interleaved = true;
+            else if (order == "buffered")
+                args.prn_interleaved = false;
+            else
+                throw std::runtime_error("Unknown PRN order '" + order + "'. Expected 'interleaved' or 'buffered'.");
+        }
+        else if (arg_str.rfind("--trace=", 0) == 0)
+        {
+            args.trace_file = arg_str.substr(8);
+            if (args.trace_file.empty())
+                throw std::runtime_error("--trace option requires a file name.");
+        }
+        else if (arg_str == "--profile")
+        {
+            args.profile = true;
+        }
+        else if (arg_str.rfind("--profile=", 0) == 0)
+        {
+            args.profile = true;
+            args.profile_file = arg_str.substr(10);
+            if (args.profile_file.empty())
+                throw std::runtime_error("--profile= requires a file name.");
+        }
+        else if (arg_str.rfind("--profile-folded=", 0) == 0)
+        {
+            args.profile = true;
+            args.folded_file = arg_str.substr(17);
+            if (args.folded_file.empty())
+                throw std::runtime_error("--profile-folded option requires a file name.");
+        }
+        else if (arg_str.rfind("--symbols=", 0) == 0)
+        {
+            args.symbols_file = arg_str.substr(10);
+            if (args.symbols_file.empty())
+                throw std::runtime_error("--symbols option requires a file name.");
+        }
+        else if (arg_str == "--batch")
+        {
+            if (i + 1 >= argc)
+                throw std::runtime_error("--batch option requires a job file.");
+            args.batch_file = argv[++i];
+        }
+        else if (arg_str == "--resume")
+        {
+            if (i + 1 >= argc)
+                throw std::runtime_error("--resume option requires a snapshot file.");
+            args.resume_file = argv[++i];
+        }
+        else if (arg_str == "--save-snapshot")
+        {
+            if (i + 1 >= argc)
+                throw std::runtime_error("--save-snapshot option requires a file name.");
+            args.snapshot_file = argv[++i];
+        }
+        else if (arg_str == "--snapshot-at")
+        {
+            if (i + 1 >= argc)
+                throw std::runtime_error("--snapshot-at option requires 'boot' or a cycle count.");
+            std::string point = argv[++i];
+            if (point == "boot")
+            {
+                args.snapshot_at = -1;
+            }
+            else
+            {
+                try
+                {
+                    size_t used = 0;
+                    args.snapshot_at = std::stol(point, &used);
+                    if (used != point.size() || args.snapshot_at < 0)
+                        throw std::invalid_argument(point);
+                }
+                catch (const std::exception &e)
+                {
+                    throw std::runtime_error("Invalid value for --snapshot-at: " + point);
+                }
+            }
+        }
+        else if (arg_str == "--ensemble")
+        {
+            args.ensemble = true;
+        }
+        else if (arg_str == "--verify-ensemble")
+        {
+            args.verify_ensemble = true;
+        }
+        else if (arg_str == "--threads")
+        {
+            if (i + 1 >= argc)
+                throw std::runtime_error("--threads option requires a value.");
+            try
+            {
+                args.threads = static_cast<unsigned>(std::stoul(argv[++i]));
+            }
+            catch (const std::exception &e)
+            {
+                throw std::runtime_error("Invalid value for --threads: " + std::string(argv[i]));
+            }
+        }
         else if (args.filename.empty())
         {
             args.filename = arg_str;
@@ -178,7 +496,27 @@ ProgramArgs parseArguments(int argc, char *argv[])
         }
     }
 
-    if (args.filename.empty())
+    if (!args.batch_file.empty())
+    {
+        if (!args.filename.empty())
+            throw std::runtime_error("--batch takes its images from the job file, not the command line.");
+        if (args.verify_ensemble && !args.ensemble)
+            throw std::runtime_error("--verify-ensemble only applies to --ensemble.");
+        return args;
+    }
+    if (args.ensemble || args.verify_ensemble)
+    {
+        throw std::runtime_error("--ensemble and --verify-ensemble only apply to --batch.");
+    }
+    if (!args.resume_file.empty() && !args.filename.empty())
+    {
+        throw std::runtime_error("--resume takes the program from the snapshot, not the command line.");
+    }
+    if (!args.resume_file.empty() && (args.memory_size_given || args.memory_backend_given))
+    {
+        throw std::runtime_error("--memory-size and --memory-backend do not apply to --resume: the snapshot's memory is mapped from its file.");
+    }
+    if (args.filename.empty() && args.resume_file.empty())
     {
         throw std::runtime_error("Program filename is required.");
     }
@@ -189,6 +527,38 @@ ProgramArgs parseArguments(int argc, char *argv[])
     }
     if (args.debug_mode == -1)
         args.debug_mode = 0; // Default to mode 0 if not specified
+    if (args.delta_dumps && args.debug_mode != 1 && args.debug_mode != 2)
+    {
+        throw std::runtime_error("--delta-dumps and --full-dump-every only apply to -D1 and -D2.");
+    }
+    if (args.lockstep && args.debug_mode != 0)
+    {
+        throw std::runtime_error("--lockstep requires debug mode 0.");
+    }
+    if (!args.trace_file.empty() && (args.lockstep || args.debug_mode != 0))
+    {
+        throw std::runtime_error("--trace requires debug mode 0 and cannot be combined with --lockstep.");
+    }
+    if (args.fast_idle && (args.debug_mode != 0 || args.lockstep || !args.trace_file.empty()))
+    {
+        throw std::runtime_error("--fast-idle requires debug mode 0 and cannot be combined with --lockstep or --trace.");
+    }
+    if (args.profile && (args.debug_mode != 0 || args.lockstep || !args.trace_file.empty() || args.fast_idle))
+    {
+        throw std::runtime_error("--profile requires debug mode 0 and cannot be combined with --lockstep, --trace or --fast-idle.");
+    }
+    if (!args.symbols_file.empty() && !args.profile)
+    {
+        throw std::runtime_error("--symbols only applies to --profile.");
+    }
+    if (args.lockstep && args.max_wall_seconds > 0)
+    {
+        throw std::runtime_error("--max-wall-time cannot be combined with --lockstep.");
+    }
+    if (args.lockstep && !args.snapshot_file.empty())
+    {
+        throw std::runtime_error("--save-snapshot cannot be combined with --lockstep.");
+    }
 
     return args;
 }
@@ -197,7 +567,12 @@ int main(int argc, char *argv[])
 {
     if (argc < 2)
     {
-        std::cerr << "Usage: ./gtu_sim <program_filename> [-D<0|1|2|3>] [--memory-size <size_in_longs>]" << std::endl;
+        std::cerr << "Usage: ./gtu_sim <program_filename> [-D<0|1|2|3>] [--memory-size <size_in_longs>] [--max-cycles <n|0>] [--max-wall-time <seconds>] [--fast-idle] [--memory-backend=<dense|sparse>] [--engine=<switch|threaded|block|jit>] [--lockstep] [--stats] [--quiet-faults]" << std::endl;
+        std::cerr << "                [--save-snapshot <file> [--snapshot-at <boot|cycles>]] [--delta-dumps] [--full-dump-every <steps>] [--trace=<file>]" << std::endl;
+        std::cerr << "                [--prn-file=<file>] [--flush-every <values>] [--prn-order=<interleaved|buffered>]" << std::endl;
+        std::cerr << "                [--profile[=<file>]] [--profile-folded=<file>] [--symbols=<file>]" << std::endl;
+        std::cerr << "       ./gtu_sim --resume <snapshot> [options as above]" << std::endl;
+        std::cerr << "       ./gtu_sim --batch <jobfile> [--threads <n> | --ensemble [--verify-ensemble]] [--stats] [--engine=<switch|threaded|block|jit>]" << std::endl;
         return 1;
     }
 
@@ -209,154 +584,523 @@ int main(int argc, char *argv[])
     catch (const std::exception &e)
     {
         std::cerr << "Argument Error: " << e.what() << std::endl;
-        std::cerr << "Usage: ./gtu_sim <program_filename> [-D<0|1|2|3>] [--memory-size <size_in_longs>]" << std::endl;
+        std::cerr << "Usage: ./gtu_sim <program_filename> [-D<0|1|2|3>] [--memory-size <size_in_longs>] [--max-cycles <n|0>] [--max-wall-time <seconds>] [--fast-idle] [--memory-backend=<dense|sparse>] [--engine=<switch|threaded|block|jit>] [--lockstep] [--stats] [--quiet-faults]" << std::endl;
+        std::cerr << "                [--save-snapshot <file> [--snapshot-at <boot|cycles>]] [--delta-dumps] [--full-dump-every <steps>] [--trace=<file>]" << std::endl;
+        std::cerr << "                [--prn-file=<file>] [--flush-every <values>] [--prn-order=<interleaved|buffered>]" << std::endl;
+        std::cerr << "                [--profile[=<file>]] [--profile-folded=<file>] [--symbols=<file>]" << std::endl;
+        std::cerr << "       ./gtu_sim --resume <snapshot> [options as above]" << std::endl;
+        std::cerr << "       ./gtu_sim --batch <jobfile> [--threads <n> | --ensemble [--verify-ensemble]] [--stats] [--engine=<switch|threaded|block|jit>]" << std::endl;
         return 1;
     }
 
-    Memory systemMemory(args.memory_size);
-    std::vector<Instruction> programInstructions;
-
-    std::ifstream programFile(args.filename);
-    if (!programFile.is_open())
+    if (!args.batch_file.empty())
     {
-        std::cerr << "Error: Could not open program file '" << args.filename << "'." << std::endl;
-        return 1;
+        BatchOptions batch_options;
+        batch_options.engine = args.engine;
+        batch_options.threads = args.threads;
+        batch_options.ensemble = args.ensemble;
+        batch_options.show_stats = args.show_stats;
+        batch_options.verify_ensemble = args.verify_ensemble;
+        try
+        {
+            size_t failed = runBatch(parseJobFile(args.batch_file), batch_options, std::cout);
+            return failed == 0 ? 0 : 1;
+        }
+        catch (const std::runtime_error &e)
+        {
+            std::cerr << "Batch error: " << e.what() << std::endl;
+            return 1;
+        }
     }
 
-    int total_lines_read_for_error = 0;
-    if (!systemMemory.loadDataSection(programFile, total_lines_read_for_error))
+    Memory systemMemory(args.memory_size, args.memory_backend);
+    std::shared_ptr<const Program> program;
+    MachineSnapshot resumed; // --resume: state to continue from
+
+    if (!args.resume_file.empty())
     {
-        // Error message already printed by loadDataSection
-        return 1;
+        try
+        {
+            resumed = loadSnapshot(args.resume_file);
+        }
+        catch (const std::runtime_error &e)
+        {
+            std::cerr << "Error: " << e.what() << std::endl;
+            return 1;
+        }
+        systemMemory = resumed.memory;
+        program = resumed.program;
+    }
+    else
+    {
+        std::vector<Instruction> programInstructions;
+
+        std::ifstream programFile(args.filename);
+        if (!programFile.is_open())
+        {
+            std::cerr << "Error: Could not open program file '" << args.filename << "'." << std::endl;
+            return 1;
+        }
+
+        int total_lines_read_for_error = 0;
+        if (!systemMemory.loadDataSection(programFile, total_lines_read_for_error))
+        {
+            // Error message already printed by loadDataSection
+            return 1;
+        }
+
+        try
+        {
+            // Pass total_lines_read_for_error by reference so it's updated
+            programInstructions = parseInstructionSection(programFile, args.filename, total_lines_read_for_error);
+            program = Program::create(programInstructions, systemMemory);
+        }
+        catch (const std::runtime_error &e)
+        {
+            std::cerr << "Error parsing instruction section: " << e.what() << std::endl;
+            return 1;
+        }
+        programFile.close();
+
+        long initial_pc = systemMemory.read(PC_ADDR);
+        if (initial_pc == 0 && programInstructions.empty())
+        {
+            std::cerr << "Warning: PC is 0 and no instructions loaded. CPU will likely halt or fault immediately." << std::endl;
+        }
+        else if (initial_pc == 0 && !programInstructions.empty() && OS_BOOT_START_PC != 0)
+        {
+            std::cerr << "Warning: Initial PC is 0 from data section. OS boot is expected at "
+                      << OS_BOOT_START_PC << " (or as per data section 0 value). "
+                      << "If OS instructions start at PC 0, this might be fine." << std::endl;
+        }
     }
 
+    // --lockstep: PRN output of both machines, compared after every chunk
+    MemoryPrnSink prn_output;
+    MemoryPrnSink reference_prn_output;
+
+    // SYSCALL PRN output is buffered. With --prn-order=interleaved (the default) it is
+    // flushed before anything is written to stderr, so diagnostics appear where they did
+    // unbuffered.
+    std::unique_ptr<FdPrnSink> prn_sink;
     try
     {
-        // Pass total_lines_read_for_error by reference so it's updated
-        programInstructions = parseInstructionSection(programFile, args.filename, total_lines_read_for_error);
+        if (args.prn_file.empty())
+            prn_sink.reset(new FdPrnSink(STDOUT_FILENO, FdPrnSink::DEFAULT_BUFFER_BYTES, args.flush_every));
+        else
+            prn_sink.reset(new FdPrnSink(args.prn_file, FdPrnSink::DEFAULT_BUFFER_BYTES, args.flush_every));
     }
     catch (const std::runtime_error &e)
     {
-        std::cerr << "Error parsing instruction section: " << e.what() << std::endl;
+        std::cerr << "Error: " << e.what() << std::endl;
         return 1;
     }
-    programFile.close();
+    if (args.prn_interleaved)
+        prn_sink->orderBefore(std::cerr);
 
-    long initial_pc = systemMemory.read(PC_ADDR);
-    if (initial_pc == 0 && programInstructions.empty())
+    CPU gtu_cpu(systemMemory, program, [&](long value)
+                {
+                    prn_sink->write(value);
+                    if (args.lockstep)
+                        prn_output.write(value);
+                });
+    gtu_cpu.setEngine(args.engine);
+    if (args.quiet_faults)
     {
-        std::cerr << "Warning: PC is 0 and no instructions loaded. CPU will likely halt or fault immediately." << std::endl;
+        gtu_cpu.setFaultLog(nullptr);
     }
-    else if (initial_pc == 0 && !programInstructions.empty() && OS_BOOT_START_PC != 0)
+    // --lockstep: a reference machine started from the same state. Only built when
+    // needed, as it is a second copy of the whole machine.
+    std::unique_ptr<Memory> reference_memory;
+    std::unique_ptr<CPU> reference_cpu;
+    if (args.lockstep)
+    {
+        reference_memory.reset(new Memory(systemMemory));
+        reference_cpu.reset(new CPU(*reference_memory, program, prnCallback(reference_prn_output)));
+        reference_cpu->setFaultLog(nullptr);
+    }
+
+    // --profile: labels come from --symbols, the symbols header gtu_assembler wrote next
+    // to the image, or the program itself; without any the report shows PCs only.
+    std::unique_ptr<GuestProfiler> profiler;
+    if (args.profile)
     {
-        std::cerr << "Warning: Initial PC is 0 from data section. OS boot is expected at "
-                  << OS_BOOT_START_PC << " (or as per data section 0 value). "
-                  << "If OS instructions start at PC 0, this might be fine." << std::endl;
+        std::vector<ProgramSymbol> symbols = program->symbols();
+        std::string symbols_file = args.symbols_file;
+        if (symbols_file.empty() && symbols.empty() && !args.filename.empty())
+        {
+            size_t dot = args.filename.rfind('.');
+            size_t slash = args.filename.rfind('/');
+            std::string base = dot != std::string::npos && (slash == std::string::npos || dot > slash) ? args.filename.substr(0, dot) : args.filename;
+            if (std::ifstream(base + "_symbols.h").good())
+                symbols_file = base + "_symbols.h";
+        }
+        if (!symbols_file.empty())
+        {
+            try
+            {
+                symbols = Program::loadSymbols(symbols_file);
+            }
+            catch (const std::runtime_error &e)
+            {
+                std::cerr << "Error: " << e.what() << std::endl;
+                return 1;
+            }
+        }
+        if (symbols.empty())
+            std::cerr << "Warning: No symbols for --profile; the report shows PCs only." << std::endl;
+        profiler.reset(new GuestProfiler(program->code(), symbols));
     }
 
-    CPU gtu_cpu(systemMemory, programInstructions, handlePrnSyscall);
+    uint64_t cycle_count = 0;
+    const uint64_t cycle_limit = args.max_cycles != 0 ? args.max_cycles : std::numeric_limits<uint64_t>::max();
 
-    int cycle_count = 0;
-    constexpr int MAX_CYCLES = 200000; // Increased max cycles for potentially longer OS runs
+    if (resumed.program)
+    {
+        // Cycles before the snapshot count against the cycle limit as if the run had never stopped
+        gtu_cpu.restore(resumed);
+        if (reference_cpu)
+            reference_cpu->restore(resumed);
+        cycle_count = std::min(resumed.cycles, cycle_limit);
+    }
+    const uint64_t start_cycle_count = cycle_count;
+    auto remaining_cycles = [&]
+    { return cycle_limit - cycle_count; };
+
+    // --save-snapshot: written once the snapshot point is reached. Returns false if the
+    // file could not be written.
+    // Boot ends with the first jump (or switch to user mode) after OS_BOOT_START, which is
+    // where the OS hands over to its scheduler. stepTrackingBoot() executes one instruction and notes it.
+    bool snapshot_pending = !args.snapshot_file.empty();
+    bool boot_done = resumed.program != nullptr; // A resumed machine has booted already
+    auto stepTrackingBoot = [&]
+    {
+        long pc = gtu_cpu.getCurrentProgramCounter();
+        gtu_cpu.step();
+        cycle_count++;
+        boot_done = boot_done || gtu_cpu.getCurrentProgramCounter() != pc + 1 || gtu_cpu.isInUserMode();
+    };
+    auto saveSnapshotIfDue = [&]
+    {
+        bool due = args.snapshot_at < 0 ? boot_done : cycle_count == static_cast<uint64_t>(args.snapshot_at);
+        if (!snapshot_pending || !due)
+            return true;
+        snapshot_pending = false;
+        try
+        {
+            saveSnapshot(gtu_cpu.snapshot(cycle_count), args.snapshot_file);
+        }
+        catch (const std::runtime_error &e)
+        {
+            std::cerr << "Error: " << e.what() << std::endl;
+            return false;
+        }
+        std::cerr << "Snapshot written to '" << args.snapshot_file << "' after " << cycle_count << " cycles." << std::endl;
+        return true;
+    };
 
     bool prev_is_user_mode = gtu_cpu.isInUserMode(); // Initial state before first step
 
-    while (!gtu_cpu.isHalted() && cycle_count < MAX_CYCLES)
+    auto run_start = std::chrono::steady_clock::now();
+
+    // --max-wall-time: the clock is read between CPU::run() chunks of WALL_TIME_CHUNK
+    // cycles, and every WALL_TIME_STEPS steps in the single-stepping loops, so the
+    // engines' loops carry no extra check.
+    constexpr uint64_t WALL_TIME_CHUNK = 1u << 22;
+    constexpr uint64_t WALL_TIME_STEPS = 1u << 16;
+    bool wall_time_exceeded = false;
+    auto wallTimeUp = [&]
+    {
+        if (args.max_wall_seconds > 0 && !wall_time_exceeded)
+        {
+            std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - run_start;
+            wall_time_exceeded = elapsed.count() >= args.max_wall_seconds;
+        }
+        return wall_time_exceeded;
+    };
+    auto withinBudget = [&]
+    {
+        if (cycle_count >= cycle_limit)
+            return false;
+        return (cycle_count - start_cycle_count) % WALL_TIME_STEPS != 0 || !wallTimeUp();
+    };
+
+    // --fast-idle: between chunks the guest is probed for a polling loop. Failed probes
+    // double the chunk (up to IDLE_PROBE_MAX), so busy guests are rarely probed.
+    constexpr uint64_t IDLE_PROBE_MIN = 64;
+    constexpr uint64_t IDLE_PROBE_MAX = 1u << 24;
+    uint64_t idle_probe_interval = IDLE_PROBE_MIN;
+    uint64_t idle_cycles_skipped = 0;
+    uint64_t idle_loops_skipped = 0;
+    auto runFor = [&](uint64_t cycles)
     {
-        // For -D3: condition check *before* step, based on state *about to be caused by OS* or *just caused by thread*
-        // This is tricky. Let's try state change *after* step.
+        while (cycles > 0 && !gtu_cpu.isHalted() && !wallTimeUp())
+        {
+            uint64_t chunk = args.max_wall_seconds > 0 ? std::min(cycles, WALL_TIME_CHUNK) : cycles;
+            if (args.fast_idle)
+                chunk = std::min(chunk, idle_probe_interval);
+            uint64_t ran = gtu_cpu.run(chunk).instructions_executed;
+            cycle_count += ran;
+            cycles -= ran;
 
+            if (args.fast_idle && cycles > 0 && !gtu_cpu.isHalted())
+            {
+                IdleProbeResult probe = probeIdleLoop(gtu_cpu, systemMemory, cycles);
+                cycle_count += probe.executed + probe.skipped;
+                cycles -= probe.executed + probe.skipped;
+                idle_cycles_skipped += probe.skipped;
+                idle_loops_skipped += probe.skipped > 0;
+                idle_probe_interval = probe.skipped > 0 ? IDLE_PROBE_MIN : std::min(idle_probe_interval * 2, IDLE_PROBE_MAX);
+            }
+        }
+    };
 
-        /* long current_pc_for_debug = gtu_cpu.getCurrentProgramCounter();
-        if (current_pc_for_debug >= 0 && static_cast<size_t>(current_pc_for_debug) < programInstructions.size())
+    if (args.lockstep)
+    {
+        if (!runLockstep(gtu_cpu, systemMemory, prn_output.values(), *reference_cpu, *reference_memory,
+                         reference_prn_output.values(), remaining_cycles(), cycle_count))
+            return 1;
+    }
+    else if (!args.trace_file.empty())
+    {
+        // --trace records every instruction, so it uses the reference interpreter. The
+        // records go to a writer thread; the loop itself never waits for the disk.
+        std::unique_ptr<TraceWriter> writer;
+        try
+        {
+            writer.reset(new TraceWriter(args.trace_file));
+        }
+        catch (const std::runtime_error &e)
+        {
+            std::cerr << "Error: " << e.what() << std::endl;
+            return 1;
+        }
+        if (!saveSnapshotIfDue())
+            return 1;
+        TraceRecord record;
+        gtu_cpu.syncRegistersToMemory();
+        while (!gtu_cpu.isHalted() && withinBudget())
+        {
+            beginTraceRecord(record, gtu_cpu, systemMemory, cycle_count);
+            stepTrackingBoot();
+            gtu_cpu.syncRegistersToMemory();
+            endTraceRecord(record, gtu_cpu, systemMemory);
+            writer->append(record);
+            if (!saveSnapshotIfDue())
+                return 1;
+        }
+        try
+        {
+            writer->finish();
+        }
+        catch (const std::runtime_error &e)
+        {
+            std::cerr << "Error: " << e.what() << std::endl;
+            return 1;
+        }
+        std::cerr << "Trace of " << writer->recordCount() << " instructions written to '" << args.trace_file << "'." << std::endl;
+    }
+    else if (profiler)
+    {
+        // --profile sees every instruction, so it single-steps the reference interpreter
+        if (!saveSnapshotIfDue())
+            return 1;
+        gtu_cpu.syncRegistersToMemory();
+        while (!gtu_cpu.isHalted() && withinBudget())
+        {
+            profiler->beforeStep(gtu_cpu);
+            stepTrackingBoot();
+            gtu_cpu.syncRegistersToMemory();
+            profiler->afterStep(gtu_cpu, systemMemory);
+            if (!saveSnapshotIfDue())
+                return 1;
+        }
+    }
+    else if (args.debug_mode == 0)
+    {
+        // Nothing to observe between instructions: stay inside the CPU until it halts
+        // or the cycle budget runs out, stopping once on the way for --save-snapshot.
+        if (snapshot_pending)
         {
-            // Ensure there's a valid instruction at the PC to prevent crashing the simulator
-            const Instruction &instr_to_exec = programInstructions[static_cast<size_t>(current_pc_for_debug)];
-            if (instr_to_exec.opcode != OpCode::UNKNOWN || !instr_to_exec.original_line.empty())
+            if (args.snapshot_at >= 0)
             {
-                // Print to std::cerr so it doesn't interfere with the program's SYSCALL PRN output
-                std::cerr << "Cycle " << std::setw(5) << cycle_count
-                          << " | PC: " << std::setw(4) << current_pc_for_debug
-                          << " | Executing: " << instr_to_exec.original_line << std::endl;
+                uint64_t snapshot_at = static_cast<uint64_t>(args.snapshot_at);
+                if (snapshot_at > cycle_count)
+                    runFor(std::min(snapshot_at - cycle_count, remaining_cycles()));
+            }
+            else
+            {
+                // The boot sequence is short, so it is single-stepped to find its end
+                while (!boot_done && !gtu_cpu.isHalted() && withinBudget())
+                    stepTrackingBoot();
+                gtu_cpu.syncRegistersToMemory();
             }
+            if (!saveSnapshotIfDue())
+                return 1;
         }
-        else
+        runFor(remaining_cycles());
+    }
+    else
+    {
+        // Debug modes 1-3 inspect state after every step, so they use the reference interpreter.
+        if (!saveSnapshotIfDue())
+            return 1;
+        unsigned long steps_dumped = 0; // -D1/-D2 memory dumps so far
+        while (!gtu_cpu.isHalted() && withinBudget())
         {
-            std::cerr << "Cycle " << std::setw(5) << cycle_count
-                      << " | PC: " << std::setw(4) << current_pc_for_debug
-                      << " | NOTE: PC is out of instruction bounds. CPU will fault." << std::endl;
-        }  */
+            // For -D3: condition check *before* step, based on state *about to be caused by OS* or *just caused by thread*
+            // This is tricky. Let's try state change *after* step.
 
-        gtu_cpu.step();
-        cycle_count++;
 
-        bool current_is_user_mode = gtu_cpu.isInUserMode();
-        CpuEvent current_event_code = static_cast<CpuEvent>(systemMemory.read(CPU_OS_COMM_ADDR));
+            /* long current_pc_for_debug = gtu_cpu.getCurrentProgramCounter();
+            if (current_pc_for_debug >= 0 && static_cast<size_t>(current_pc_for_debug) < programInstructions.size())
+            {
+                // Ensure there's a valid instruction at the PC to prevent crashing the simulator
+                const Instruction &instr_to_exec = programInstructions[static_cast<size_t>(current_pc_for_debug)];
+                if (instr_to_exec.opcode != OpCode::UNKNOWN || !instr_to_exec.original_line.empty())
+                {
+                    // Print to std::cerr so it doesn't interfere with the program's SYSCALL PRN output
+                    std::cerr << "Cycle " << std::setw(5) << cycle_count
+                              << " | PC: " << std::setw(4) << current_pc_for_debug
+                              << " | Executing: " << instr_to_exec.original_line << std::endl;
+                }
+            }
+            else
+            {
+                std::cerr << "Cycle " << std::setw(5) << cycle_count
+                          << " | PC: " << std::setw(4) << current_pc_for_debug
+                          << " | NOTE: PC is out of instruction bounds. CPU will fault." << std::endl;
+            }  */
 
-        if (args.debug_mode == 3)
-        {
-            bool syscall_like_event_occurred = (current_event_code != CpuEvent::NONE);
-            bool context_switch_to_user = !prev_is_user_mode && current_is_user_mode;
-            bool syscall_trap_to_kernel = prev_is_user_mode && !current_is_user_mode && syscall_like_event_occurred;
-            
-            // For debug mode 3, we should trigger on any syscall or context switch
-            // This includes: any non-NONE event, or mode transitions
-            bool should_dump_thread_table = context_switch_to_user || syscall_trap_to_kernel || syscall_like_event_occurred;
+            stepTrackingBoot();
+            gtu_cpu.syncRegistersToMemory(); // Debug views below read PC/SP/INSTR_COUNT from memory
+            if (!saveSnapshotIfDue())
+                return 1;
 
-            if (should_dump_thread_table)
+            bool current_is_user_mode = gtu_cpu.isInUserMode();
+            CpuEvent current_event_code = static_cast<CpuEvent>(systemMemory.read(CPU_OS_COMM_ADDR));
+
+            if (args.debug_mode == 3)
             {
-                std::cerr << "--- D3: Event Trigger (Cycle " << cycle_count << ") ---" << std::endl;
-                if (context_switch_to_user)
-                    std::cerr << "Context switch to USER detected." << std::endl;
-                if (syscall_trap_to_kernel)
-                    std::cerr << "Syscall/Trap to KERNEL detected. Event: " << static_cast<long>(current_event_code) << std::endl;
-                if (syscall_like_event_occurred && !syscall_trap_to_kernel)
-                    std::cerr << "System call event detected. Event: " << static_cast<long>(current_event_code) << std::endl;
+                bool syscall_like_event_occurred = (current_event_code != CpuEvent::NONE);
+                bool context_switch_to_user = !prev_is_user_mode && current_is_user_mode;
+                bool syscall_trap_to_kernel = prev_is_user_mode && !current_is_user_mode && syscall_like_event_occurred;
+            
+                // For debug mode 3, we should trigger on any syscall or context switch
+                // This includes: any non-NONE event, or mode transitions
+                bool should_dump_thread_table = context_switch_to_user || syscall_trap_to_kernel || syscall_like_event_occurred;
+
+                if (should_dump_thread_table)
+                {
+                    std::cerr << "--- D3: Event Trigger (Cycle " << cycle_count << ") ---" << std::endl;
+                    if (context_switch_to_user)
+                        std::cerr << "Context switch to USER detected." << std::endl;
+                    if (syscall_trap_to_kernel)
+                        std::cerr << "Syscall/Trap to KERNEL detected. Event: " << static_cast<long>(current_event_code) << std::endl;
+                    if (syscall_like_event_occurred && !syscall_trap_to_kernel)
+                        std::cerr << "System call event detected. Event: " << static_cast<long>(current_event_code) << std::endl;
                     
-                dumpThreadTableForDebug3(systemMemory, std::cerr);
+                    dumpThreadTableForDebug3(systemMemory, std::cerr);
                 
-                // DEBUG MODE SHOULD ONLY OBSERVE, NOT MODIFY SYSTEM STATE
-                // The OS itself will clear events when appropriate - we don't interfere
-                std::cerr << "Event preserved for OS handling (not cleared by debug mode)." << std::endl;
+                    // DEBUG MODE SHOULD ONLY OBSERVE, NOT MODIFY SYSTEM STATE
+                    // The OS itself will clear events when appropriate - we don't interfere
+                    std::cerr << "Event preserved for OS handling (not cleared by debug mode)." << std::endl;
                 
-                // Optional pause for mode 3 event
-                std::cerr << "--- Press ENTER to continue after D3 event ---" << std::endl;
-                std::cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+                    // Optional pause for mode 3 event
+                    std::cerr << "--- Press ENTER to continue after D3 event ---" << std::endl;
+                    std::cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+                }
             }
-        }
 
-        // Dumps for -D1, -D2 happen after step
-        if (args.debug_mode == 1)
-        {
-            dumpMemoryForDebug(systemMemory, args.debug_mode);
-        }
-        else if (args.debug_mode == 2)
-        {
-            dumpMemoryForDebug(systemMemory, args.debug_mode); // This includes its own "Press ENTER"
-            // No need for "Cycle ... completed" here as dumpMemoryForDebug handles the pause
-        }
-        prev_is_user_mode = current_is_user_mode;
-        if (current_event_code != CpuEvent::NONE && !gtu_cpu.isInUserMode())
-        { // Clear event if OS is handling it
-            // This assumes OS will handle it in its current timeslice.
-            // Or OS can clear it by writing 0 to CPU_OS_COMM_ADDR
-            // memory.write(CPU_OS_COMM_ADDR, static_cast<long>(CpuEvent::NONE)); // CPU might do this or OS does
+            // Dumps for -D1, -D2 happen after step. The first one is always full.
+            bool full_dump = steps_dumped == 0 || (args.full_dump_every > 0 && steps_dumped % args.full_dump_every == 0);
+            if (args.debug_mode == 1)
+            {
+                dumpMemoryForDebug(systemMemory, args.debug_mode, false, args.delta_dumps, full_dump);
+            }
+            else if (args.debug_mode == 2)
+            {
+                dumpMemoryForDebug(systemMemory, args.debug_mode, false, args.delta_dumps, full_dump); // This includes its own "Press ENTER"
+                // No need for "Cycle ... completed" here as dumpMemoryForDebug handles the pause
+            }
+            ++steps_dumped;
+            prev_is_user_mode = current_is_user_mode;
+            if (current_event_code != CpuEvent::NONE && !gtu_cpu.isInUserMode())
+            { // Clear event if OS is handling it
+                // This assumes OS will handle it in its current timeslice.
+                // Or OS can clear it by writing 0 to CPU_OS_COMM_ADDR
+                // memory.write(CPU_OS_COMM_ADDR, static_cast<long>(CpuEvent::NONE)); // CPU might do this or OS does
+            }
         }
     }
 
+    std::chrono::duration<double> run_seconds = std::chrono::steady_clock::now() - run_start;
+
+    if (snapshot_pending)
+    {
+        std::cerr << "Warning: The snapshot point was not reached; no snapshot was written." << std::endl;
+    }
+
+    prn_sink->flush(); // Before the run summary on stdout
+    if (prn_sink->failed())
+    {
+        std::cerr << "Error: Could not write the PRN output." << std::endl;
+        return 1;
+    }
+
     if (gtu_cpu.isHalted())
     {
         std::cout << "Program HLT instruction executed after " << cycle_count << " cycles." << std::endl;
     }
-    else if (cycle_count >= MAX_CYCLES)
+    else if (cycle_count >= cycle_limit)
     {
-        std::cerr << "Program terminated: Maximum cycle limit reached (" << MAX_CYCLES << ")." << std::endl;
+        std::cerr << "Program terminated: Maximum cycle limit reached (" << cycle_limit << ")." << std::endl;
+    }
+    else if (wall_time_exceeded)
+    {
+        std::cerr << "Program terminated: Wall-time limit reached (" << args.max_wall_seconds << " s) after "
+                  << cycle_count << " cycles." << std::endl;
     }
     else
     {
         std::cout << "Program ended for unknown reason after " << cycle_count << " cycles." << std::endl;
     }
 
+    if (args.show_stats)
+    {
+        double seconds = run_seconds.count();
+        const char *engine_name = args.engine == CpuEngine::THREADED ? "threaded"
+                                  : args.engine == CpuEngine::BLOCK  ? "block"
+                                  : args.engine == CpuEngine::JIT    ? "jit"
+                                                                     : "switch";
+        uint64_t executed = cycle_count - start_cycle_count - idle_cycles_skipped; // This process only, after --resume
+        std::cerr << "Engine: " << engine_name
+                  << ", " << executed << " instructions in " << seconds << " s ("
+                  << (seconds > 0 ? executed / seconds / 1e6 : 0.0) << " MIPS)" << std::endl;
+
+        // Superinstructions only exist in the threaded engine
+        if (args.engine == CpuEngine::THREADED)
+        {
+            std::cerr << "Fused ops:";
+            for (size_t op = 1; op < static_cast<size_t>(FusedOp::COUNT); ++op)
+                std::cerr << " " << fusedOpName(static_cast<FusedOp>(op)) << "="
+                          << gtu_cpu.getFusedOpCount(static_cast<FusedOp>(op));
+            std::cerr << std::endl;
+        }
+        if (args.engine == CpuEngine::JIT)
+        {
+            std::cerr << "JIT compiled blocks: " << gtu_cpu.getJitCompiledBlockCount() << std::endl;
+        }
+        if (args.fast_idle)
+        {
+            std::cerr << "Fast idle: " << idle_cycles_skipped << " cycles skipped in " << idle_loops_skipped << " polling loops" << std::endl;
+        }
+        // Built with make OPCODE_COSTS=1: only instructions run by the reference
+        // interpreter (the switch engine, -D1-3, --trace, --profile) are timed
+        if (const OpcodeCosts *costs = gtu_cpu.getOpcodeCosts())
+            costs->write(std::cerr);
+    }
+
     // Final dump for mode 0 (or always if desired)
     if (args.debug_mode == 0 || args.debug_mode == -1)
     {                                              // -1 was if not set, now defaults to 0
@@ -368,5 +1112,34 @@ int main(int argc, char *argv[])
         systemMemory.dumpImportantRegions(std::cerr);
     }
 
+    if (profiler)
+    {
+        if (args.profile_file.empty())
+        {
+            profiler->writeReport(std::cerr);
+        }
+        else
+        {
+            std::ofstream report(args.profile_file);
+            profiler->writeReport(report);
+            if (!report.flush())
+            {
+                std::cerr << "Error: Could not write profile report '" << args.profile_file << "'." << std::endl;
+                return 1;
+            }
+            std::cerr << "Profile of " << profiler->totalCount() << " instructions written to '" << args.profile_file << "'." << std::endl;
+        }
+        if (!args.folded_file.empty())
+        {
+            std::ofstream folded(args.folded_file);
+            profiler->writeFoldedStacks(folded);
+            if (!folded.flush())
+            {
+                std::cerr << "Error: Could not write folded stacks '" << args.folded_file << "'." << std::endl;
+                return 1;
+            }
+        }
+    }
+
     return 0;
 }
\ No newline at end of file
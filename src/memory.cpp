@@ -10,31 +10,449 @@
 #include <stdexcept>
 #include <algorithm> // For std::fill, std::max, std::min
 #include <iomanip> // For std::setw
+#include <cerrno>    // For errno
+#include <climits>   // For LONG_MAX
+#include <cstdint>   // For pagemap entries
+#include <cstdlib>   // For getenv, mkstemp
+#include <cstring>   // For strerror
+#include <fcntl.h>   // For open
+#include <sys/mman.h> // For mmap, memfd_create
+#include <unistd.h>  // For ftruncate, pread, pwrite, sysconf, unlink
 
-Memory::Memory(size_t initialSize) : size_(initialSize)
+namespace
+{
+
+// Anonymous in-memory file (memfd) holding pages of one or more Memory images. Where
+// memfd_create is not available, an unlinked temporary file takes its place.
+class MemoryFile
+{
+public:
+    explicit MemoryFile(size_t bytes) : fd_(createFile())
+    {
+        if (fd_ < 0 || ftruncate(fd_, static_cast<off_t>(bytes)) != 0)
+        {
+            int error = errno;
+            if (fd_ >= 0)
+                close(fd_);
+            throw std::runtime_error(std::string("Could not create memory pages: ") + std::strerror(error) + ".");
+        }
+    }
+    ~MemoryFile() { close(fd_); }
+
+    MemoryFile(const MemoryFile &) = delete;
+    MemoryFile &operator=(const MemoryFile &) = delete;
+
+    // Takes over fd, an open file whose pages are only ever read
+    static std::shared_ptr<const MemoryFile> adopt(int fd)
+    {
+        return std::shared_ptr<const MemoryFile>(new MemoryFile(fd, Existing()));
+    }
+
+    int fd() const { return fd_; }
+
+private:
+    int fd_;
+
+    struct Existing {};
+    MemoryFile(int fd, Existing) : fd_(fd) {}
+
+    static int createFile()
+    {
+        int fd = -1;
+#ifdef MFD_CLOEXEC
+        fd = memfd_create("gtu_memory", MFD_CLOEXEC);
+        if (fd >= 0)
+            return fd;
+#endif
+        const char *directory = std::getenv("TMPDIR");
+        std::string path = std::string(directory && *directory ? directory : "/tmp") + "/gtu_memory.XXXXXX";
+        fd = mkstemp(&path[0]);
+        if (fd >= 0)
+        {
+            unlink(path.c_str());
+            fcntl(fd, F_SETFD, FD_CLOEXEC);
+        }
+        return fd;
+    }
+};
+
+// Most mappings (runs of consecutive pages of one file, or of demand-zero pages) an image
+// may need. Every Memory mapping the image uses that many of the process's limited
+// mappings (vm.max_map_count), so an image that would need more is flattened.
+constexpr size_t MAX_IMAGE_RUNS = 64;
+
+size_t hostPageSize()
+{
+    static const size_t page_size = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    return page_size;
+}
+
+// Maps bytes of file at offset over at, privately (writes stay in this process). A null
+// file maps anonymous pages: demand-zero ones that reserve no swap and whose reading
+// allocates nothing, unless extra_flags has MAP_POPULATE (dense pages, allocated and
+// charged against the commit limit now, so a Memory too large fails to be created
+// instead of failing later on a write).
+void mapPages(char *at, size_t bytes, const MemoryFile *file, off_t offset, int extra_flags = 0)
+{
+    const int reserve = (extra_flags & MAP_POPULATE) ? 0 : MAP_NORESERVE;
+    void *mapped = file ? mmap(at, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED | extra_flags, file->fd(), offset)
+                        : mmap(at, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED | MAP_ANONYMOUS | reserve | extra_flags, -1, 0);
+    if (mapped == MAP_FAILED)
+        throw std::runtime_error(std::string("Could not map memory pages: ") + std::strerror(errno) + ".");
+}
+
+// /proc/self/pagemap entries for the pages from start, or an empty vector if they
+// cannot be read
+std::vector<uint64_t> readPagemap(const char *start, size_t count)
+{
+    static const int pagemap = open("/proc/self/pagemap", O_RDONLY | O_CLOEXEC);
+    std::vector<uint64_t> entries(count);
+    const size_t bytes = count * sizeof(uint64_t);
+    const off_t offset = static_cast<off_t>(reinterpret_cast<uintptr_t>(start) / hostPageSize() * sizeof(uint64_t));
+    if (pagemap < 0 || pread(pagemap, entries.data(), bytes, offset) != static_cast<ssize_t>(bytes))
+        entries.clear();
+    return entries;
+}
+
+bool isPresent(uint64_t entry) { return (entry >> 63) & 1; }
+bool isSwapped(uint64_t entry) { return (entry >> 62) & 1; }
+bool isFilePage(uint64_t entry) { return (entry >> 61) & 1; }
+
+// Flags the pages from start that may have been written since they were mapped: every
+// page that is not still the page of its file (or a demand-zero page never touched).
+// Pages that were only read from a demand-zero mapping are included; freeze() finds
+// them to be zero. If /proc/self/pagemap is not available every page counts as written.
+std::vector<bool> writtenPages(const char *start, size_t count)
+{
+    std::vector<uint64_t> entries = readPagemap(start, count);
+    if (entries.empty())
+        return std::vector<bool>(count, true);
+    std::vector<bool> written(count);
+    for (size_t index = 0; index < count; ++index)
+        written[index] = (isPresent(entries[index]) && !isFilePage(entries[index])) || isSwapped(entries[index]);
+    return written;
+}
+
+bool isZeroPage(const char *page)
+{
+    const long *cells = reinterpret_cast<const long *>(page);
+    const size_t count = hostPageSize() / sizeof(long);
+    for (size_t index = 0; index < count; ++index)
+    {
+        if (cells[index] != 0)
+            return false;
+    }
+    return true;
+}
+
+} // namespace
+
+// Where each page of a Memory comes from: a page of a file, or a demand-zero page (null
+// file). Immutable once built: the files are only written while freeze() creates them,
+// and every Memory maps them privately.
+struct MemoryImage
+{
+    struct Page
+    {
+        std::shared_ptr<const MemoryFile> file;
+        off_t offset;
+
+        bool operator==(const Page &other) const { return file == other.file && (!file || offset == other.offset); }
+    };
+    std::vector<Page> pages;
+
+    // True if page index can share a mapping with the page before it
+    bool continuesRun(size_t index) const
+    {
+        return index > 0 && pages[index].file == pages[index - 1].file &&
+               (!pages[index].file || pages[index].offset == pages[index - 1].offset + static_cast<off_t>(hostPageSize()));
+    }
+
+    size_t runCount() const
+    {
+        size_t runs = 0;
+        for (size_t index = 0; index < pages.size(); ++index)
+            runs += continuesRun(index) ? 0 : 1;
+        return runs;
+    }
+
+    // Maps pages [first, last) at base, one mapping per run
+    void map(char *base, size_t first, size_t last, int extra_flags = 0) const
+    {
+        const size_t page_size = hostPageSize();
+        while (first < last)
+        {
+            size_t end = first + 1;
+            while (end < last && continuesRun(end))
+                ++end;
+            mapPages(base + first * page_size, (end - first) * page_size, pages[first].file.get(), pages[first].offset, extra_flags);
+            first = end;
+        }
+    }
+
+    // Rewrites the image into file (as large as the whole Memory, every page at its own
+    // offset) so that it needs at most MAX_IMAGE_RUNS mappings. base holds the current
+    // contents. Zero pages stay demand-zero in the longest gaps between data pages; the
+    // rest point at holes of file, which read as zero.
+    void flatten(const char *base, const std::shared_ptr<const MemoryFile> &file)
+    {
+        const size_t page_size = hostPageSize();
+        for (size_t index = 0; index < pages.size(); ++index)
+        {
+            Page &page = pages[index];
+            if (page.file == file || !page.file)
+                continue;
+            const char *contents = base + index * page_size;
+            if (isZeroPage(contents))
+            {
+                page = {nullptr, 0};
+                continue;
+            }
+            const off_t offset = static_cast<off_t>(index * page_size);
+            if (pwrite(file->fd(), contents, page_size, offset) != static_cast<ssize_t>(page_size))
+                throw std::runtime_error(std::string("Could not copy memory pages: ") + std::strerror(errno) + ".");
+            page = {file, offset};
+        }
+
+        // Gaps of zero pages as (length, first page), longest first
+        std::vector<std::pair<size_t, size_t>> gaps;
+        for (size_t first = 0; first < pages.size();)
+        {
+            size_t end = first;
+            while (end < pages.size() && !pages[end].file)
+                ++end;
+            if (end > first)
+                gaps.emplace_back(end - first, first);
+            first = std::max(end, first + 1);
+        }
+        std::sort(gaps.begin(), gaps.end(), [](const std::pair<size_t, size_t> &a, const std::pair<size_t, size_t> &b)
+                  { return a.first > b.first; });
+        for (size_t gap = (MAX_IMAGE_RUNS - 1) / 2; gap < gaps.size(); ++gap)
+        {
+            for (size_t index = gaps[gap].second; index < gaps[gap].second + gaps[gap].first; ++index)
+                pages[index] = {file, static_cast<off_t>(index * page_size)};
+        }
+    }
+};
+
+Memory::Memory(size_t initialSize, MemoryBackend backend) : data_(nullptr), size_(initialSize), mapped_bytes_(0), backend_(backend)
 {
     if (initialSize == 0) {
         throw std::invalid_argument("Memory size cannot be zero.");
     }
+    if (initialSize > static_cast<size_t>(LONG_MAX) / sizeof(long)) {
+        throw std::invalid_argument("Memory size " + std::to_string(initialSize) + " is too large.");
+    }
     // REGISTERS_END_ADDR is 20, so minimum size is 21 (0-20)
     if (initialSize < REGISTERS_END_ADDR + 1) {
         std::cerr << "Warning: Memory size " << initialSize 
                   << " is less than " << (REGISTERS_END_ADDR + 1) 
                   << " (minimum for registers)." << std::endl;
     }
-    data_.resize(size_, 0L);
+
+    // Plain anonymous pages: dense ones allocated up front, sparse ones on first write.
+    // They only move into a memory file when the Memory is first copied.
+    const size_t page_size = hostPageSize();
+    mapped_bytes_ = (size_ * sizeof(long) + page_size - 1) / page_size * page_size;
+    auto image = std::make_shared<MemoryImage>();
+    image->pages.assign(mapped_bytes_ / page_size, {nullptr, 0});
+    mapImage(image, backend_ == MemoryBackend::DENSE ? MAP_POPULATE : 0);
+    baseline_ = image_;
+}
+
+Memory::Memory(int fd, uint64_t offset, size_t size) : Memory(size, MemoryBackend::SPARSE)
+{
+    // Keep the reserved address range and map the file's pages over it
+    backend_ = MemoryBackend::DENSE;
+    const int copy = fcntl(fd, F_DUPFD_CLOEXEC, 0);
+    if (copy < 0)
+        throw std::runtime_error(std::string("Could not map memory file: ") + std::strerror(errno) + ".");
+    std::shared_ptr<const MemoryFile> file = MemoryFile::adopt(copy);
+    const size_t page_size = hostPageSize();
+    auto image = std::make_shared<MemoryImage>();
+    image->pages.reserve(mapped_bytes_ / page_size);
+    for (size_t page = 0; page < mapped_bytes_; page += page_size)
+        image->pages.push_back({file, static_cast<off_t>(offset + page)});
+    mapImage(image);
+    baseline_ = image_;
+}
+
+Memory::Memory(const Memory &other)
+    : data_(nullptr), size_(other.size_), mapped_bytes_(other.mapped_bytes_), backend_(other.backend_)
+{
+    mapImage(other.freeze());
+    baseline_ = image_;
+}
+
+Memory &Memory::operator=(const Memory &other)
+{
+    if (this == &other)
+        return *this;
+    std::shared_ptr<const MemoryImage> image = other.freeze();
+    std::lock_guard<std::mutex> lock(freeze_mutex_);
+    if (size_ != other.size_)
+    {
+        munmap(data_, mapped_bytes_);
+        data_ = nullptr;
+        size_ = other.size_;
+        mapped_bytes_ = other.mapped_bytes_;
+    }
+    backend_ = other.backend_;
+    mapImage(image);
+    baseline_ = image_;
+    return *this;
+}
+
+Memory::~Memory()
+{
+    if (data_)
+        munmap(data_, mapped_bytes_);
+}
+
+void Memory::mapImage(const std::shared_ptr<const MemoryImage> &image, int extra_flags)
+{
+    if (!data_)
+    {
+        // Reserve the address range, then map the image over it
+        void *region = mmap(nullptr, mapped_bytes_, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (region == MAP_FAILED)
+            throw std::runtime_error(std::string("Could not reserve memory: ") + std::strerror(errno) + ".");
+        data_ = static_cast<long *>(region);
+    }
+    image->map(reinterpret_cast<char *>(data_), 0, image->pages.size(), extra_flags);
+    image_ = image;
+}
+
+std::shared_ptr<const MemoryImage> Memory::freeze() const
+{
+    std::lock_guard<std::mutex> lock(freeze_mutex_);
+    const size_t page_size = hostPageSize();
+    const size_t page_count = image_->pages.size();
+    char *base = reinterpret_cast<char *>(data_);
+    std::vector<bool> written = writtenPages(base, page_count);
+    if (std::find(written.begin(), written.end(), true) == written.end())
+        return image_;
+
+    // Copy the written pages to a new file, each at its own offset, and turn those that
+    // hold only zeros back into demand-zero pages. The file is only created once a page
+    // holds data.
+    std::shared_ptr<const MemoryFile> file;
+    auto image = std::make_shared<MemoryImage>(*image_);
+    for (size_t index = 0; index < page_count; ++index)
+    {
+        if (!written[index])
+            continue;
+        const char *contents = base + index * page_size;
+        if (isZeroPage(contents))
+        {
+            image->pages[index] = {nullptr, 0};
+            continue;
+        }
+        if (!file)
+            file = std::make_shared<const MemoryFile>(mapped_bytes_);
+        const off_t offset = static_cast<off_t>(index * page_size);
+        if (pwrite(file->fd(), contents, page_size, offset) != static_cast<ssize_t>(page_size))
+            throw std::runtime_error(std::string("Could not copy memory pages: ") + std::strerror(errno) + ".");
+        image->pages[index] = {file, offset};
+    }
+    if (image->runCount() > MAX_IMAGE_RUNS)
+    {
+        if (!file)
+            file = std::make_shared<const MemoryFile>(mapped_bytes_);
+        image->flatten(base, file);
+    }
+
+    // Map the changed pages back from the new image: the contents stay the same, and the
+    // pages are now shared with every copy made from it.
+    for (size_t first = 0; first < page_count;)
+    {
+        if (!written[first] && image->pages[first] == image_->pages[first])
+        {
+            ++first;
+            continue;
+        }
+        size_t last = first + 1;
+        while (last < page_count && (written[last] || !(image->pages[last] == image_->pages[last])))
+            ++last;
+        image->map(base, first, last);
+        first = last;
+    }
+    image_ = image;
+    return image_;
+}
+
+void Memory::markClean()
+{
+    baseline_ = freeze();
+}
+
+std::vector<long> Memory::changedCells() const
+{
+    std::lock_guard<std::mutex> lock(freeze_mutex_);
+    const size_t page_size = hostPageSize();
+    const size_t cells_per_page = page_size / sizeof(long);
+    const size_t page_count = image_->pages.size();
+    const std::vector<bool> written = writtenPages(reinterpret_cast<const char *>(data_), page_count);
+
+    std::vector<long> changed;
+    std::vector<long> old_cells(cells_per_page);
+    for (size_t page = 0; page < page_count; ++page)
+    {
+        // Unwritten pages still mapped from the baseline's page cannot have changed
+        const MemoryImage::Page &old_page = baseline_->pages[page];
+        if (!written[page] && image_->pages[page] == old_page)
+            continue;
+
+        if (!old_page.file)
+            std::fill(old_cells.begin(), old_cells.end(), 0L);
+        else if (pread(old_page.file->fd(), old_cells.data(), page_size, old_page.offset) != static_cast<ssize_t>(page_size))
+            throw std::runtime_error(std::string("Could not read memory pages: ") + std::strerror(errno) + ".");
+
+        const size_t first = page * cells_per_page;
+        const size_t last = std::min(size_, first + cells_per_page);
+        for (size_t address = first; address < last; ++address)
+        {
+            if (data_[address] != old_cells[address - first])
+                changed.push_back(static_cast<long>(address));
+        }
+    }
+    return changed;
+}
+
+void Memory::dumpChanges(std::ostream &out)
+{
+    for (long address : changedCells())
+        out << address << ":" << data_[static_cast<size_t>(address)] << '\n';
+    markClean();
+}
+
+std::vector<bool> Memory::untouchedPages(size_t first, size_t count) const
+{
+    std::lock_guard<std::mutex> lock(freeze_mutex_);
+    std::vector<bool> untouched(count, false);
+    std::vector<uint64_t> entries = readPagemap(reinterpret_cast<const char *>(data_) + first * hostPageSize(), count);
+    if (entries.empty())
+        return untouched;
+    for (size_t index = 0; index < count; ++index)
+        untouched[index] = !image_->pages[first + index].file && !isPresent(entries[index]) && !isSwapped(entries[index]);
+    return untouched;
 }
 
 void Memory::checkAddress(long address) const
 {
-    if (address < 0 || static_cast<size_t>(address) >= size_) {
-        std::ostringstream errMsg;
-        errMsg << "Memory access violation: Address " << address
-               << " is out of bounds (0-" << size_ - 1 << ").";
-        throw std::out_of_range(errMsg.str());
+    if (!isValidAddress(address)) {
+        throw std::out_of_range(outOfBoundsMessage(address));
     }
 }
 
+std::string Memory::outOfBoundsMessage(long address) const
+{
+    std::ostringstream errMsg;
+    errMsg << "Memory access violation: Address " << address
+           << " is out of bounds (0-" << size_ - 1 << ").";
+    return errMsg.str();
+}
+
 long Memory::read(long address) const
 {
     checkAddress(address);
@@ -49,7 +467,7 @@ void Memory::write(long address, long value)
 
 void Memory::clear()
 {
-    std::fill(data_.begin(), data_.end(), 0L);
+    std::fill(data_, data_ + size_, 0L);
 }
 
 static std::string trimLine(std::string line)
@@ -146,7 +564,7 @@ bool Memory::loadDataSection(std::ifstream &imageFileStream, int& linesReadCount
     return false;
 }
 
-void Memory::dumpMemoryRange(std::ostream &out, long startAddr, long endAddr) const
+void Memory::dumpMemoryRange(std::ostream &out, long startAddr, long endAddr, bool skipZeroPages) const
 {
     long effectiveStartAddr = std::max(0L, startAddr);
     long effectiveEndAddr = std::min(static_cast<long>(size_ - 1), endAddr);
@@ -155,8 +573,30 @@ void Memory::dumpMemoryRange(std::ostream &out, long startAddr, long endAddr) co
         return;
     }
 
-    for (long addr = effectiveStartAddr; addr <= effectiveEndAddr; ++addr) {
-        out << addr << ":" << data_[static_cast<size_t>(addr)] << std::endl;
+    if (!skipZeroPages) {
+        for (long addr = effectiveStartAddr; addr <= effectiveEndAddr; ++addr) {
+            out << addr << ":" << data_[static_cast<size_t>(addr)] << std::endl;
+        }
+        return;
+    }
+
+    // Page by page: untouched pages are known to be zero, the others are scanned first
+    const long cellsPerPage = static_cast<long>(hostPageSize() / sizeof(long));
+    const size_t firstPage = static_cast<size_t>(effectiveStartAddr / cellsPerPage);
+    const size_t lastPage = static_cast<size_t>(effectiveEndAddr / cellsPerPage);
+    std::vector<bool> untouched = untouchedPages(firstPage, lastPage - firstPage + 1);
+    for (size_t page = firstPage; page <= lastPage; ++page) {
+        if (untouched[page - firstPage]) {
+            continue;
+        }
+        long pageStart = std::max(effectiveStartAddr, static_cast<long>(page) * cellsPerPage);
+        long pageEnd = std::min(effectiveEndAddr, static_cast<long>(page + 1) * cellsPerPage - 1);
+        if (std::all_of(data_ + pageStart, data_ + pageEnd + 1, [](long value) { return value == 0; })) {
+            continue;
+        }
+        for (long addr = pageStart; addr <= pageEnd; ++addr) {
+            out << addr << ":" << data_[static_cast<size_t>(addr)] << std::endl;
+        }
     }
 }
 
@@ -3,15 +3,48 @@
 #define MEMORY_H
 
 #include <stdexcept> // For std::out_of_range, std::invalid_argument - needed for exceptions
+#include <cstdint>   // For file offsets
 #include <iosfwd>    // Forward declarations for stream types
-#include <vector>    // For std::vector<long> member - required for member variables
+#include <memory>    // For std::shared_ptr<const MemoryImage>
+#include <mutex>     // For freezing a Memory that other threads copy
+#include <string>    // For std::string diagnostics
+#include <vector>    // For page lists
 
+struct MemoryImage;
+
+// How the pages of a new Memory are provided
+enum class MemoryBackend
+{
+    DENSE, // Every page allocated (zero-filled) and charged up front, so no page faults
+           // while running
+    SPARSE // Demand-zero pages: a page is allocated on its first write, and reading an
+           // untouched page returns zero without allocating. For very large address spaces.
+};
+
+// The cells live in a private mapping of anonymous pages until the Memory is first
+// copied. Copying moves the pages the source changed since it was last copied into a
+// memory file (memfd), which source and copy then map copy-on-write: the kernel gives
+// each its own page on first write, and all-zero pages become demand-zero pages again.
+// Memory is therefore cheap to fork at any size.
 class Memory
 {
 public:
     // Constructor: Initializes memory of a given size with all zeros.
     // Minimum size of 11000 to accommodate OS and 10 threads' basic data segments.
-    explicit Memory(size_t initialSize = 11000);
+    explicit Memory(size_t initialSize = 11000, MemoryBackend backend = MemoryBackend::DENSE);
+
+    // Maps size cells of the open file fd from byte offset, a multiple of the host page
+    // size, copy-on-write: pages are read from the file when first used, and writes stay
+    // in this Memory. The file must hold every page the cells touch and must not change
+    // while the Memory or a copy of it exists. Keeps a duplicate of fd. Reports the DENSE
+    // backend. Throws std::runtime_error if the file cannot be mapped.
+    Memory(int fd, uint64_t offset, size_t size);
+
+    // Copy-on-write copies. Safe while other threads copy or read the same source.
+    // Assigning a Memory of the same size keeps data() where it is.
+    Memory(const Memory &other);
+    Memory &operator=(const Memory &other);
+    ~Memory();
 
     // Reads a long value from the specified memory address.
     // Throws std::out_of_range if address is invalid.
@@ -21,6 +54,20 @@ public:
     // Throws std::out_of_range if address is invalid.
     void write(long address, long value);
 
+    // Non-throwing bounds test, for callers that report faults themselves.
+    bool isValidAddress(long address) const { return address >= 0 && static_cast<size_t>(address) < size_; }
+
+    // Unchecked accessors. The caller must have validated the address with isValidAddress().
+    long readUnchecked(long address) const { return data_[static_cast<size_t>(address)]; }
+    void writeUnchecked(long address, long value) { data_[static_cast<size_t>(address)] = value; }
+
+    // First cell, for generated code that addresses memory directly. Stable for the
+    // lifetime of the Memory, and across assignments that keep its size.
+    long *data() { return data_; }
+
+    // Describes why an address is invalid (the text std::out_of_range carries from read/write).
+    std::string outOfBoundsMessage(long address) const;
+
     // Loads the "Data Section" from a program file into memory.
     // The file is expected to contain lines defining initial memory values.
     // It parses lines starting from "Begin Data Section" until "End Data Section".
@@ -32,7 +79,22 @@ public:
     // Dumps memory contents for a specified range to the given output stream.
     // Prints each address and its content in the format "address:value".
     // Ensures startAddr and endAddr are within valid bounds.
-    void dumpMemoryRange(std::ostream &out, long startAddr, long endAddr) const;
+    // With skipZeroPages, host pages whose cells in the range are all zero are left out;
+    // pages a sparse Memory never touched are skipped without reading them.
+    void dumpMemoryRange(std::ostream &out, long startAddr, long endAddr, bool skipZeroPages = false) const;
+
+    // Write tracking against a baseline: the contents when the Memory was created or
+    // copied, or at the last markClean(). Only host pages written since the baseline are
+    // compared, so the cost follows the number of pages written, not the memory size.
+    // Writes through data() are tracked too.
+    void markClean();
+
+    // Addresses whose value differs from the baseline, in ascending order
+    std::vector<long> changedCells() const;
+
+    // Prints "address:value" for every changed cell, then makes the current contents the
+    // new baseline. Lines are not flushed one by one.
+    void dumpChanges(std::ostream &out);
 
     // Dumps memory contents in a compact table format (10 columns per row).
     // More organized and space-efficient than dumpMemoryRange for viewing large ranges.
@@ -45,15 +107,37 @@ public:
     // Returns the total size of the memory (number of long locations).
     size_t getSize() const { return size_; }
 
+    // Backend the Memory was created with (copies keep the source's)
+    MemoryBackend getBackend() const { return backend_; }
+
     // Clears all memory to zero.
     void clear();
 
 private:
-    std::vector<long> data_;
+    long *data_;  // Start of the mapping
     size_t size_; // Stores the actual configured size of the memory
+    size_t mapped_bytes_; // size_ cells rounded up to whole pages
+    MemoryBackend backend_;
+
+    // Pages the mapping was last built from. Pages written since then are private
+    // to this Memory until freeze() moves them into a new image.
+    mutable std::shared_ptr<const MemoryImage> image_;
+    std::shared_ptr<const MemoryImage> baseline_; // Contents changedCells() compares against
+    mutable std::mutex freeze_mutex_;
 
     // Helper to check address validity and throw std::out_of_range if invalid.
     void checkAddress(long address) const;
+
+    // Returns an image of the current contents, after moving the pages written since the
+    // last freeze into it (the mapping then uses them too, so nothing changes for readers).
+    std::shared_ptr<const MemoryImage> freeze() const;
+
+    // Maps image over [data_, data_ + mapped_bytes_), or at a new address if data_ is null.
+    // extra_flags are passed to mmap (MAP_POPULATE for a dense Memory).
+    void mapImage(const std::shared_ptr<const MemoryImage> &image, int extra_flags = 0);
+
+    // Flags the host pages from first that are demand-zero pages never touched
+    std::vector<bool> untouchedPages(size_t first, size_t count) const;
 };
 
 #endif // MEMORY_H
\ No newline at end of file
@@ -0,0 +1,67 @@
+// src/opcode_costs.cpp
+#include "opcode_costs.h"
+#include <algorithm> // For std::sort and std::min
+#include <iomanip>   // For report columns
+#include <limits>    // For the overhead minimum
+#include <ostream>   // For the report
+#include <vector>    // For the sorted rows
+
+OpcodeCosts::OpcodeCosts()
+    : start_ticks_(now()), start_time_(std::chrono::steady_clock::now()),
+      timer_overhead_(std::numeric_limits<uint64_t>::max())
+{
+    for (int i = 0; i < 1000; ++i)
+    {
+        uint64_t first = now();
+        timer_overhead_ = std::min(timer_overhead_, now() - first);
+    }
+}
+
+void OpcodeCosts::write(std::ostream &out) const
+{
+    // Nanoseconds per tick, from the ticks and wall time elapsed since construction
+    std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start_time_;
+    uint64_t elapsed_ticks = now() - start_ticks_;
+    double ns_per_tick = elapsed_ticks > 0 ? elapsed.count() / static_cast<double>(elapsed_ticks) : 0.0;
+
+    auto ticksOf = [&](size_t op)
+    {
+        const Entry &e = entries_[op];
+        return e.ticks[NORMAL] + e.ticks[FAULT] + e.ticks[UNWIND];
+    };
+    std::vector<size_t> order;
+    uint64_t total_ticks = 0;
+    for (size_t op = 0; op < OPCODE_COUNT; ++op)
+    {
+        const Entry &e = entries_[op];
+        total_ticks += ticksOf(op);
+        if (e.count[NORMAL] + e.count[FAULT] + e.count[UNWIND] > 0)
+            order.push_back(op);
+    }
+    std::sort(order.begin(), order.end(), [&](size_t a, size_t b)
+              { return ticksOf(a) != ticksOf(b) ? ticksOf(a) > ticksOf(b) : a < b; });
+
+    const std::ios::fmtflags flags = out.flags();
+    const std::streamsize precision = out.precision();
+    out << std::fixed << std::setprecision(3);
+    out << "Opcode costs (interpreter, " << ns_per_tick << " ns/tick, timer overhead "
+        << timer_overhead_ << " ticks per sample, not subtracted):\n";
+    out << std::setprecision(1);
+    out << std::left << std::setw(20) << "Opcode" << std::right << std::setw(12) << "Count" << std::setw(14) << "Ticks"
+        << std::setw(9) << "%" << std::setw(10) << "Ticks/op" << std::setw(9) << "ns/op"
+        << std::setw(9) << "Faults" << std::setw(12) << "Fault t/op" << std::setw(9) << "Unwinds" << "\n";
+    for (size_t op : order)
+    {
+        const Entry &e = entries_[op];
+        double per_op = e.count[NORMAL] > 0 ? static_cast<double>(e.ticks[NORMAL]) / static_cast<double>(e.count[NORMAL]) : 0.0;
+        double per_fault = e.count[FAULT] > 0 ? static_cast<double>(e.ticks[FAULT]) / static_cast<double>(e.count[FAULT]) : 0.0;
+        double share = total_ticks > 0 ? 100.0 * static_cast<double>(ticksOf(op)) / static_cast<double>(total_ticks) : 0.0;
+        out << std::left << std::setw(20) << opCodeToString(static_cast<OpCode>(op)) << std::right
+            << std::setw(12) << e.count[NORMAL] << std::setw(14) << ticksOf(op) << std::setw(8) << share << "%"
+            << std::setw(10) << per_op << std::setw(9) << per_op * ns_per_tick
+            << std::setw(9) << e.count[FAULT] << std::setw(12) << per_fault << std::setw(9) << e.count[UNWIND] << "\n";
+    }
+
+    out.flags(flags);
+    out.precision(precision);
+}
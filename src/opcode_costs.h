@@ -0,0 +1,102 @@
+// src/opcode_costs.h
+#ifndef OPCODE_COSTS_H
+#define OPCODE_COSTS_H
+
+#include "instruction.h" // For OpCode
+#include <chrono>        // For calibrating ticks against wall time
+#include <cstddef>       // For size_t
+#include <cstdint>       // For counts and ticks
+#include <exception>     // For std::uncaught_exceptions
+#include <iosfwd>        // For the report stream
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>   // For __rdtsc
+#else
+#include <time.h>        // For clock_gettime
+#endif
+
+// Host cost of the reference interpreter per opcode: how often CPU::stepIn() executed
+// each opcode and how many host ticks it took, with instructions that faulted and
+// instructions left by a C++ exception kept apart from the normal path. Only
+// collected in builds with USE_OPCODE_COSTS (make OPCODE_COSTS=1); without it the CPU
+// has no table and the interpreter no timing code.
+class OpcodeCosts
+{
+public:
+    enum Path
+    {
+        NORMAL,
+        FAULT,  // Raised a CPU fault; includes its delivery (report, trap to the OS)
+        UNWIND, // Left stepIn() through an exception
+        PATH_COUNT
+    };
+
+    struct Entry
+    {
+        uint64_t count[PATH_COUNT] = {};
+        uint64_t ticks[PATH_COUNT] = {};
+    };
+
+    OpcodeCosts();
+
+    // Time stamp counter on x86, CLOCK_MONOTONIC nanoseconds elsewhere
+    static uint64_t now()
+    {
+#if defined(__x86_64__) || defined(__i386__)
+        return __rdtsc();
+#else
+        timespec time;
+        clock_gettime(CLOCK_MONOTONIC, &time);
+        return static_cast<uint64_t>(time.tv_sec) * 1000000000u + static_cast<uint64_t>(time.tv_nsec);
+#endif
+    }
+
+    void add(OpCode op, Path path, uint64_t ticks)
+    {
+        Entry &entry = entries_[static_cast<size_t>(op)];
+        ++entry.count[path];
+        entry.ticks[path] += ticks;
+    }
+
+    const Entry &entry(OpCode op) const { return entries_[static_cast<size_t>(op)]; }
+
+    // Table sorted by total ticks, with ticks converted to nanoseconds against the wall
+    // time since construction, and the timer's own cost per sample (not subtracted)
+    void write(std::ostream &out) const;
+
+    // Times one instruction from construction to destruction and adds it to costs.
+    // Call markFaulted() before the end if the instruction raised a CPU fault.
+    class Scope
+    {
+    public:
+        Scope(OpcodeCosts &costs, OpCode op)
+            : costs_(costs), op_(op), exceptions_(std::uncaught_exceptions()), faulted_(false), start_(now()) {}
+        ~Scope()
+        {
+            uint64_t ticks = now() - start_;
+            Path path = std::uncaught_exceptions() > exceptions_ ? UNWIND : faulted_ ? FAULT : NORMAL;
+            costs_.add(op_, path, ticks);
+        }
+
+        Scope(const Scope &) = delete;
+        Scope &operator=(const Scope &) = delete;
+
+        void markFaulted() { faulted_ = true; }
+
+    private:
+        OpcodeCosts &costs_;
+        OpCode op_;
+        int exceptions_;
+        bool faulted_;
+        uint64_t start_; // Read last, so setting up the scope is not timed
+    };
+
+private:
+    static constexpr size_t OPCODE_COUNT = static_cast<size_t>(OpCode::UNKNOWN) + 1;
+
+    Entry entries_[OPCODE_COUNT];
+    uint64_t start_ticks_;
+    std::chrono::steady_clock::time_point start_time_;
+    uint64_t timer_overhead_; // Least ticks between two back-to-back now() calls
+};
+
+#endif // OPCODE_COSTS_H
@@ -136,6 +136,7 @@ std::vector<Instruction> parseInstructionSection(std::ifstream &fileStream, cons
 
         Instruction instr;
         instr.original_line = line;
+        instr.source_line = current_line_num;
         long arg1_val = 0, arg2_val = 0;
         std::string operands_part_str;
         std::getline(iss, operands_part_str);
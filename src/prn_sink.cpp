@@ -0,0 +1,136 @@
+// src/prn_sink.cpp
+#include "prn_sink.h"
+#include <algorithm>    // For std::min
+#include <cerrno>       // For errno
+#include <charconv>     // For std::to_chars
+#include <climits>      // For IOV_MAX
+#include <cstring>      // For strerror
+#include <iostream>     // For std::cout
+#include <stdexcept>    // For runtime_error
+#include <fcntl.h>      // For open
+#include <sys/uio.h>    // For writev
+#include <unistd.h>     // For close
+
+std::function<void(long)> prnCallback(PrnSink &sink)
+{
+    return [&sink](long value)
+    { sink.write(value); };
+}
+
+// --- FdPrnSink ---
+
+FdPrnSink::FdPrnSink(int fd, size_t buffer_bytes, unsigned long flush_every)
+    : fd_(fd), owns_fd_(false), failed_(false), current_(0), flush_every_(flush_every), pending_values_(0),
+      flush_buffer_(*this), flush_stream_(&flush_buffer_), ordered_diagnostics_(nullptr), previous_tie_(nullptr)
+{
+    init(buffer_bytes);
+}
+
+FdPrnSink::FdPrnSink(const std::string &filename, size_t buffer_bytes, unsigned long flush_every)
+    : fd_(-1), owns_fd_(true), failed_(false), current_(0), flush_every_(flush_every), pending_values_(0),
+      flush_buffer_(*this), flush_stream_(&flush_buffer_), ordered_diagnostics_(nullptr), previous_tie_(nullptr)
+{
+    fd_ = open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd_ < 0)
+        throw std::runtime_error("Could not create PRN output file '" + filename + "': " + std::strerror(errno) + ".");
+    init(buffer_bytes);
+}
+
+void FdPrnSink::init(size_t buffer_bytes)
+{
+    // At least one block, and no more than one writev() can take
+    size_t count = std::min<size_t>(std::max<size_t>(1, buffer_bytes / BLOCK_BYTES), IOV_MAX);
+    blocks_.resize(count);
+    for (auto &block : blocks_)
+        block.reserve(BLOCK_BYTES);
+}
+
+FdPrnSink::~FdPrnSink()
+{
+    if (ordered_diagnostics_)
+        ordered_diagnostics_->tie(previous_tie_);
+    flush();
+    if (owns_fd_)
+        close(fd_);
+}
+
+void FdPrnSink::orderBefore(std::ostream &diagnostics)
+{
+    if (ordered_diagnostics_)
+        ordered_diagnostics_->tie(previous_tie_);
+    ordered_diagnostics_ = &diagnostics;
+    previous_tie_ = diagnostics.tie(&flush_stream_);
+}
+
+void FdPrnSink::write(long value)
+{
+    std::vector<char> *block = &blocks_[current_];
+    if (block->size() + MAX_LINE_BYTES > BLOCK_BYTES)
+    {
+        if (current_ + 1 == blocks_.size())
+            flush();
+        else
+            ++current_;
+        block = &blocks_[current_];
+    }
+
+    // Capacity was reserved, so growing the block never reallocates
+    size_t used = block->size();
+    block->resize(used + MAX_LINE_BYTES);
+    char *end = std::to_chars(block->data() + used, block->data() + block->size(), value).ptr;
+    *end++ = '\n';
+    block->resize(static_cast<size_t>(end - block->data()));
+
+    if (flush_every_ != 0 && ++pending_values_ >= flush_every_)
+        flush();
+}
+
+void FdPrnSink::flush()
+{
+    pending_values_ = 0;
+    if (blocks_[0].empty())
+        return;
+
+    std::vector<iovec> pieces;
+    pieces.reserve(current_ + 1);
+    for (size_t i = 0; i <= current_; ++i)
+        pieces.push_back({blocks_[i].data(), blocks_[i].size()});
+    current_ = 0;
+
+    if (!failed_ && fd_ == STDOUT_FILENO)
+        std::cout.flush();
+
+    // Retries short writes, resuming inside the piece where the last one stopped
+    size_t first = 0;
+    while (!failed_ && first < pieces.size())
+    {
+        ssize_t written = writev(fd_, pieces.data() + first, static_cast<int>(pieces.size() - first));
+        if (written < 0 && errno == EINTR)
+            continue;
+        if (written <= 0)
+        {
+            failed_ = true;
+            break;
+        }
+        size_t left = static_cast<size_t>(written);
+        while (first < pieces.size() && left >= pieces[first].iov_len)
+            left -= pieces[first++].iov_len;
+        if (first < pieces.size())
+        {
+            pieces[first].iov_base = static_cast<char *>(pieces[first].iov_base) + left;
+            pieces[first].iov_len -= left;
+        }
+    }
+
+    for (auto &block : blocks_)
+        block.clear();
+}
+
+// The tie replaced by orderBefore() (normally std::cout) is still flushed afterwards
+int FdPrnSink::FlushBuffer::sync()
+{
+    sink_.flush();
+    if (sink_.previous_tie_)
+        sink_.previous_tie_->flush();
+    return 0;
+}
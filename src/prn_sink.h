@@ -0,0 +1,96 @@
+// src/prn_sink.h
+#ifndef PRN_SINK_H
+#define PRN_SINK_H
+
+#include <functional> // For CPU PRN callbacks
+#include <ostream>    // For the ordering stream
+#include <streambuf>  // For the ordering stream's buffer
+#include <string>     // For file names
+#include <vector>     // For buffers and recorded values
+
+// Destination of SYSCALL PRN values, one per line
+class PrnSink
+{
+public:
+    virtual ~PrnSink() = default;
+    virtual void write(long value) = 0;
+    virtual void flush() {}
+};
+
+// A CPU PRN callback writing to sink, which must outlive the CPU
+std::function<void(long)> prnCallback(PrnSink &sink);
+
+// Keeps the values in memory, for batch runs and differential checks
+class MemoryPrnSink : public PrnSink
+{
+public:
+    void write(long value) override { values_.push_back(value); }
+
+    const std::vector<long> &values() const { return values_; }
+    std::vector<long> take() { return std::move(values_); }
+
+private:
+    std::vector<long> values_;
+};
+
+// Formats values into blocks of a large in-memory buffer and writes all blocks with one
+// writev() when the buffer is full, every flush_every values (0: never), on flush() and
+// on destruction. The first write error is remembered and later output is dropped.
+class FdPrnSink : public PrnSink
+{
+public:
+    static constexpr size_t DEFAULT_BUFFER_BYTES = 1u << 20;
+
+    // Writes to fd (not closed), e.g. STDOUT_FILENO. std::cout is flushed before each
+    // writev() so that text printed through it earlier stays in order.
+    explicit FdPrnSink(int fd, size_t buffer_bytes = DEFAULT_BUFFER_BYTES, unsigned long flush_every = 0);
+    // Creates filename. Throws std::runtime_error if it cannot be created.
+    explicit FdPrnSink(const std::string &filename, size_t buffer_bytes = DEFAULT_BUFFER_BYTES, unsigned long flush_every = 0);
+    ~FdPrnSink() override;
+
+    FdPrnSink(const FdPrnSink &) = delete;
+    FdPrnSink &operator=(const FdPrnSink &) = delete;
+
+    void write(long value) override;
+    void flush() override;
+
+    // Flushes this sink whenever diagnostics is written to (through diagnostics.tie()),
+    // so PRN output printed before a diagnostic also appears before it. Undone on
+    // destruction.
+    void orderBefore(std::ostream &diagnostics);
+
+    bool failed() const { return failed_; }
+
+private:
+    static constexpr size_t BLOCK_BYTES = 1u << 16;
+    static constexpr size_t MAX_LINE_BYTES = 24; // "-9223372036854775808\n"
+
+    // Flushes the sink on std::ostream::flush()
+    class FlushBuffer : public std::streambuf
+    {
+    public:
+        explicit FlushBuffer(FdPrnSink &sink) : sink_(sink) {}
+
+    protected:
+        int sync() override;
+
+    private:
+        FdPrnSink &sink_;
+    };
+
+    int fd_;
+    bool owns_fd_;
+    bool failed_;
+    std::vector<std::vector<char>> blocks_; // Filled in order, each up to BLOCK_BYTES
+    size_t current_;                        // Block being filled
+    unsigned long flush_every_;
+    unsigned long pending_values_; // Written since the last flush
+    FlushBuffer flush_buffer_;
+    std::ostream flush_stream_;
+    std::ostream *ordered_diagnostics_;
+    std::ostream *previous_tie_;
+
+    void init(size_t buffer_bytes);
+};
+
+#endif // PRN_SINK_H
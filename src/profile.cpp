@@ -0,0 +1,293 @@
+// src/profile.cpp
+#include "profile.h"
+#include "common.h"   // For the memory-mapped registers
+#include "cpu.h"      // For the profiled CPU
+#include "memory.h"   // For SP and the saved trap PC
+#include <algorithm>  // For std::sort
+#include <iomanip>    // For report columns
+#include <numeric>    // For std::iota
+#include <ostream>    // For reports
+
+namespace
+{
+
+const std::string SYMBOL_PREFIX = "SYMBOL_"; // Added by gtu_assembler to plain labels
+constexpr int KERNEL_ROOT = 0;                // Label and node index of the kernel root
+constexpr int USER_ROOT = 1;                  // Label and node index of the user root
+constexpr int NO_LABEL = 2;                   // Label of PCs before the first label
+
+double percent(uint64_t count, uint64_t total)
+{
+    return total == 0 ? 0.0 : 100.0 * static_cast<double>(count) / static_cast<double>(total);
+}
+
+std::string trimmed(const std::string &text)
+{
+    size_t first = text.find_first_not_of(" \t");
+    if (first == std::string::npos)
+        return "";
+    return text.substr(first, text.find_last_not_of(" \t\r") - first + 1);
+}
+
+} // namespace
+
+GuestProfiler::GuestProfiler(const DecodedProgram &code, const std::vector<ProgramSymbol> &symbols)
+    : code_(code), labels_{"[kernel]", "[user]", "<no label>"}, label_pcs_{-1, -1, -1},
+      pc_labels_(code.size(), NO_LABEL), pc_counts_(code.size(), 0), mode_counts_{0, 0},
+      pc_(0), user_mode_(false), opcode_(OpCode::UNKNOWN), arg1_(0)
+{
+    // The first label at each PC names it, then covers the PCs up to the next label
+    std::vector<const ProgramSymbol *> code_symbols;
+    for (const ProgramSymbol &symbol : symbols)
+    {
+        if (symbol.is_code && symbol.value >= 0 && static_cast<size_t>(symbol.value) < code.size())
+            code_symbols.push_back(&symbol);
+    }
+    std::stable_sort(code_symbols.begin(), code_symbols.end(),
+                     [](const ProgramSymbol *a, const ProgramSymbol *b)
+                     { return a->value < b->value; });
+    for (size_t i = 0; i < code_symbols.size(); ++i)
+    {
+        const ProgramSymbol &symbol = *code_symbols[i];
+        if (i > 0 && code_symbols[i - 1]->value == symbol.value)
+            continue;
+        std::string name = symbol.name;
+        if (name.compare(0, SYMBOL_PREFIX.size(), SYMBOL_PREFIX) == 0)
+            name.erase(0, SYMBOL_PREFIX.size());
+        int label = labelIndex(name);
+        label_pcs_[static_cast<size_t>(label)] = symbol.value;
+        std::fill(pc_labels_.begin() + symbol.value, pc_labels_.end(), label);
+    }
+
+    nodes_.push_back({-1, KERNEL_ROOT, 0});
+    nodes_.push_back({-1, USER_ROOT, 0});
+    resetStack(false);
+}
+
+int GuestProfiler::labelAt(long pc) const
+{
+    return static_cast<unsigned long>(pc) < pc_labels_.size() ? pc_labels_[static_cast<size_t>(pc)] : NO_LABEL;
+}
+
+int GuestProfiler::labelIndex(const std::string &name)
+{
+    for (size_t i = 0; i < labels_.size(); ++i)
+    {
+        if (labels_[i] == name)
+            return static_cast<int>(i);
+    }
+    labels_.push_back(name);
+    label_pcs_.push_back(-1);
+    return static_cast<int>(labels_.size() - 1);
+}
+
+int GuestProfiler::child(int parent, int label)
+{
+    uint64_t key = (static_cast<uint64_t>(parent) << 32) | static_cast<uint32_t>(label);
+    auto it = children_.find(key);
+    if (it != children_.end())
+        return it->second;
+    nodes_.push_back({parent, label, 0});
+    int node = static_cast<int>(nodes_.size() - 1);
+    children_.emplace(key, node);
+    return node;
+}
+
+// Just the mode root and a root label frame, which afterStep() keeps pointing at the
+// label of the PC being executed
+void GuestProfiler::resetStack(bool user_mode)
+{
+    stack_.clear();
+    int root = user_mode ? USER_ROOT : KERNEL_ROOT;
+    stack_.push_back({root, -1});
+    stack_.push_back({child(root, NO_LABEL), -1});
+}
+
+void GuestProfiler::beforeStep(const CPU &cpu)
+{
+    pc_ = cpu.getCurrentProgramCounter();
+    user_mode_ = cpu.isInUserMode();
+    const DecodedInstruction &instr = code_.fetch(pc_);
+    opcode_ = instr.opcode;
+    arg1_ = instr.arg1;
+}
+
+void GuestProfiler::afterStep(const CPU &cpu, const Memory &memory)
+{
+    if (static_cast<unsigned long>(pc_) < pc_counts_.size())
+        ++pc_counts_[static_cast<size_t>(pc_)];
+    ++mode_counts_[user_mode_ ? 1 : 0];
+    if (stack_.size() == 2)
+        stack_[1].node = child(stack_[0].node, labelAt(pc_));
+    ++nodes_[static_cast<size_t>(stack_.back().node)].self_count;
+
+    const long next_pc = cpu.getCurrentProgramCounter();
+    const bool user_mode = cpu.isInUserMode();
+    if (user_mode != user_mode_)
+    {
+        const long sp = memory.readUnchecked(SP_ADDR);
+        if (user_mode)
+        {
+            // USER: resume the thread's stack if it is going back to where it trapped
+            auto parked = parked_user_stacks_.find(sp);
+            if (parked != parked_user_stacks_.end() && parked->second.resume_pc == next_pc)
+                stack_ = std::move(parked->second.frames);
+            else
+                resetStack(true);
+            if (parked != parked_user_stacks_.end())
+                parked_user_stacks_.erase(parked);
+        }
+        else
+        {
+            // Syscall or fault: the trap leaves SP alone and saves the resume PC
+            parked_user_stacks_[sp] = {memory.readUnchecked(SAVED_TRAP_PC_ADDR), std::move(stack_)};
+            resetStack(false);
+        }
+        return;
+    }
+
+    if (opcode_ == OpCode::CALL && next_pc == arg1_ && !cpu.isHalted())
+    {
+        int label = labelAt(next_pc);
+        stack_.push_back({child(stack_.back().node, label), pc_ + 1});
+        if (calls_.size() < labels_.size())
+            calls_.resize(labels_.size(), 0);
+        ++calls_[static_cast<size_t>(label)];
+    }
+    else if (opcode_ == OpCode::RET && !cpu.isHalted())
+    {
+        // Unwind to the frame returned from, or to the root label if it was never seen
+        size_t depth = stack_.size();
+        while (depth > 2 && stack_[depth - 1].return_pc != next_pc)
+            --depth;
+        stack_.resize(depth > 2 ? depth - 1 : 2);
+    }
+}
+
+std::string GuestProfiler::labelName(int label) const
+{
+    return labels_[static_cast<size_t>(label)];
+}
+
+// "LABEL+offset" for pc
+std::string GuestProfiler::location(long pc) const
+{
+    int label = labelAt(pc);
+    long start = label_pcs_[static_cast<size_t>(label)];
+    if (start < 0)
+        return labelName(label);
+    return pc == start ? labelName(label) : labelName(label) + "+" + std::to_string(pc - start);
+}
+
+void GuestProfiler::writeReport(std::ostream &out, size_t hot_pcs) const
+{
+    const uint64_t total = totalCount();
+    const std::ios::fmtflags flags = out.flags();
+    out << std::fixed << std::setprecision(2);
+
+    out << "=== Guest profile ===\n";
+    out << "Instructions: " << total << " (kernel " << mode_counts_[0] << ", "
+        << percent(mode_counts_[0], total) << "%; user " << mode_counts_[1] << ", "
+        << percent(mode_counts_[1], total) << "%)\n";
+
+    // Inclusive counts: every label on a node's path gets its self count, once per path
+    std::vector<uint64_t> inclusive(labels_.size(), 0);
+    std::vector<uint64_t> self(labels_.size(), 0);
+    std::vector<int> path;
+    for (const CallNode &node : nodes_)
+    {
+        if (node.self_count == 0)
+            continue;
+        self[static_cast<size_t>(node.label)] += node.self_count;
+        path.clear();
+        for (const CallNode *n = &node; n->parent >= 0; n = &nodes_[static_cast<size_t>(n->parent)])
+        {
+            if (std::find(path.begin(), path.end(), n->label) == path.end())
+                path.push_back(n->label);
+        }
+        for (int label : path)
+            inclusive[static_cast<size_t>(label)] += node.self_count;
+    }
+
+    std::vector<int> order(labels_.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::sort(order.begin(), order.end(), [&](int a, int b)
+              { return inclusive[a] != inclusive[b] ? inclusive[a] > inclusive[b] : labels_[a] < labels_[b]; });
+
+    out << "\n--- Functions (inclusive counts follow CALL/RET) ---\n";
+    out << std::setw(12) << "Inclusive" << std::setw(9) << "%" << std::setw(12) << "Self" << std::setw(9) << "%"
+        << std::setw(10) << "Calls" << "  Label\n";
+    for (int label : order)
+    {
+        size_t i = static_cast<size_t>(label);
+        if (label == KERNEL_ROOT || label == USER_ROOT || inclusive[i] == 0)
+            continue;
+        out << std::setw(12) << inclusive[i] << std::setw(8) << percent(inclusive[i], total) << "%"
+            << std::setw(12) << self[i] << std::setw(8) << percent(self[i], total) << "%"
+            << std::setw(10) << (i < calls_.size() ? calls_[i] : 0) << "  " << labels_[i] << "\n";
+    }
+
+    // Flat counts: each PC goes to the label it is under, regardless of the call stack
+    std::vector<uint64_t> flat(labels_.size(), 0);
+    std::vector<long> last_pc(labels_.size(), -1);
+    for (size_t pc = 0; pc < pc_counts_.size(); ++pc)
+    {
+        flat[static_cast<size_t>(pc_labels_[pc])] += pc_counts_[pc];
+        last_pc[static_cast<size_t>(pc_labels_[pc])] = static_cast<long>(pc);
+    }
+    std::sort(order.begin(), order.end(), [&](int a, int b)
+              { return flat[a] != flat[b] ? flat[a] > flat[b] : labels_[a] < labels_[b]; });
+
+    out << "\n--- Labels (flat counts per PC range) ---\n";
+    out << std::setw(12) << "Count" << std::setw(9) << "%" << std::setw(14) << "PCs" << "  Label\n";
+    for (int label : order)
+    {
+        size_t i = static_cast<size_t>(label);
+        if (flat[i] == 0)
+            continue;
+        long first = label == NO_LABEL ? 0 : label_pcs_[i];
+        out << std::setw(12) << flat[i] << std::setw(8) << percent(flat[i], total) << "%"
+            << std::setw(14) << (std::to_string(first) + "-" + std::to_string(last_pc[i])) << "  " << labels_[i] << "\n";
+    }
+
+    std::vector<size_t> pcs;
+    for (size_t pc = 0; pc < pc_counts_.size(); ++pc)
+    {
+        if (pc_counts_[pc] != 0)
+            pcs.push_back(pc);
+    }
+    size_t shown = std::min(hot_pcs, pcs.size());
+    std::partial_sort(pcs.begin(), pcs.begin() + static_cast<long>(shown), pcs.end(), [&](size_t a, size_t b)
+                      { return pc_counts_[a] != pc_counts_[b] ? pc_counts_[a] > pc_counts_[b] : a < b; });
+
+    out << "\n--- Hottest PCs ---\n";
+    out << std::setw(6) << "PC" << std::setw(12) << "Count" << std::setw(9) << "%" << "  Location / source\n";
+    for (size_t i = 0; i < shown; ++i)
+    {
+        size_t pc = pcs[i];
+        out << std::setw(6) << pc << std::setw(12) << pc_counts_[pc] << std::setw(8) << percent(pc_counts_[pc], total) << "%"
+            << "  " << location(static_cast<long>(pc));
+        std::string source = trimmed(code_.sources[pc].original_line);
+        if (!source.empty())
+            out << "  | " << source;
+        out << "\n";
+    }
+
+    out.flags(flags);
+}
+
+void GuestProfiler::writeFoldedStacks(std::ostream &out) const
+{
+    std::vector<int> path;
+    for (const CallNode &node : nodes_)
+    {
+        if (node.self_count == 0)
+            continue;
+        path.clear();
+        for (const CallNode *n = &node; n != nullptr; n = n->parent >= 0 ? &nodes_[static_cast<size_t>(n->parent)] : nullptr)
+            path.push_back(n->label);
+        for (auto it = path.rbegin(); it != path.rend(); ++it)
+            out << (it == path.rbegin() ? "" : ";") << labels_[static_cast<size_t>(*it)];
+        out << ' ' << node.self_count << '\n';
+    }
+}
@@ -0,0 +1,90 @@
+// src/profile.h
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include "decoder.h"       // For DecodedProgram
+#include "instruction.h"   // For OpCode
+#include "program.h"       // For ProgramSymbol
+#include <cstdint>         // For counts
+#include <iosfwd>          // For report streams
+#include <string>          // For label names
+#include <unordered_map>   // For the call tree's child index
+#include <vector>          // For per-PC counts and the call tree
+
+class CPU;
+class Memory;
+
+// Guest profiler for --profile. Counts executions per PC, attributes each PC to the
+// nearest instruction label at or before it, and follows CALL/RET to build a call tree
+// for inclusive counts and folded stacks. Feed it every executed instruction with
+// beforeStep()/afterStep() around CPU::step().
+//
+// Kernel and user mode have separate call stacks. The kernel stack restarts at each
+// trap into the kernel. A user stack is put aside at a trap under the thread's stack
+// pointer, and picked up again when USER resumes a thread with that stack pointer.
+class GuestProfiler
+{
+public:
+    // symbols: the program's symbol table; data labels are ignored, and the "SYMBOL_"
+    // prefix of gtu_assembler's headers is dropped from instruction labels.
+    GuestProfiler(const DecodedProgram &code, const std::vector<ProgramSymbol> &symbols);
+
+    // Notes the instruction cpu is about to execute
+    void beforeStep(const CPU &cpu);
+    // Counts it once executed; registers must be synced to memory
+    void afterStep(const CPU &cpu, const Memory &memory);
+
+    uint64_t totalCount() const { return mode_counts_[0] + mode_counts_[1]; }
+
+    // Sorted text report: functions with inclusive and self counts, labels, hottest PCs
+    void writeReport(std::ostream &out, size_t hot_pcs = 20) const;
+    // One "frame;frame;... count" line per call stack, for flame graph tools
+    void writeFoldedStacks(std::ostream &out) const;
+
+private:
+    struct CallNode
+    {
+        int parent; // -1 for the mode roots
+        int label;  // Index into labels_
+        uint64_t self_count;
+    };
+
+    struct Frame
+    {
+        int node;
+        long return_pc; // -1 for the mode root and the root label
+    };
+
+    struct ParkedStack
+    {
+        long resume_pc; // Where the thread trapped from
+        std::vector<Frame> frames;
+    };
+
+    const DecodedProgram &code_;
+    std::vector<std::string> labels_;   // [0] and [1] are the kernel and user roots, [2] "<no label>"
+    std::vector<long> label_pcs_;       // First PC of each label, -1 for the three above
+    std::vector<int> pc_labels_;        // Label index of each PC
+    std::vector<uint64_t> pc_counts_;
+    uint64_t mode_counts_[2];           // Kernel, user
+
+    std::vector<CallNode> nodes_;
+    std::unordered_map<uint64_t, int> children_; // (parent, label) -> node
+    std::vector<uint64_t> calls_;                // CALLs per label index
+    std::vector<Frame> stack_;                   // Current stack: mode root, root label, callees
+    std::unordered_map<long, ParkedStack> parked_user_stacks_; // By stack pointer
+
+    long pc_;
+    bool user_mode_;
+    OpCode opcode_;
+    long arg1_;
+
+    int labelAt(long pc) const;
+    int labelIndex(const std::string &name);
+    int child(int parent, int label);
+    void resetStack(bool user_mode);
+    std::string labelName(int label) const;
+    std::string location(long pc) const;
+};
+
+#endif // PROFILE_H
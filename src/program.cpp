@@ -0,0 +1,93 @@
+// src/program.cpp
+#include "program.h"
+#include "instruction.h" // For Instruction
+#include "parser.h"      // For parseInstructionSection
+#include <algorithm>     // For std::sort
+#include <fstream>       // For image and symbols files
+#include <sstream>       // For header line parsing
+#include <stdexcept>     // For runtime_error
+
+Program::Program(DecodedProgram code, const Memory &initial_memory, std::vector<ProgramSymbol> symbols)
+    : code_(std::move(code)),
+      initial_memory_(initial_memory),
+      symbols_(std::move(symbols))
+{
+    markProvenOperands(code_, initial_memory_.getSize());
+    markFusedOps(code_);
+    std::sort(symbols_.begin(), symbols_.end(), [](const ProgramSymbol &a, const ProgramSymbol &b)
+              { return a.value != b.value ? a.value < b.value : a.name < b.name; });
+}
+
+std::shared_ptr<const Program> Program::create(const std::vector<Instruction> &instructions,
+                                               const Memory &initial_memory,
+                                               std::vector<ProgramSymbol> symbols)
+{
+    return create(decodeProgram(instructions), initial_memory, std::move(symbols));
+}
+
+std::shared_ptr<const Program> Program::create(DecodedProgram code,
+                                               const Memory &initial_memory,
+                                               std::vector<ProgramSymbol> symbols)
+{
+    return std::shared_ptr<const Program>(new Program(std::move(code), initial_memory, std::move(symbols)));
+}
+
+std::shared_ptr<const Program> Program::load(const std::string &image_filename, size_t memory_size,
+                                             const std::string &symbols_filename)
+{
+    std::ifstream file(image_filename);
+    if (!file.is_open())
+        throw std::runtime_error("Could not open program file '" + image_filename + "'.");
+
+    Memory memory(memory_size);
+    int lines_read = 0;
+    if (!memory.loadDataSection(file, lines_read)) // Prints the details itself
+        throw std::runtime_error("Could not load the data section of '" + image_filename + "'.");
+    std::vector<Instruction> instructions = parseInstructionSection(file, image_filename, lines_read);
+
+    std::vector<ProgramSymbol> symbols;
+    if (!symbols_filename.empty())
+        symbols = loadSymbols(symbols_filename);
+    return create(instructions, memory, std::move(symbols));
+}
+
+std::vector<ProgramSymbol> Program::loadSymbols(const std::string &symbols_filename)
+{
+    std::ifstream file(symbols_filename);
+    if (!file.is_open())
+        throw std::runtime_error("Could not open symbols file '" + symbols_filename + "'.");
+
+    std::vector<ProgramSymbol> symbols;
+    bool in_memory_labels = false;
+    std::string line;
+    while (std::getline(file, line))
+    {
+        if (line.rfind("//", 0) == 0)
+        {
+            in_memory_labels = line.find("Memory Address Labels") != std::string::npos;
+            continue;
+        }
+        std::istringstream fields(line);
+        std::string directive, name;
+        long value;
+        if (fields >> directive >> name >> value && directive == "#define")
+            symbols.push_back({name, value, !in_memory_labels});
+    }
+    return symbols;
+}
+
+const ProgramSymbol *Program::findSymbol(const std::string &name) const
+{
+    for (const ProgramSymbol &symbol : symbols_)
+    {
+        if (symbol.name == name)
+            return &symbol;
+    }
+    return nullptr;
+}
+
+void Program::resolveHandlers(int mode, const std::function<void(DecodedProgram &)> &resolve) const
+{
+    std::call_once(handlers_resolved_[mode], [&]
+                   { resolve(code_); });
+}
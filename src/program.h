@@ -0,0 +1,76 @@
+// src/program.h
+#ifndef PROGRAM_H
+#define PROGRAM_H
+
+#include "decoder.h"  // For DecodedProgram - held by value
+#include "memory.h"   // For the initial data image - held by value
+#include <functional> // For std::function handler resolution
+#include <memory>     // For std::shared_ptr
+#include <mutex>      // For std::once_flag
+#include <string>     // For symbol names and paths
+#include <vector>     // For std::vector containers
+
+struct Instruction;
+
+// Label exported by the assembler's symbols header
+struct ProgramSymbol
+{
+    std::string name;
+    long value;
+    bool is_code; // Instruction label (PC); false for memory address labels
+};
+
+// Loaded image shared read-only by any number of CPU/Memory pairs: the decoded
+// instructions (operand proofs and fused ops marked for memorySize() cells), the data
+// section as an initial memory image, and optionally the symbol table. A machine is a
+// copy of initialMemory() plus a CPU constructed on the shared program.
+class Program
+{
+public:
+    // Decodes instructions for machines with initial_memory.getSize() cells, taking
+    // initial_memory's contents as the data image. Throws std::runtime_error for an
+    // instruction with the wrong number of operands.
+    static std::shared_ptr<const Program> create(const std::vector<Instruction> &instructions,
+                                                 const Memory &initial_memory,
+                                                 std::vector<ProgramSymbol> symbols = {});
+
+    // Same for code that is already decoded (END sentinel included, nothing marked yet),
+    // e.g. read back from a snapshot file.
+    static std::shared_ptr<const Program> create(DecodedProgram code,
+                                                 const Memory &initial_memory,
+                                                 std::vector<ProgramSymbol> symbols = {});
+
+    // Loads an .img file, and the symbols header written by gtu_assembler if
+    // symbols_filename is not empty. Throws std::runtime_error on any load error.
+    static std::shared_ptr<const Program> load(const std::string &image_filename, size_t memory_size,
+                                               const std::string &symbols_filename = "");
+
+    // Reads the "#define NAME VALUE" lines of a gtu_assembler symbols header. Labels under
+    // "// Memory Address Labels" are data labels, everything else instruction labels.
+    static std::vector<ProgramSymbol> loadSymbols(const std::string &symbols_filename);
+
+    Program(const Program &) = delete;
+    Program &operator=(const Program &) = delete;
+
+    const DecodedProgram &code() const { return code_; }
+    const Memory &initialMemory() const { return initial_memory_; }
+    size_t memorySize() const { return initial_memory_.getSize(); }
+
+    // Sorted by value, then name
+    const std::vector<ProgramSymbol> &symbols() const { return symbols_; }
+    const ProgramSymbol *findSymbol(const std::string &name) const;
+
+    // Runs resolve on the decoded code exactly once per privilege mode (0 kernel, 1 user),
+    // however many CPUs share the program. resolve may only write handler_offset[mode].
+    void resolveHandlers(int mode, const std::function<void(DecodedProgram &)> &resolve) const;
+
+private:
+    Program(DecodedProgram code, const Memory &initial_memory, std::vector<ProgramSymbol> symbols);
+
+    mutable DecodedProgram code_; // Immutable apart from the lazily filled handler offsets
+    Memory initial_memory_;
+    std::vector<ProgramSymbol> symbols_;
+    mutable std::once_flag handlers_resolved_[2];
+};
+
+#endif // PROGRAM_H
@@ -0,0 +1,219 @@
+// src/snapshot.cpp
+#include "snapshot.h"
+#include "decoder.h"     // For DecodedProgram records
+#include "instruction.h" // For OpCode
+#include "program.h"     // For the code of the snapshot
+#include <cstdio>        // For rename, remove
+#include <cstring>       // For memcmp, memcpy, strerror
+#include <cerrno>        // For errno
+#include <fstream>       // For writing snapshot files
+#include <stdexcept>     // For runtime_error
+#include <fcntl.h>       // For open
+#include <sys/mman.h>    // For mmap of snapshot files
+#include <sys/stat.h>    // For fstat
+#include <unistd.h>      // For close, sysconf
+
+namespace
+{
+
+constexpr char SNAPSHOT_MAGIC[8] = {'G', 'T', 'U', 'S', 'N', 'A', 'P', '\0'};
+
+static_assert(sizeof(long) == sizeof(int64_t), "snapshot cells are stored as 64-bit values");
+static_assert(sizeof(SnapshotFileHeader) == 72, "snapshot header layout changed");
+static_assert(sizeof(SnapshotInstruction) == 24, "snapshot instruction layout changed");
+
+// Read-only private mapping of a whole file, unmapped and closed on destruction
+class MappedFile
+{
+public:
+    explicit MappedFile(const std::string &filename) : fd_(open(filename.c_str(), O_RDONLY | O_CLOEXEC)), data_(nullptr), size_(0)
+    {
+        if (fd_ < 0)
+            throw std::runtime_error("Could not open snapshot file '" + filename + "': " + std::strerror(errno) + ".");
+        struct stat info;
+        if (fstat(fd_, &info) != 0 || info.st_size <= 0)
+        {
+            close(fd_);
+            throw std::runtime_error("Snapshot file '" + filename + "' is empty or unreadable.");
+        }
+        size_ = static_cast<size_t>(info.st_size);
+        void *mapping = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd_, 0);
+        if (mapping == MAP_FAILED)
+        {
+            int error = errno;
+            close(fd_);
+            throw std::runtime_error("Could not map snapshot file '" + filename + "': " + std::strerror(error) + ".");
+        }
+        data_ = static_cast<const char *>(mapping);
+    }
+    ~MappedFile()
+    {
+        munmap(const_cast<char *>(data_), size_);
+        close(fd_);
+    }
+
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    int fd() const { return fd_; }
+    const char *data() const { return data_; }
+    size_t size() const { return size_; }
+
+    // True if [offset, offset + length) lies inside the file
+    bool contains(uint64_t offset, uint64_t length) const { return offset <= size_ && length <= size_ - offset; }
+
+private:
+    int fd_;
+    const char *data_;
+    size_t size_;
+};
+
+uint64_t alignedToPage(uint64_t bytes)
+{
+    return (bytes + SNAPSHOT_PAGE_ALIGNMENT - 1) / SNAPSHOT_PAGE_ALIGNMENT * SNAPSHOT_PAGE_ALIGNMENT;
+}
+
+} // namespace
+
+MachineFork::MachineFork(const MachineSnapshot &origin, std::function<void(long)> prn_callback)
+    : memory(origin.memory),
+      cpu(memory, origin.program, std::move(prn_callback))
+{
+    cpu.restore(origin);
+}
+
+std::vector<std::unique_ptr<MachineFork>> forkMachine(const CPU &parent,
+                                                      const std::vector<std::vector<std::pair<long, long>>> &patches,
+                                                      const std::function<std::function<void(long)>(size_t)> &prn_callback)
+{
+    const MachineSnapshot origin = parent.snapshot();
+    std::vector<std::unique_ptr<MachineFork>> children;
+    children.reserve(patches.size());
+    for (size_t child = 0; child < patches.size(); ++child)
+    {
+        std::unique_ptr<MachineFork> machine(new MachineFork(origin, prn_callback(child)));
+        for (const auto &patch : patches[child])
+            machine->memory.write(patch.first, patch.second);
+        machine->cpu.syncRegistersFromMemory(); // Patches may change the PC, SP or instruction counter
+        children.push_back(std::move(machine));
+    }
+    return children;
+}
+
+void saveSnapshot(const MachineSnapshot &snapshot, const std::string &filename)
+{
+    const DecodedProgram &code = snapshot.program->code();
+    const size_t memory_size = snapshot.memory.getSize();
+
+    std::string text;
+    for (const InstructionSource &source : code.sources)
+        text += source.original_line + '\n';
+
+    SnapshotFileHeader header = {};
+    std::memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.version = SNAPSHOT_VERSION;
+    header.flags = (snapshot.halted ? SNAPSHOT_HALTED : 0u) | (snapshot.user_mode ? SNAPSHOT_USER_MODE : 0u);
+    header.cycles = snapshot.cycles;
+    header.memory_size = memory_size;
+    header.memory_offset = alignedToPage(sizeof(header));
+    header.instruction_count = code.size();
+    header.code_offset = header.memory_offset + alignedToPage(memory_size * sizeof(int64_t));
+    header.text_offset = header.code_offset + code.size() * sizeof(SnapshotInstruction);
+    header.text_size = text.size();
+
+    const std::string temporary = filename + ".tmp";
+    std::ofstream file(temporary, std::ios::binary | std::ios::trunc);
+    if (!file.is_open())
+        throw std::runtime_error("Could not create snapshot file '" + filename + "'.");
+
+    const std::string padding(SNAPSHOT_PAGE_ALIGNMENT, '\0');
+    file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    file.write(padding.data(), static_cast<std::streamsize>(header.memory_offset - sizeof(header)));
+    for (size_t address = 0; address < memory_size; ++address)
+    {
+        int64_t cell = snapshot.memory.readUnchecked(static_cast<long>(address));
+        file.write(reinterpret_cast<const char *>(&cell), sizeof(cell));
+    }
+    file.write(padding.data(), static_cast<std::streamsize>(header.code_offset - header.memory_offset - memory_size * sizeof(int64_t)));
+    for (size_t pc = 0; pc < code.size(); ++pc)
+    {
+        SnapshotInstruction record = {static_cast<int32_t>(code.code[pc].opcode), code.sources[pc].line_number,
+                                      code.code[pc].arg1, code.code[pc].arg2};
+        file.write(reinterpret_cast<const char *>(&record), sizeof(record));
+    }
+    file.write(text.data(), static_cast<std::streamsize>(text.size()));
+    file.close();
+
+    if (!file || std::rename(temporary.c_str(), filename.c_str()) != 0)
+    {
+        std::remove(temporary.c_str());
+        throw std::runtime_error("Could not write snapshot file '" + filename + "'.");
+    }
+}
+
+MachineSnapshot loadSnapshot(const std::string &filename)
+{
+    MappedFile file(filename);
+    SnapshotFileHeader header;
+    if (!file.contains(0, sizeof(header)) || std::memcmp(file.data(), SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC)) != 0)
+        throw std::runtime_error("'" + filename + "' is not a snapshot file.");
+    std::memcpy(&header, file.data(), sizeof(header));
+    if (header.version != SNAPSHOT_VERSION)
+        throw std::runtime_error("Snapshot file '" + filename + "' has version " + std::to_string(header.version) +
+                                 ", expected " + std::to_string(SNAPSHOT_VERSION) + ".");
+
+    const uint64_t max_records = file.size() / sizeof(SnapshotInstruction);
+    if (header.memory_size > file.size() / sizeof(int64_t) || header.instruction_count > max_records ||
+        header.memory_offset % SNAPSHOT_PAGE_ALIGNMENT != 0 ||
+        !file.contains(header.memory_offset, alignedToPage(header.memory_size * sizeof(int64_t))) ||
+        !file.contains(header.code_offset, header.instruction_count * sizeof(SnapshotInstruction)) ||
+        !file.contains(header.text_offset, header.text_size))
+        throw std::runtime_error("Snapshot file '" + filename + "' is truncated.");
+
+    MachineSnapshot snapshot;
+    if (header.memory_offset % static_cast<uint64_t>(sysconf(_SC_PAGESIZE)) == 0)
+    {
+        snapshot.memory = Memory(file.fd(), header.memory_offset, static_cast<size_t>(header.memory_size));
+    }
+    else
+    {
+        snapshot.memory = Memory(static_cast<size_t>(header.memory_size));
+        std::memcpy(snapshot.memory.data(), file.data() + header.memory_offset, header.memory_size * sizeof(int64_t));
+    }
+    snapshot.halted = (header.flags & SNAPSHOT_HALTED) != 0;
+    snapshot.user_mode = (header.flags & SNAPSHOT_USER_MODE) != 0;
+    snapshot.cycles = header.cycles;
+
+    DecodedProgram code;
+    code.code.reserve(header.instruction_count + 1);
+    code.sources.reserve(header.instruction_count);
+    const char *text = file.data() + header.text_offset;
+    const char *text_end = text + header.text_size;
+    for (uint64_t pc = 0; pc < header.instruction_count; ++pc)
+    {
+        SnapshotInstruction record;
+        std::memcpy(&record, file.data() + header.code_offset + pc * sizeof(record), sizeof(record));
+        if (record.opcode < 0 || record.opcode >= static_cast<int32_t>(OpCode::END))
+            throw std::runtime_error("Snapshot file '" + filename + "' has an invalid opcode at PC " + std::to_string(pc) + ".");
+
+        const char *line_end = static_cast<const char *>(std::memchr(text, '\n', static_cast<size_t>(text_end - text)));
+        if (!line_end)
+            throw std::runtime_error("Snapshot file '" + filename + "' is truncated.");
+
+        code.code.push_back({static_cast<OpCode>(record.opcode), {0, 0}, {FusedOp::NONE, FusedOp::NONE},
+                             static_cast<long>(record.arg1), static_cast<long>(record.arg2), {0, 0}});
+        code.sources.push_back({std::string(text, line_end), record.source_line});
+        text = line_end + 1;
+    }
+    code.code.push_back({OpCode::END, {0, 0}, {FusedOp::NONE, FusedOp::NONE}, 0, 0, {0, 0}});
+
+    snapshot.program = Program::create(std::move(code), snapshot.memory);
+    return snapshot;
+}
+
+bool isSnapshotFile(const std::string &filename)
+{
+    std::ifstream file(filename, std::ios::binary);
+    char magic[sizeof(SNAPSHOT_MAGIC)];
+    return file.read(magic, sizeof(magic)) && std::memcmp(magic, SNAPSHOT_MAGIC, sizeof(magic)) == 0;
+}
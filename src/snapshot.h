@@ -0,0 +1,103 @@
+// src/snapshot.h
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include "cpu.h"    // For the CPU of a MachineFork - held by value
+#include "memory.h" // For the memory image - held by value
+#include <cstdint>  // For uint64_t cycle counts
+#include <functional> // For PRN callbacks of forked machines
+#include <memory>   // For std::shared_ptr<const Program>
+#include <string>   // For file names
+#include <utility>  // For std::pair data patches
+#include <vector>   // For lists of forked machines
+
+class Program;
+
+// Whole machine between two instructions, from CPU::snapshot(). Restoring it with
+// CPU::restore() continues exactly where the snapshot was taken. Any number of machines
+// may be restored from one snapshot.
+struct MachineSnapshot
+{
+    std::shared_ptr<const Program> program; // Code the machine runs (shared, not copied)
+    Memory memory;                          // Every cell, registers included
+    bool halted = false;
+    bool user_mode = false;
+    uint64_t cycles = 0; // Instructions the run had executed, as recorded by the caller
+};
+
+// A machine of its own started from a snapshot: a CPU on a copy-on-write copy of the
+// snapshot's memory, in the snapshot's privilege mode and halt state.
+struct MachineFork
+{
+    MachineFork(const MachineSnapshot &origin, std::function<void(long)> prn_callback);
+
+    Memory memory;
+    CPU cpu;
+};
+
+// Forks one child per entry of patches from parent, which may go on running: every child
+// shares the parent's memory pages until it writes them, continues at the parent's PC and
+// has its (address, value) patches written first. prn_callback(i) is child i's PRN
+// callback. Throws std::out_of_range for a patch outside memory.
+std::vector<std::unique_ptr<MachineFork>> forkMachine(const CPU &parent,
+                                                      const std::vector<std::vector<std::pair<long, long>>> &patches,
+                                                      const std::function<std::function<void(long)>(size_t)> &prn_callback);
+
+// Snapshot file, in host byte order, laid out so that it can be mapped and used in place:
+//   SnapshotFileHeader (72 bytes)
+//   memory_size cells of 8 bytes at memory_offset, a multiple of SNAPSHOT_PAGE_ALIGNMENT,
+//   zero-padded to the next multiple
+//   instruction_count SnapshotInstruction records at code_offset
+//   the source line of every instruction, each followed by '\n', at text_offset
+// The memory section is mapped copy-on-write as the machine's memory, so resuming reads
+// only the pages the machine uses. The code is stored decoded, so resuming parses no
+// image text.
+struct SnapshotFileHeader
+{
+    char magic[8];              // "GTUSNAP" followed by '\0'
+    uint32_t version;           // SNAPSHOT_VERSION
+    uint32_t flags;             // SnapshotFlags bits
+    uint64_t cycles;
+    uint64_t memory_size;       // In cells
+    uint64_t memory_offset;
+    uint64_t instruction_count; // Without the END sentinel
+    uint64_t code_offset;
+    uint64_t text_offset;
+    uint64_t text_size;
+};
+
+struct SnapshotInstruction
+{
+    int32_t opcode; // OpCode, HOLE for unused slots
+    int32_t source_line;
+    int64_t arg1;
+    int64_t arg2;
+};
+
+enum SnapshotFlags : uint32_t
+{
+    SNAPSHOT_HALTED = 1u << 0,
+    SNAPSHOT_USER_MODE = 1u << 1
+};
+
+constexpr uint32_t SNAPSHOT_VERSION = 2;
+
+// Alignment of the memory section: a multiple of every host page size in common use
+constexpr uint64_t SNAPSHOT_PAGE_ALIGNMENT = 65536;
+
+// Writes snapshot to filename. The file is written under a temporary name and renamed
+// over filename, so machines still mapping an older file of that name keep their pages.
+// Throws std::runtime_error if the file cannot be written.
+void saveSnapshot(const MachineSnapshot &snapshot, const std::string &filename);
+
+// Maps a snapshot file and rebuilds the machine from it: the memory section becomes the
+// memory image, mapped copy-on-write (copied instead if the host page size does not
+// divide its offset), and the code records become a new Program. The file must not be
+// changed in place while the machine or a copy of it exists. Throws std::runtime_error
+// for a missing, truncated or foreign file.
+MachineSnapshot loadSnapshot(const std::string &filename);
+
+// True if filename starts with the snapshot file magic
+bool isSnapshotFile(const std::string &filename);
+
+#endif // SNAPSHOT_H
@@ -0,0 +1,231 @@
+// src/trace.cpp
+#include "trace.h"
+#include "common.h"      // For the memory-mapped registers
+#include "cpu.h"         // For the traced CPU
+#include "decoder.h"     // For DecodedInstruction
+#include "instruction.h" // For OpCode
+#include "memory.h"      // For operand values
+#include "program.h"     // For the code being traced
+#include <algorithm>     // For std::min
+#include <cerrno>        // For errno
+#include <chrono>        // For the writer's idle wait
+#include <cstring>       // For memcpy, strerror
+#include <stdexcept>     // For runtime_error
+#include <fcntl.h>       // For open
+#include <unistd.h>      // For write, close
+
+static_assert(sizeof(TraceRecord) == 64, "trace record layout changed");
+static_assert(sizeof(TraceFileHeader) == 16, "trace header layout changed");
+
+namespace
+{
+
+// Contents of address, or TRACE_NO_ADDRESS if it is outside memory (the CPU faults then)
+int64_t cellOrNone(const Memory &memory, long address)
+{
+    return memory.isValidAddress(address) ? memory.readUnchecked(address) : TRACE_NO_ADDRESS;
+}
+
+// Writes all of data, retrying short writes. Returns false on error.
+bool writeAll(int fd, const char *data, size_t size)
+{
+    while (size > 0)
+    {
+        ssize_t written = write(fd, data, size);
+        if (written < 0 && errno == EINTR)
+            continue;
+        if (written <= 0)
+            return false;
+        data += written;
+        size -= static_cast<size_t>(written);
+    }
+    return true;
+}
+
+} // namespace
+
+// --- Record capture ---
+// The effective addresses follow the semantics of CPU::step(), evaluated on the state
+// before the instruction. The value written is read back afterwards.
+
+void beginTraceRecord(TraceRecord &record, const CPU &cpu, const Memory &memory, uint64_t cycle)
+{
+    const long pc = cpu.getCurrentProgramCounter();
+    const DecodedInstruction &instr = cpu.getProgram()->code().fetch(pc);
+    const long sp = memory.readUnchecked(SP_ADDR);
+
+    record = TraceRecord();
+    record.cycle = cycle;
+    record.pc = pc;
+    record.arg1 = instr.arg1;
+    record.arg2 = instr.arg2;
+    record.opcode = static_cast<uint8_t>(instr.opcode);
+    record.flags = cpu.isInUserMode() ? TRACE_USER_MODE : 0;
+    record.read_address = TRACE_NO_ADDRESS;
+    record.write_address = TRACE_NO_ADDRESS;
+    record.event = static_cast<uint8_t>(memory.readUnchecked(CPU_OS_COMM_ADDR)); // Until endTraceRecord()
+
+    switch (instr.opcode)
+    {
+    case OpCode::SET:
+        record.write_address = instr.arg2;
+        break;
+    case OpCode::CPY:
+    case OpCode::SUBI:
+        record.read_address = instr.arg1;
+        record.write_address = instr.arg2;
+        break;
+    case OpCode::CPYI:
+        record.read_address = cellOrNone(memory, instr.arg1);
+        record.write_address = instr.arg2;
+        break;
+    case OpCode::CPYI2:
+        record.read_address = cellOrNone(memory, instr.arg1);
+        record.write_address = cellOrNone(memory, instr.arg2);
+        break;
+    case OpCode::ADD:
+    case OpCode::ADDI:
+        record.read_address = instr.arg1;
+        record.write_address = instr.arg1;
+        break;
+    case OpCode::STOREI:
+        record.read_address = instr.arg1;
+        record.write_address = cellOrNone(memory, instr.arg2);
+        break;
+    case OpCode::LOADI:
+        record.read_address = cellOrNone(memory, instr.arg1);
+        record.write_address = instr.arg2;
+        break;
+    case OpCode::JIF:
+    case OpCode::USER:
+    case OpCode::SYSCALL_PRN:
+        record.read_address = instr.arg1;
+        break;
+    case OpCode::PUSH:
+        record.read_address = instr.arg1;
+        record.write_address = sp - 1;
+        break;
+    case OpCode::POP:
+        record.read_address = sp;
+        record.write_address = instr.arg1;
+        break;
+    case OpCode::CALL:
+        record.write_address = sp - 1;
+        break;
+    case OpCode::RET:
+        record.read_address = sp;
+        break;
+    default:
+        break;
+    }
+}
+
+void endTraceRecord(TraceRecord &record, const CPU &cpu, const Memory &memory)
+{
+    if (record.write_address != TRACE_NO_ADDRESS)
+        record.value_written = cellOrNone(memory, record.write_address);
+    if (cpu.isInUserMode())
+        record.flags |= TRACE_USER_MODE_AFTER;
+    if (cpu.isHalted())
+        record.flags |= TRACE_HALTED;
+
+    // The event cell keeps its value until the OS clears it, so only a change or a
+    // syscall counts as an event raised by this instruction
+    uint8_t event = static_cast<uint8_t>(memory.readUnchecked(CPU_OS_COMM_ADDR));
+    OpCode opcode = static_cast<OpCode>(record.opcode);
+    bool syscall = opcode == OpCode::SYSCALL_PRN || opcode == OpCode::SYSCALL_HLT_THREAD ||
+                   opcode == OpCode::SYSCALL_YIELD;
+    record.event = event != record.event || syscall ? event : 0;
+}
+
+// --- Writer ---
+
+TraceWriter::TraceWriter(const std::string &filename, size_t ring_records)
+    : tail_cache_(0), head_(0), tail_(0), stopping_(false), failed_(false), fd_(-1)
+{
+    size_t capacity = 1;
+    while (capacity < ring_records)
+        capacity <<= 1;
+    ring_.resize(capacity);
+    mask_ = capacity - 1;
+
+    fd_ = open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd_ < 0)
+        throw std::runtime_error("Could not create trace file '" + filename + "': " + std::strerror(errno) + ".");
+
+    TraceFileHeader header = {};
+    std::memcpy(header.magic, TRACE_MAGIC, sizeof(header.magic));
+    header.version = TRACE_VERSION;
+    header.record_size = sizeof(TraceRecord);
+    if (!writeAll(fd_, reinterpret_cast<const char *>(&header), sizeof(header)))
+    {
+        close(fd_);
+        throw std::runtime_error("Could not write trace file '" + filename + "'.");
+    }
+
+    writer_ = std::thread(&TraceWriter::drain, this);
+}
+
+TraceWriter::~TraceWriter()
+{
+    try
+    {
+        finish();
+    }
+    catch (const std::runtime_error &)
+    {
+    }
+}
+
+void TraceWriter::finish()
+{
+    if (fd_ < 0)
+        return;
+    stopping_.store(true, std::memory_order_release);
+    writer_.join();
+    close(fd_);
+    fd_ = -1;
+    if (failed_.load())
+        throw std::runtime_error("Could not write the trace file.");
+}
+
+void TraceWriter::waitForSpace(uint64_t head)
+{
+    tail_cache_ = tail_.load(std::memory_order_acquire);
+    while (head - tail_cache_ > mask_)
+    {
+        std::this_thread::yield();
+        tail_cache_ = tail_.load(std::memory_order_acquire);
+    }
+}
+
+void TraceWriter::drain()
+{
+    uint64_t tail = 0;
+    for (;;)
+    {
+        // Read stopping_ before head_, so that nothing appended before finish() is missed
+        bool stopping = stopping_.load(std::memory_order_acquire);
+        uint64_t head = head_.load(std::memory_order_acquire);
+        if (head == tail)
+        {
+            if (stopping)
+                return;
+            std::this_thread::sleep_for(std::chrono::microseconds(200));
+            continue;
+        }
+
+        // Everything up to head, in at most two pieces around the end of the ring
+        while (tail != head)
+        {
+            uint64_t index = tail & mask_;
+            uint64_t count = std::min(head - tail, ring_.size() - index);
+            // After a failed write the records are still consumed, so append() never stalls
+            if (!failed_.load(std::memory_order_relaxed) &&
+                !writeAll(fd_, reinterpret_cast<const char *>(&ring_[index]), count * sizeof(TraceRecord)))
+                failed_.store(true);
+            tail += count;
+            tail_.store(tail, std::memory_order_release);
+        }
+    }
+}
@@ -0,0 +1,102 @@
+// src/trace.h
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <atomic>  // For the ring indices shared with the writer thread
+#include <cstdint> // For fixed-size record fields
+#include <string>  // For file names
+#include <thread>  // For the writer thread
+#include <vector>  // For the ring storage
+
+class CPU;
+class Memory;
+
+// One executed instruction in a trace file (host byte order, 64 bytes)
+struct TraceRecord
+{
+    uint64_t cycle;        // Cycles executed before this instruction
+    int64_t pc;
+    int64_t arg1;
+    int64_t arg2;
+    int64_t read_address;  // Effective address of the data read, TRACE_NO_ADDRESS if none
+    int64_t write_address; // Effective address written, TRACE_NO_ADDRESS if none
+    int64_t value_written; // Contents of write_address after the instruction
+    uint8_t opcode;        // OpCode
+    uint8_t flags;         // TraceFlags
+    uint8_t event;         // CpuEvent the instruction raised in CPU_OS_COMM_ADDR, 0 if none
+    uint8_t reserved[5];
+};
+
+enum TraceFlags : uint8_t
+{
+    TRACE_USER_MODE = 1u << 0,       // Executed in user mode
+    TRACE_USER_MODE_AFTER = 1u << 1, // The CPU was in user mode afterwards
+    TRACE_HALTED = 1u << 2           // The CPU halted on this instruction
+};
+
+constexpr int64_t TRACE_NO_ADDRESS = -1;
+
+// Trace file: this header followed by TraceRecords
+struct TraceFileHeader
+{
+    char magic[8];        // "GTUTRACE"
+    uint32_t version;     // TRACE_VERSION
+    uint32_t record_size; // sizeof(TraceRecord)
+};
+
+constexpr uint32_t TRACE_VERSION = 1;
+constexpr char TRACE_MAGIC[8] = {'G', 'T', 'U', 'T', 'R', 'A', 'C', 'E'};
+
+// Fills the fields of record known before cpu executes its next instruction. Registers
+// must be synced to memory.
+void beginTraceRecord(TraceRecord &record, const CPU &cpu, const Memory &memory, uint64_t cycle);
+
+// Completes record after the instruction, with registers synced to memory again.
+void endTraceRecord(TraceRecord &record, const CPU &cpu, const Memory &memory);
+
+// Writes trace records to a file from a background thread. append() puts a record into
+// a single-producer/single-consumer ring and returns; the writer thread drains the ring
+// in large writes. append() only waits when the ring is full.
+class TraceWriter
+{
+public:
+    // Creates filename and starts the writer. ring_records is rounded up to a power of two.
+    // Throws std::runtime_error if the file cannot be created.
+    explicit TraceWriter(const std::string &filename, size_t ring_records = 1u << 16);
+    ~TraceWriter(); // Calls finish(), ignoring write errors
+
+    TraceWriter(const TraceWriter &) = delete;
+    TraceWriter &operator=(const TraceWriter &) = delete;
+
+    // Called from one thread only
+    void append(const TraceRecord &record)
+    {
+        uint64_t head = head_.load(std::memory_order_relaxed);
+        if (head - tail_cache_ > mask_)
+            waitForSpace(head);
+        ring_[head & mask_] = record;
+        head_.store(head + 1, std::memory_order_release);
+    }
+
+    // Writes the remaining records, stops the writer and closes the file. Throws
+    // std::runtime_error if any write failed.
+    void finish();
+
+    uint64_t recordCount() const { return head_.load(std::memory_order_relaxed); }
+
+private:
+    std::vector<TraceRecord> ring_;
+    uint64_t mask_;
+    uint64_t tail_cache_; // Producer's last view of tail_
+    alignas(64) std::atomic<uint64_t> head_; // Next record to fill (producer)
+    alignas(64) std::atomic<uint64_t> tail_; // Next record to write (consumer)
+    std::atomic<bool> stopping_;
+    std::atomic<bool> failed_;
+    int fd_;
+    std::thread writer_;
+
+    void waitForSpace(uint64_t head);
+    void drain(); // Writer thread body
+};
+
+#endif // TRACE_H
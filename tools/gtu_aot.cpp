@@ -0,0 +1,380 @@
+// tools/gtu_aot.cpp (AHEAD-OF-TIME RECOMPILER: .img -> standalone C++)
+//
+// Every instruction becomes a labelled statement in one function and every JIF a goto.
+// CALL pushes the return address and jumps to its target; RET goes through a switch over
+// the return addresses of all CALL sites. The inline code covers the fault-free case
+// only: operands proven in range by the decoder, stack slots and indirect addresses
+// checked at run time. Everything else (HLT, USER, SYSCALL, holes, faults, writes to the
+// registers at addresses 0-3) is handed to the simulator's CPU::step(), so trap
+// semantics, diagnostics and the final dump are those of gtu_sim.
+//
+// The generated file links against the simulator's objects except main.o (see the
+// makefile's %_aot rule).
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <set>
+#include <climits>
+
+#include "common.h"
+#include "decoder.h"
+#include "instruction.h"
+#include "memory.h"
+#include "parser.h"
+
+namespace {
+
+// Same default cycle limit as gtu_sim
+constexpr unsigned long AOT_DEFAULT_MAX_CYCLES = 200000;
+
+std::string literal(long value)
+{
+    if (value == LONG_MIN)
+        return "(-" + std::to_string(LONG_MAX) + "L - 1)";
+    return std::to_string(value) + "L";
+}
+
+std::string quoted(const std::string &text)
+{
+    std::string out = "\"";
+    for (char c : text) {
+        if (c == '"' || c == '\\')
+            out += '\\';
+        if (c == '\t') {
+            out += "\\t";
+            continue;
+        }
+        out += c;
+    }
+    return out + "\"";
+}
+
+std::string cell(long address)
+{
+    return "m[" + std::to_string(address) + "]";
+}
+
+// Jump to the code for pc, or to the CPU for PCs outside the program
+std::string jumpTo(long pc, size_t program_size)
+{
+    if (pc >= 0 && static_cast<size_t>(pc) < program_size)
+        return "goto L" + std::to_string(pc) + ";";
+    return "AOT_SLOW(" + literal(pc) + ");";
+}
+
+// Statement body for the instruction at pc. The guard sends the instruction to the CPU
+// when its direct operands are not proven for the current privilege mode.
+void emitInstruction(std::ostream &out, const DecodedProgram &program, size_t pc)
+{
+    const DecodedInstruction &instr = program.code[pc];
+    const long n = static_cast<long>(pc);
+    const unsigned direct = directOperands(instr.opcode);
+    const bool kernel_proven = instr.proven_operands[0] == direct;
+    const bool user_proven = instr.proven_operands[1] == direct;
+    const std::string a = cell(instr.arg1);
+    const std::string b = cell(instr.arg2);
+
+    bool inline_op = false;
+    switch (instr.opcode) {
+    case OpCode::SET: case OpCode::CPY: case OpCode::CPYI: case OpCode::CPYI2:
+    case OpCode::ADD: case OpCode::ADDI: case OpCode::SUBI: case OpCode::JIF:
+    case OpCode::PUSH: case OpCode::POP: case OpCode::STOREI: case OpCode::LOADI:
+        inline_op = kernel_proven;
+        break;
+    case OpCode::CALL: case OpCode::RET:
+        inline_op = true; // No direct operands; the stack slot is checked below
+        break;
+    default:
+        break;
+    }
+
+    out << "L" << n << ": // " << opCodeToString(instr.opcode) << " " << instr.arg1 << " " << instr.arg2 << "\n";
+    out << "    AOT_BEGIN(" << n << ");\n";
+    if (!inline_op) {
+        out << "    AOT_SLOW(" << n << ");\n";
+        return;
+    }
+    if (!user_proven)
+        out << "    if (user) AOT_SLOW(" << n << ");\n";
+
+    switch (instr.opcode) {
+    case OpCode::SET:
+        out << "    " << b << " = " << literal(instr.arg1) << ";\n";
+        break;
+    case OpCode::CPY:
+        out << "    " << b << " = " << a << ";\n";
+        break;
+    case OpCode::CPYI:
+        out << "    x = " << a << "; if (!AOT_PLAIN(x)) AOT_SLOW(" << n << ");\n";
+        out << "    " << b << " = m[x];\n";
+        break;
+    case OpCode::CPYI2:
+        out << "    x = " << a << "; y = " << b << "; if (!AOT_PLAIN(x) || !AOT_PLAIN(y)) AOT_SLOW(" << n << ");\n";
+        out << "    m[y] = m[x];\n";
+        break;
+    case OpCode::ADD:
+        out << "    " << a << " += " << literal(instr.arg2) << ";\n";
+        break;
+    case OpCode::ADDI:
+        out << "    " << a << " += " << b << ";\n";
+        break;
+    case OpCode::SUBI:
+        out << "    " << b << " = " << a << " - " << b << ";\n";
+        break;
+    case OpCode::STOREI:
+        out << "    y = " << b << "; if (!AOT_PLAIN(y)) AOT_SLOW(" << n << ");\n";
+        out << "    m[y] = " << a << ";\n";
+        break;
+    case OpCode::LOADI:
+        out << "    x = " << a << "; if (!AOT_PLAIN(x)) AOT_SLOW(" << n << ");\n";
+        out << "    " << b << " = m[x];\n";
+        break;
+    case OpCode::JIF:
+        out << "    AOT_RETIRE();\n";
+        out << "    if (" << a << " <= 0) " << jumpTo(instr.arg2, program.size()) << "\n";
+        return;
+    case OpCode::PUSH:
+        out << "    x = m[" << SP_ADDR << "] - 1; if (!AOT_PLAIN(x)) AOT_SLOW(" << n << ");\n";
+        out << "    m[" << SP_ADDR << "] = x; m[x] = " << a << ";\n";
+        break;
+    case OpCode::POP:
+        out << "    x = m[" << SP_ADDR << "]; if (!AOT_PLAIN(x)) AOT_SLOW(" << n << ");\n";
+        out << "    m[" << SP_ADDR << "] = x + 1; " << a << " = m[x];\n";
+        break;
+    case OpCode::CALL:
+        out << "    x = m[" << SP_ADDR << "] - 1; if (!AOT_PLAIN(x)) AOT_SLOW(" << n << ");\n";
+        out << "    m[" << SP_ADDR << "] = x; m[x] = " << literal(n + 1) << ";\n";
+        out << "    AOT_RETIRE();\n";
+        out << "    " << jumpTo(instr.arg1, program.size()) << "\n";
+        return;
+    default: // RET
+        out << "    x = m[" << SP_ADDR << "]; if (!AOT_PLAIN(x)) AOT_SLOW(" << n << ");\n";
+        out << "    pc = m[x]; m[" << SP_ADDR << "] = x + 1;\n";
+        out << "    AOT_RETIRE();\n";
+        out << "    goto ret_dispatch;\n";
+        return;
+    }
+    out << "    AOT_RETIRE();\n";
+}
+
+void emitProgram(std::ostream &out, const std::string &image_name, const Memory &memory,
+                 const std::vector<Instruction> &instructions, const DecodedProgram &program,
+                 unsigned long max_cycles)
+{
+    const size_t size = program.size();
+
+    out << "// Generated by tools/gtu_aot from " << image_name << ". Do not edit.\n"
+        << "#include \"cpu.h\"\n"
+        << "#include \"instruction.h\"\n"
+        << "#include \"memory.h\"\n"
+        << "#include \"prn_sink.h\"\n"
+        << "#include <iostream>\n"
+        << "#include <vector>\n"
+        << "#include <unistd.h>\n\n"
+        << "namespace\n{\n"
+        << "constexpr size_t AOT_MEMORY_SIZE = " << memory.getSize() << ";\n"
+        << "constexpr unsigned long AOT_MAX_CYCLES = " << max_cycles << "UL; // 0: no limit\n\n";
+
+    // Data section: the non-zero cells after loading
+    out << "// Data section: {address, value}\n"
+        << "const long AOT_DATA_IMAGE[][2] = {\n";
+    size_t data_cells = 0;
+    for (size_t address = 0; address < memory.getSize(); ++address) {
+        long value = memory.readUnchecked(static_cast<long>(address));
+        if (value != 0) {
+            out << "    {" << address << ", " << literal(value) << "},\n";
+            ++data_cells;
+        }
+    }
+    if (data_cells == 0)
+        out << "    {0, 0L},\n";
+    out << "};\n\n";
+
+    // Instruction section for the CPU, which executes the instructions handed to it
+    out << "struct AotInstruction\n{\n"
+        << "    OpCode opcode;\n    long arg1;\n    long arg2;\n    int num_operands;\n"
+        << "    const char *original_line;\n    int source_line;\n};\n\n"
+        << "const AotInstruction AOT_INSTRUCTIONS[] = {\n";
+    for (const Instruction &instr : instructions) {
+        out << "    {static_cast<OpCode>(" << static_cast<int>(instr.opcode) << "), "
+            << literal(instr.arg1) << ", " << literal(instr.arg2) << ", " << instr.num_operands << ", "
+            << quoted(instr.original_line) << ", " << instr.source_line << "},\n";
+    }
+    if (instructions.empty())
+        out << "    {OpCode::UNKNOWN, 0L, 0L, 0, \"\", 0},\n";
+    out << "};\n"
+        << "} // namespace\n\n";
+
+    out << "int main()\n{\n"
+        << "    Memory memory(AOT_MEMORY_SIZE);\n"
+        << "    for (const auto &data_cell : AOT_DATA_IMAGE)\n"
+        << "        memory.write(data_cell[0], data_cell[1]);\n"
+        << "    std::vector<Instruction> instructions;\n"
+        << "    for (size_t i = 0; i < " << instructions.size() << "; ++i)\n"
+        << "    {\n"
+        << "        const AotInstruction &instr = AOT_INSTRUCTIONS[i];\n"
+        << "        instructions.emplace_back(instr.opcode, instr.arg1, instr.arg2, instr.num_operands, instr.original_line, instr.source_line);\n"
+        << "    }\n"
+        << "    FdPrnSink prn(STDOUT_FILENO);\n"
+        << "    prn.orderBefore(std::cerr);\n"
+        << "    CPU cpu(memory, instructions, prnCallback(prn));\n\n"
+        << "    // PC lives in pc while running inline code; SP and the instruction counter stay in memory.\n"
+        << "    long *const m = memory.data();\n"
+        << "    [[maybe_unused]] const unsigned long user_span = AOT_MEMORY_SIZE > " << USER_MEMORY_START_ADDR
+        << " ? AOT_MEMORY_SIZE - " << USER_MEMORY_START_ADDR << " : 0;\n"
+        << "    [[maybe_unused]] bool user = false;\n"
+        << "    unsigned long cycles = 0;\n"
+        << "    long pc = m[" << PC_ADDR << "];\n"
+        << "    [[maybe_unused]] long x = 0, y = 0;\n\n"
+        << "// Cycle limit check before each instruction, as in gtu_sim\n"
+        << "#define AOT_BEGIN(n) do { if (AOT_MAX_CYCLES != 0 && cycles == AOT_MAX_CYCLES) { pc = (n); goto limit; } } while (0)\n"
+        << "// Let the CPU execute the instruction at n\n"
+        << "#define AOT_SLOW(n) do { pc = (n); goto slow; } while (0)\n"
+        << "#define AOT_RETIRE() (++m[" << INSTR_COUNT_ADDR << "], ++cycles)\n"
+        << "// Address that needs no checks in the current privilege mode (CPU::isPlainAddress)\n"
+        << "#define AOT_PLAIN(a) (user ? static_cast<unsigned long>((a) - " << USER_MEMORY_START_ADDR << ") < user_span\\\n"
+        << "                           : ((a) > " << INSTR_COUNT_ADDR << " && static_cast<unsigned long>(a) < AOT_MEMORY_SIZE))\n\n"
+        << "    goto dispatch;\n\n";
+
+    for (size_t pc = 0; pc < size; ++pc)
+        emitInstruction(out, program, pc);
+    out << "    AOT_SLOW(" << size << "); // Past the last instruction\n\n";
+
+    // Return addresses first, anything else through the full table
+    std::set<long> return_addresses;
+    bool has_ret = false;
+    for (size_t pc = 0; pc < size; ++pc) {
+        if (program.code[pc].opcode == OpCode::CALL && pc + 1 < size)
+            return_addresses.insert(static_cast<long>(pc + 1));
+        has_ret = has_ret || program.code[pc].opcode == OpCode::RET;
+    }
+    if (has_ret) {
+        out << "ret_dispatch:\n    switch (pc)\n    {\n";
+        for (long address : return_addresses)
+            out << "    case " << address << ": goto L" << address << ";\n";
+        out << "    default: goto dispatch;\n    }\n\n";
+    }
+
+    out << "dispatch:\n    switch (pc)\n    {\n";
+    for (size_t pc = 0; pc < size; ++pc)
+        out << "    case " << pc << ": goto L" << pc << ";\n";
+    out << "    default: goto slow;\n    }\n\n";
+
+    out << "slow:\n"
+        << "    AOT_BEGIN(pc);\n"
+        << "    m[" << PC_ADDR << "] = pc;\n"
+        << "    cpu.syncRegistersFromMemory();\n"
+        << "    cpu.step();\n"
+        << "    cpu.syncRegistersToMemory();\n"
+        << "    ++cycles;\n"
+        << "    if (cpu.isHalted())\n"
+        << "        goto halted;\n"
+        << "    user = cpu.isInUserMode();\n"
+        << "    pc = m[" << PC_ADDR << "];\n"
+        << "    goto dispatch;\n\n"
+        << "limit:\n"
+        << "    m[" << PC_ADDR << "] = pc;\n"
+        << "    std::cerr << \"Program terminated: Maximum cycle limit reached (\" << AOT_MAX_CYCLES << \").\" << std::endl;\n"
+        << "    goto done;\n\n"
+        << "halted:\n"
+        << "    prn.flush();\n"
+        << "    std::cout << \"Program HLT instruction executed after \" << cycles << \" cycles.\" << std::endl;\n\n"
+        << "done:\n"
+        << "    std::cerr << \"--- Memory Dump After Halt ---\" << std::endl;\n"
+        << "    memory.dumpImportantRegions(std::cerr);\n"
+        << "    return 0;\n"
+        << "}\n";
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    std::string input_filename;
+    std::string output_filename;
+    size_t memory_size = 11000; // gtu_sim's default
+    unsigned long max_cycles = AOT_DEFAULT_MAX_CYCLES;
+
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if ((arg == "--memory-size" || arg == "-m") && i + 1 < argc) {
+            try {
+                memory_size = std::stoul(argv[++i]);
+            } catch (const std::exception &) {
+                memory_size = 0;
+            }
+            if (memory_size == 0) {
+                std::cerr << "Error: Invalid value for --memory-size: " << argv[i] << std::endl;
+                return 1;
+            }
+        } else if (arg == "--max-cycles" && i + 1 < argc) {
+            std::string count = argv[++i];
+            size_t used = 0;
+            try {
+                max_cycles = std::stoul(count, &used);
+            } catch (const std::exception &) {
+                used = 0;
+            }
+            if (used == 0 || used != count.size() || count[0] == '-') {
+                std::cerr << "Error: Invalid value for --max-cycles: " << count << std::endl;
+                return 1;
+            }
+        } else if (input_filename.empty()) {
+            input_filename = arg;
+        } else if (output_filename.empty()) {
+            output_filename = arg;
+        } else {
+            input_filename.clear();
+            break;
+        }
+    }
+
+    if (input_filename.empty()) {
+        std::cerr << "Usage: ./gtu_aot <input_file.img> [output_file.cpp] [--memory-size <size_in_longs>] [--max-cycles <n|0>]" << std::endl;
+        std::cerr << "Build the output with 'make <name>_aot' or link it against the simulator objects except main.o." << std::endl;
+        return 1;
+    }
+    if (output_filename.empty()) {
+        size_t dot_pos = input_filename.rfind(".img");
+        output_filename = (dot_pos != std::string::npos ? input_filename.substr(0, dot_pos) : input_filename) + "_aot.cpp";
+    }
+
+    std::ifstream infile(input_filename);
+    if (!infile.is_open()) {
+        std::cerr << "Error: Could not open input file '" << input_filename << "'." << std::endl;
+        return 1;
+    }
+
+    Memory memory(memory_size);
+    std::vector<Instruction> instructions;
+    int lines_read = 0;
+    if (!memory.loadDataSection(infile, lines_read))
+        return 1; // Error message already printed by loadDataSection
+
+    DecodedProgram program;
+    try {
+        instructions = parseInstructionSection(infile, input_filename, lines_read);
+        program = decodeProgram(instructions);
+    } catch (const std::runtime_error &e) {
+        std::cerr << "Error parsing instruction section: " << e.what() << std::endl;
+        return 1;
+    }
+    markProvenOperands(program, memory.getSize());
+
+    std::ofstream outfile(output_filename);
+    if (!outfile.is_open()) {
+        std::cerr << "Error: Could not open output file '" << output_filename << "'." << std::endl;
+        return 1;
+    }
+    emitProgram(outfile, input_filename, memory, instructions, program, max_cycles);
+    if (!outfile) {
+        std::cerr << "Error: Failed writing '" << output_filename << "'." << std::endl;
+        return 1;
+    }
+
+    std::cout << "Recompiled " << program.size() << " instructions from '" << input_filename
+              << "' to '" << output_filename << "'." << std::endl;
+    return 0;
+}
@@ -0,0 +1,170 @@
+// tools/gtu_trace.cpp (TRACE READER: gtu_sim --trace=<file> -> text)
+//
+// Prints the records of a binary trace one instruction per line, optionally filtered:
+//
+//   <cycle> <pc> <U|K> <OPCODE> <arg1> <arg2> [r@<addr>] [w@<addr>=<value>] [->U|->K] [event=<n>] [HALT]
+//
+// The mode letter is the mode the instruction executed in; "->U"/"->K" marks a mode switch.
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <cstring>
+#include <cstdint>
+
+#include "instruction.h"
+#include "trace.h"
+
+namespace {
+
+struct TraceFilter {
+    bool pc_set = false;
+    int64_t pc = 0;
+    bool opcode_set = false;
+    std::string opcode;
+    int mode = -1; // 1 user, 0 kernel, -1 both
+    bool address_set = false;
+    int64_t address = 0; // Read or written
+    uint64_t from = 0;
+    uint64_t to = UINT64_MAX; // Exclusive
+    bool events_only = false;
+
+    bool matches(const TraceRecord &record) const
+    {
+        if (record.cycle < from || record.cycle >= to)
+            return false;
+        if (pc_set && record.pc != pc)
+            return false;
+        if (mode >= 0 && ((record.flags & TRACE_USER_MODE) != 0) != (mode == 1))
+            return false;
+        if (address_set && record.read_address != address && record.write_address != address)
+            return false;
+        if (events_only && record.event == 0)
+            return false;
+        return !opcode_set || opCodeToString(static_cast<OpCode>(record.opcode)) == opcode;
+    }
+};
+
+void printRecord(std::ostream &out, const TraceRecord &record)
+{
+    bool user = (record.flags & TRACE_USER_MODE) != 0;
+    bool user_after = (record.flags & TRACE_USER_MODE_AFTER) != 0;
+    out << record.cycle << ' ' << record.pc << ' ' << (user ? 'U' : 'K') << ' '
+        << opCodeToString(static_cast<OpCode>(record.opcode)) << ' ' << record.arg1 << ' ' << record.arg2;
+    if (record.read_address != TRACE_NO_ADDRESS)
+        out << " r@" << record.read_address;
+    if (record.write_address != TRACE_NO_ADDRESS)
+        out << " w@" << record.write_address << '=' << record.value_written;
+    if (user_after != user)
+        out << (user_after ? " ->U" : " ->K");
+    if (record.event != 0)
+        out << " event=" << static_cast<int>(record.event);
+    if (record.flags & TRACE_HALTED)
+        out << " HALT";
+    out << '\n';
+}
+
+// Parses the value of --name=<integer>. Returns false if arg is not that option.
+bool integerOption(const std::string &arg, const std::string &name, int64_t &value)
+{
+    if (arg.compare(0, name.size(), name) != 0)
+        return false;
+    std::string text = arg.substr(name.size());
+    size_t used = 0;
+    value = std::stoll(text, &used);
+    if (used != text.size())
+        throw std::invalid_argument(text);
+    return true;
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    std::string input_filename;
+    TraceFilter filter;
+    bool count_only = false;
+
+    try {
+        for (int i = 1; i < argc; ++i) {
+            std::string arg = argv[i];
+            int64_t value = 0;
+            if (integerOption(arg, "--pc=", value)) {
+                filter.pc_set = true;
+                filter.pc = value;
+            } else if (integerOption(arg, "--addr=", value)) {
+                filter.address_set = true;
+                filter.address = value;
+            } else if (integerOption(arg, "--from=", value)) {
+                filter.from = static_cast<uint64_t>(value);
+            } else if (integerOption(arg, "--to=", value)) {
+                filter.to = static_cast<uint64_t>(value);
+            } else if (arg.compare(0, 5, "--op=") == 0) {
+                filter.opcode_set = true;
+                filter.opcode = arg.substr(5);
+            } else if (arg == "--mode=user" || arg == "--mode=kernel") {
+                filter.mode = arg == "--mode=user" ? 1 : 0;
+            } else if (arg == "--events") {
+                filter.events_only = true;
+            } else if (arg == "--count") {
+                count_only = true;
+            } else if (input_filename.empty() && arg.compare(0, 2, "--") != 0) {
+                input_filename = arg;
+            } else {
+                input_filename.clear();
+                break;
+            }
+        }
+    } catch (const std::exception &) {
+        input_filename.clear();
+    }
+
+    if (input_filename.empty()) {
+        std::cerr << "Usage: ./gtu_trace <trace_file> [--pc=<n>] [--op=<OPCODE>] [--mode=<user|kernel>] [--addr=<n>]" << std::endl;
+        std::cerr << "                   [--from=<cycle>] [--to=<cycle>] [--events] [--count]" << std::endl;
+        return 1;
+    }
+
+    std::ifstream infile(input_filename, std::ios::binary);
+    if (!infile.is_open()) {
+        std::cerr << "Error: Could not open trace file '" << input_filename << "'." << std::endl;
+        return 1;
+    }
+
+    TraceFileHeader header;
+    if (!infile.read(reinterpret_cast<char *>(&header), sizeof(header)) ||
+        std::memcmp(header.magic, TRACE_MAGIC, sizeof(header.magic)) != 0) {
+        std::cerr << "Error: '" << input_filename << "' is not a gtu_sim trace." << std::endl;
+        return 1;
+    }
+    if (header.version != TRACE_VERSION || header.record_size != sizeof(TraceRecord)) {
+        std::cerr << "Error: Unsupported trace version " << header.version << " in '" << input_filename << "'." << std::endl;
+        return 1;
+    }
+
+    // Records are read in large chunks; a partial record at the end is reported
+    std::vector<TraceRecord> chunk(4096);
+    uint64_t matched = 0;
+    for (;;) {
+        infile.read(reinterpret_cast<char *>(chunk.data()), chunk.size() * sizeof(TraceRecord));
+        std::streamsize bytes = infile.gcount();
+        size_t records = static_cast<size_t>(bytes) / sizeof(TraceRecord);
+        for (size_t i = 0; i < records; ++i) {
+            if (!filter.matches(chunk[i]))
+                continue;
+            ++matched;
+            if (!count_only)
+                printRecord(std::cout, chunk[i]);
+        }
+        if (static_cast<size_t>(bytes) % sizeof(TraceRecord) != 0) {
+            std::cerr << "Warning: '" << input_filename << "' ends with a truncated record." << std::endl;
+            break;
+        }
+        if (!infile)
+            break;
+    }
+
+    if (count_only)
+        std::cout << matched << std::endl;
+    return 0;
+}